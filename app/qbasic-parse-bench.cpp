@@ -0,0 +1,163 @@
+#include <PreparedProgram.h>
+#include <Syntax.h>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+
+namespace {
+
+void usage(const char *prog) {
+    std::cerr << "usage: " << prog << " [--lines N] [--runs N]\n"
+              << "Parse a generated program of N lines in each parse mode, "
+                 "and with the hand-written parser, and compare the time "
+                 "taken.\n";
+}
+
+/// Read a whole argument as a number.
+bool parse_int(const char *text, int &value) {
+    auto end = text + std::strlen(text);
+    auto [ptr, ec] = std::from_chars(text, end, value);
+    return ec == std::errc{} && ptr == end;
+}
+
+/// An expression of at most `depth` levels of nested operators.
+std::string gen_expr(std::mt19937 &rng, int depth) {
+    static const char *const ops[] = {" + ", " - ", " * ", " / ", " MOD ",
+                                      " ** "};
+    std::uniform_int_distribution<int> pick(0, 9);
+    if (depth == 0 || pick(rng) < 2) {
+        if (pick(rng) < 5) {
+            return std::string(1, static_cast<char>('a' + pick(rng)));
+        }
+        return std::to_string(pick(rng) * 37);
+    }
+    auto expr = gen_expr(rng, depth - 1) + ops[pick(rng) % 6] +
+                gen_expr(rng, depth - 1);
+    switch (pick(rng)) {
+    case 0:
+        return "-" + expr;
+    case 1:
+    case 2:
+        return "(" + expr + ")";
+    default:
+        return expr;
+    }
+}
+
+/// A program in the shape of machine-generated code: mostly long
+/// assignments, with tests, jumps and output in between.
+basic::Fragment gen_program(int lines) {
+    std::mt19937 rng{42};
+    std::uniform_int_distribution<int> pick(0, 9);
+    basic::Fragment frag{};
+    for (int i = 0; i < lines; ++i) {
+        auto var = std::string(1, static_cast<char>('a' + pick(rng)));
+        auto kind = pick(rng);
+        auto target = std::to_string(100 + 10 * (i + 1 + pick(rng)));
+        if (kind < 5) {
+            frag.append("LET " + var + " = " + gen_expr(rng, 5));
+        } else if (kind < 7) {
+            frag.append("IF " + gen_expr(rng, 3) + (kind == 5 ? " < " : " = ") +
+                        gen_expr(rng, 3) + " THEN " + target);
+        } else if (kind == 7) {
+            frag.append("PRINT " + gen_expr(rng, 4));
+        } else if (kind == 8) {
+            frag.append("GOTO " + target);
+        } else {
+            frag.append("REM generated line " + std::to_string(i));
+        }
+    }
+    frag.append("END");
+    return frag;
+}
+
+void report(const char *name, const basic::ParseStats &stats, int runs) {
+    using std::chrono::duration;
+    auto ms = [runs](std::chrono::nanoseconds time) {
+        return duration<double, std::milli>(time).count() / runs;
+    };
+    std::cout << name << ": " << ms(stats.sll_time + stats.ll_time)
+              << " ms per parse (SLL " << stats.sll_parses << " parses, "
+              << ms(stats.sll_time) << " ms; LL " << stats.ll_parses
+              << " parses, " << ms(stats.ll_time) << " ms)\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    int lines = 20000;
+    int runs = 5;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--lines" && has_value && parse_int(argv[i + 1], lines)) {
+            ++i;
+        } else if (arg == "--runs" && has_value &&
+                   parse_int(argv[i + 1], runs)) {
+            ++i;
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (lines <= 0 || runs <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    auto frag = gen_program(lines);
+    basic::ParseStats ll_stats{};
+    basic::ParseStats two_stage_stats{};
+    // Whole calls: rendering, lexing, parsing and decoding, as the parse
+    // stats of the hand-written parser count them.
+    std::chrono::nanoseconds ll_total{};
+    std::chrono::nanoseconds two_stage_total{};
+    std::chrono::nanoseconds hand_written_total{};
+    auto timed = [](std::chrono::nanoseconds &total, auto &&prepare) {
+        auto start = std::chrono::steady_clock::now();
+        auto result = prepare();
+        total += std::chrono::steady_clock::now() - start;
+        return result;
+    };
+    // Alternate the modes, so that all see the same warm caches.
+    for (int run = 0; run < runs; ++run) {
+        auto ll = timed(ll_total, [&] {
+            return basic::PreparedProgram::prepare(
+                frag, basic::ParseMode::LL, &ll_stats);
+        });
+        auto two_stage = timed(two_stage_total, [&] {
+            return basic::PreparedProgram::prepare(
+                frag, basic::ParseMode::TWO_STAGE, &two_stage_stats);
+        });
+        auto hand_written = timed(hand_written_total, [&] {
+            return basic_syntax::SourceProgram::parse(frag);
+        });
+        if (!ll || !two_stage || !hand_written) {
+            std::cerr << argv[0] << ": the generated program doesn't parse\n";
+            return 1;
+        }
+    }
+
+    std::cout << lines + 1 << " lines, " << runs << " runs\n";
+    report("LL", ll_stats, runs);
+    report("SLL then LL", two_stage_stats, runs);
+    auto ll_time = ll_stats.sll_time + ll_stats.ll_time;
+    auto two_stage_time = two_stage_stats.sll_time + two_stage_stats.ll_time;
+    if (two_stage_time.count() > 0) {
+        std::cout << "speedup: "
+                  << static_cast<double>(ll_time.count()) /
+                         static_cast<double>(two_stage_time.count())
+                  << "x\n";
+    }
+    auto ms = [runs](std::chrono::nanoseconds time) {
+        return std::chrono::duration<double, std::milli>(time).count() / runs;
+    };
+    std::cout << "end to end, with rendering and decoding: LL "
+              << ms(ll_total) << " ms, SLL then LL " << ms(two_stage_total)
+              << " ms, hand-written " << ms(hand_written_total) << " ms\n";
+    return 0;
+}
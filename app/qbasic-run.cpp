@@ -0,0 +1,6 @@
+#include "run-file.h"
+
+int main(int argc, char *argv[]) {
+    return basic::run_file(argc, argv,
+                           basic::Interpreter::ExecMode::BYTECODE);
+}
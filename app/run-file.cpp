@@ -0,0 +1,115 @@
+#include "run-file.h"
+#include <fstream>
+#include <iostream>
+#include <string_view>
+
+namespace {
+
+using basic::Interpreter;
+
+const char *mode_name(Interpreter::ExecMode mode) {
+    switch (mode) {
+    case Interpreter::ExecMode::TREE_WALK:
+        return "tree-walk";
+    case Interpreter::ExecMode::AOT:
+        return "aot";
+    default:
+        return "bytecode";
+    }
+}
+
+void usage(const char *prog, Interpreter::ExecMode default_mode) {
+    std::cerr << "usage: " << prog
+              << " [--mode bytecode|tree-walk|aot] [--dump-cfg DOT]"
+                 " [--no-solve-loops] [--cc COMPILER] [--cflags FLAGS]"
+                 " [--cache-dir DIR] FILE\n"
+                 "Run a Basic program. INPUT reads the standard input.\n"
+                 "--mode selects how the program runs (default: "
+              << mode_name(default_mode)
+              << ").\n"
+                 "--dump-cfg writes the control-flow graph with execution "
+                 "counts to DOT. Not written by the tree walker.\n"
+                 "--no-solve-loops runs every iteration of counted loops.\n"
+                 "--cc, --cflags and --cache-dir set up the compiler of "
+                 "the aot mode.\n";
+}
+
+} // namespace
+
+namespace basic {
+
+int run_file(int argc, char *argv[], Interpreter::ExecMode default_mode) {
+    auto mode = default_mode;
+    basic_vm::AotOptions options{};
+    basic_vm::OptimizeOptions optimize_options{};
+    const char *path = nullptr;
+    const char *dot_path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--mode" && has_value) {
+            std::string_view value = argv[++i];
+            if (value == "bytecode") {
+                mode = Interpreter::ExecMode::BYTECODE;
+            } else if (value == "tree-walk") {
+                mode = Interpreter::ExecMode::TREE_WALK;
+            } else if (value == "aot") {
+                mode = Interpreter::ExecMode::AOT;
+            } else {
+                usage(argv[0], default_mode);
+                return 2;
+            }
+        } else if (arg == "--cc" && has_value) {
+            options.compiler = argv[++i];
+        } else if (arg == "--cflags" && has_value) {
+            options.flags = argv[++i];
+        } else if (arg == "--cache-dir" && has_value) {
+            options.cache_dir = argv[++i];
+        } else if (arg == "--dump-cfg" && has_value) {
+            dot_path = argv[++i];
+        } else if (arg == "--no-solve-loops") {
+            optimize_options.solve_counted_loops = false;
+        } else if (path == nullptr && !arg.empty() && arg[0] != '-') {
+            path = argv[i];
+        } else {
+            usage(argv[0], default_mode);
+            return 2;
+        }
+    }
+    if (path == nullptr) {
+        usage(argv[0], default_mode);
+        return 2;
+    }
+
+    std::ifstream ifs{path};
+    if (!ifs.is_open()) {
+        std::cerr << argv[0] << ": cannot open " << path << '\n';
+        return 1;
+    }
+    auto frag = std::make_shared<Fragment>(Fragment::read_stream(ifs));
+
+    std::ofstream dot{};
+    if (dot_path != nullptr) {
+        dot.open(dot_path);
+        if (!dot.is_open()) {
+            std::cerr << argv[0] << ": cannot open " << dot_path << '\n';
+            return 1;
+        }
+    }
+
+    Interpreter inter{frag, std::cout, std::cerr, std::cin};
+    inter.set_exec_mode(mode);
+    inter.set_aot_options(options);
+    inter.set_optimize_options(optimize_options);
+    if (dot.is_open()) {
+        inter.set_cfg_dump(&dot);
+    }
+    inter.interpret();
+    if (!inter.get_aot_log().empty()) {
+        std::cerr << argv[0] << ": ran on the VM instead: "
+                  << inter.get_aot_log();
+    }
+    return 0;
+}
+
+} // namespace basic
@@ -0,0 +1,19 @@
+#ifndef QBASIC_RUN_FILE_H
+#define QBASIC_RUN_FILE_H
+
+#include <Interpreter.h>
+
+namespace basic {
+
+/**
+ * @brief The `main` of the command-line runners: run the Basic file named on
+ * the command line, with INPUT reading the standard input.
+ *
+ * @param default_mode The execution mode unless `--mode` says otherwise.
+ * @return The exit code: 2 on bad arguments, 1 if a file can't be opened.
+ */
+int run_file(int argc, char *argv[], Interpreter::ExecMode default_mode);
+
+} // namespace basic
+
+#endif // QBASIC_RUN_FILE_H
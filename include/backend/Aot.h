@@ -0,0 +1,97 @@
+#ifndef BASIC_AOT_H
+#define BASIC_AOT_H
+
+#include "Bytecode.h"
+#include <filesystem>
+#include <memory>
+
+namespace basic_vm {
+
+/**
+ * @brief The VM state that a compiled program reads and updates, and the
+ * callbacks it uses for everything that is not plain arithmetic.
+ *
+ * The layout is repeated in the C code emitted by `emit_c`, so it must only
+ * hold C types.
+ */
+struct AotContext {
+    VarType *vars{};
+    int *ref_times{};
+    int *hits{};
+    int *taken{};
+    /// Passed back as the first argument of each callback.
+    void *host{};
+    /// Report a read of an undefined variable slot by the instruction at pc.
+    /// rhs is nonzero for the second variable of IF_VAR_*_VAR.
+    void (*undefined)(void *host, std::uint32_t pc, std::uint32_t slot,
+                      int rhs){};
+    /// Report the failure of the DIV, MOD, POW or BAD_LINE at pc.
+    void (*fail)(void *host, std::uint32_t pc, VarType lhs, VarType rhs){};
+    void (*print)(void *host, VarType value){};
+    /// Read a value into the variable slot, or report why it can't.
+    void (*input)(void *host, std::uint32_t slot){};
+    /// Run the counted loop at once if its values allow. Nonzero if it did.
+    int (*solve_loop)(void *host, std::uint32_t index){};
+};
+
+/**
+ * @brief A program compiled ahead of time to a shared library, and loaded.
+ */
+class AotModule {
+
+public:
+    using EntryPoint = void (*)(AotContext *ctx);
+
+    AotModule(void *handle, EntryPoint entry) noexcept;
+
+    // No copy or move.
+    AotModule(const AotModule &other) = delete;
+    AotModule(AotModule &&other) = delete;
+    AotModule &operator=(const AotModule &other) = delete;
+    AotModule &operator=(AotModule &&other) = delete;
+
+    ~AotModule();
+
+    void run(AotContext &ctx) const {
+        entry(&ctx);
+    }
+
+private:
+    void *handle;
+    EntryPoint entry;
+};
+
+struct AotOptions {
+    /// The C compiler, run through the shell.
+    std::string compiler = "cc";
+    std::string flags = "-O2";
+    /// Where compiled programs are kept, by the hash of their C code. Empty
+    /// for a directory under the system's temporary directory.
+    std::filesystem::path cache_dir{};
+};
+
+/**
+ * @return Whether this build can load compiled programs.
+ */
+bool aot_available() noexcept;
+
+/**
+ * @brief Translate the program to a C function `qbasic_main(AotContext *)`
+ * that behaves like `VirtualMachine::run`, one label per instruction.
+ */
+std::string emit_c(const Program &program);
+
+/**
+ * @brief Compile the program with the system C compiler and load it, or load
+ * it from the cache if the same code was compiled before.
+ *
+ * @param log Receives the reason of a failure, e.g. the compiler's messages.
+ * @return nullptr if loading is not available or the compiler failed.
+ */
+std::unique_ptr<AotModule> aot_compile(const Program &program,
+                                       const AotOptions &options,
+                                       std::ostream &log);
+
+} // namespace basic_vm
+
+#endif // BASIC_AOT_H
@@ -0,0 +1,192 @@
+#ifndef BASIC_BYTECODE_H
+#define BASIC_BYTECODE_H
+
+#include "IR.h"
+#include <map>
+#include <optional>
+
+namespace basic_vm {
+
+/// Index of a virtual register.
+using Reg = std::uint16_t;
+
+/**
+ * Operands used by each opcode. `r[x]` is a register, `vars[x]` is a variable
+ * slot, `imm` and `index` are the corresponding fields of the instruction.
+ */
+enum class OpCode : std::uint8_t {
+    LOAD_CONST, ///< r[dst] = imm
+    LOAD_VAR,   ///< r[dst] = vars[index]
+    NEG,        ///< r[dst] = -r[a]
+    ADD,        ///< r[dst] = r[a] + r[b]
+    SUB,        ///< r[dst] = r[a] - r[b]
+    MUL,        ///< r[dst] = r[a] * r[b]
+    DIV,        ///< r[dst] = r[a] / r[b]
+    MOD,        ///< r[dst] = r[a] MOD r[b]
+    POW,        ///< r[dst] = r[a] ** r[b]
+    SQUARE,     ///< r[dst] = r[a] * r[a]
+    CUBE,       ///< r[dst] = r[a] * r[a] * r[a]
+    DIV_POW2,   ///< r[dst] = r[a] / divisors[index], by shifting
+    DIV_MAGIC,  ///< r[dst] = r[a] / divisors[index], by multiplying
+    MOD_POW2,   ///< r[dst] = r[a] MOD divisors[index], by masking
+    MOD_MAGIC,  ///< r[dst] = r[a] MOD divisors[index], by multiplying
+    FAIL,       ///< r[dst] fails, the error is already reported
+    LET,        ///< vars[index] = r[a]
+    PRINT,      ///< print r[a]
+    INPUT,      ///< vars[index] = input
+    GOTO,       ///< jump to pc index
+    IF_EQ,      ///< if r[a] = r[b], jump to pc index
+    IF_LT,      ///< if r[a] < r[b], jump to pc index
+    IF_GT,      ///< if r[a] > r[b], jump to pc index
+    // Superinstructions, each performing a whole statement. Variables are
+    // read and checked just like LOAD_VAR does.
+    INC_VAR,         ///< vars[index] = vars[index] + imm
+    MOVE_VAR,        ///< vars[index] = vars[a]
+    IF_VAR_EQ_CONST, ///< if vars[a] = imm, jump to pc index
+    IF_VAR_LT_CONST, ///< if vars[a] < imm, jump to pc index
+    IF_VAR_GT_CONST, ///< if vars[a] > imm, jump to pc index
+    IF_VAR_EQ_VAR,   ///< if vars[a] = vars[b], jump to pc index
+    IF_VAR_LT_VAR,   ///< if vars[a] < vars[b], jump to pc index
+    IF_VAR_GT_VAR,   ///< if vars[a] > vars[b], jump to pc index
+    // Support for `eliminate_dead_stores` and `hoist_invariants`. The value
+    // of an INVARIANT node is kept in a hidden slot after the variables,
+    // defined as long as it is up to date.
+    COUNT,          ///< count a LET whose value is discarded
+    TOUCH_VAR,      ///< read vars[index] like LOAD_VAR, without the value
+    LOAD_INVARIANT, ///< if vars[index] is defined, r[dst] = vars[index], count
+                    ///< the reads it stands for and go on at pc imm
+    SAVE_INVARIANT, ///< vars[index] = r[a]
+    DROP_INVARIANT, ///< undefine vars[index]
+    SOLVE_LOOP,     ///< run counted_loops[index] at once if its values allow,
+                    ///< and go on at pc imm
+    END,        ///< stop
+    BAD_LINE,   ///< report that line index doesn't exist, and stop
+};
+
+/**
+ * @brief A constant divisor, prepared so that division needs no divide
+ * instruction.
+ *
+ * The results are exactly those of `wrapping_div` and `modulo_of`: the
+ * quotient is truncated, and the remainder takes the sign of the divisor.
+ */
+struct Divisor {
+    VarType value{};
+    /// If the magnitude of the divisor is 2 ** shift, multiplier is 0.
+    /// Otherwise the quotient is the high half of multiplier * n, corrected
+    /// and shifted right by shift (Hacker's Delight, 10-1).
+    VarType multiplier{};
+    std::uint32_t shift{};
+
+    /**
+     * @pre The magnitude of value is at least 2.
+     */
+    static Divisor of(VarType value) noexcept;
+
+    bool is_pow2() const noexcept {
+        return multiplier == 0;
+    }
+
+    /// @pre is_pow2()
+    VarType shift_divide(VarType n) const noexcept {
+        // Bias a negative dividend by 2 ** shift - 1 to round toward 0.
+        auto bias = static_cast<std::uint32_t>(n >> 31) >> (32 - shift);
+        auto quotient = wrapping_add(n, static_cast<VarType>(bias)) >> shift;
+        return value < 0 ? wrapping_neg(quotient) : quotient;
+    }
+
+    /// @pre is_pow2()
+    VarType mask_modulo(VarType n) const noexcept {
+        auto mask = (std::uint32_t{1} << shift) - 1;
+        auto rem = static_cast<VarType>(static_cast<std::uint32_t>(n) & mask);
+        return value < 0 && rem != 0 ? wrapping_add(rem, value) : rem;
+    }
+
+    /// @pre !is_pow2()
+    VarType magic_divide(VarType n) const noexcept {
+        auto high = static_cast<VarType>(std::int64_t{multiplier} * n >> 32);
+        if (value > 0 && multiplier < 0) {
+            high = wrapping_add(high, n);
+        } else if (value < 0 && multiplier > 0) {
+            high = wrapping_sub(high, n);
+        }
+        high >>= shift;
+        // Round a negative quotient toward 0.
+        auto sign = static_cast<std::uint32_t>(high) >> 31;
+        return wrapping_add(high, static_cast<VarType>(sign));
+    }
+
+    /// @pre !is_pow2()
+    VarType magic_modulo(VarType n) const noexcept {
+        auto rem = wrapping_sub(n, wrapping_mul(magic_divide(n), value));
+        if (rem != 0 && (rem < 0) != (value < 0)) {
+            rem = wrapping_add(rem, value);
+        }
+        return rem;
+    }
+};
+
+struct Instruction {
+    OpCode op{};
+    Reg dst{}, a{}, b{};
+    VarType imm{};
+    std::uint32_t index{};
+};
+
+/**
+ * @brief The executable form of a `Module`.
+ *
+ * Every statement becomes a short run of register instructions that ends with
+ * the instruction performing its effect (LET, PRINT, GOTO, ...). Runs are laid
+ * out by line number, so falling through a statement is just `pc + 1`, and
+ * REM and ERROR lines don't appear at all. Jumps are resolved to the pc of
+ * their target when compiling: line 0 leads to the END that terminates the
+ * code, and each line that doesn't exist leads to a BAD_LINE placed after it.
+ *
+ * Some common statements, like `LET i = i + 1`, compile to a single
+ * superinstruction instead of a run.
+ */
+struct Program {
+    std::vector<Instruction> code{};
+    /// Source location of each instruction, only read when reporting errors.
+    std::vector<SourceLoc> locs{};
+    /// Line number of the statement each instruction belongs to, 0 for the
+    /// END and BAD_LINE after the last statement.
+    std::vector<LSize> lines{};
+    /// Location of the second variable read by IF_VAR_*_VAR instructions.
+    std::map<std::size_t, SourceLoc> rhs_locs{};
+    /// Name of each variable slot, only used for diagnostics and to build the
+    /// `VariableEnv` after a run.
+    std::vector<std::string> symbols{};
+    /// Constant divisors, referred to by DIV_* and MOD_* instructions.
+    std::vector<Divisor> divisors{};
+    /// For each hidden slot, which follow those of `symbols`, the variable
+    /// reads that LOAD_INVARIANT counts when it uses the kept value.
+    std::vector<std::vector<std::uint32_t>> invariant_reads{};
+    /// Referred to by SOLVE_LOOP instructions, which come right before the
+    /// first statement of the loop. The jump back skips them.
+    std::vector<CountedLoop> counted_loops{};
+    /// For each statement of the module, the instruction whose execution
+    /// counts as an execution of the statement, or `NO_PC`.
+    std::vector<std::size_t> stm_pc{};
+    std::size_t num_regs{};
+
+    /// Variable slots, hidden ones included.
+    std::size_t num_slots() const noexcept {
+        return symbols.size() + invariant_reads.size();
+    }
+
+    static constexpr std::size_t NO_PC = static_cast<std::size_t>(-1);
+};
+
+/**
+ * @brief Generate the bytecode for the module.
+ *
+ * @return std::optional<Program> Empty if the module exceeds the limits of the
+ * instruction encoding, e.g. an expression that is nested too deep.
+ */
+std::optional<Program> compile(const Module &module);
+
+} // namespace basic_vm
+
+#endif // BASIC_BYTECODE_H
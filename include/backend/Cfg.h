@@ -0,0 +1,83 @@
+#ifndef BASIC_CFG_H
+#define BASIC_CFG_H
+
+#include "IR.h"
+#include <iostream>
+
+namespace basic_vm {
+
+/**
+ * @brief A run of statements that is only entered at its first statement,
+ * and only left after its last.
+ */
+struct BasicBlock {
+    /// Statements [begin, end) of the module.
+    std::size_t begin{}, end{};
+    /// Where control goes next: the target of the last statement, if it
+    /// jumps, then the next block, if it falls through. `Cfg::EXIT` stands
+    /// for the end of the program.
+    std::vector<std::size_t> succs{};
+    std::vector<std::size_t> preds{};
+};
+
+/**
+ * @brief A natural loop: the blocks that can reach a jump back to the header
+ * without going through the header.
+ */
+struct Loop {
+    std::size_t header{};
+    /// The blocks that jump back to the header.
+    std::vector<std::size_t> latches{};
+    /// In ascending order, including the header.
+    std::vector<std::size_t> blocks{};
+};
+
+/**
+ * @brief The control-flow graph of a module.
+ *
+ * Jumps are by line number, so blocks start at the statements some GOTO or
+ * IF jumps to, and after each GOTO, IF and END. A jump to line 0 or to a line
+ * that doesn't exist ends the program. Blocks that can't be reached from the
+ * first one still appear, but belong to no loop.
+ */
+struct Cfg {
+    static constexpr std::size_t EXIT = static_cast<std::size_t>(-1);
+    static constexpr std::size_t NO_LOOP = static_cast<std::size_t>(-1);
+
+    std::vector<BasicBlock> blocks{};
+    /// The block of each statement.
+    std::vector<std::size_t> stm_block{};
+    /// The immediate dominator of each block, EXIT for the first block and
+    /// for those that can't be reached.
+    std::vector<std::size_t> idom{};
+    /// Loops with the same header are merged.
+    std::vector<Loop> loops{};
+    /// The innermost loop containing each block, or NO_LOOP.
+    std::vector<std::size_t> block_loop{};
+
+    bool is_reachable(std::size_t block) const noexcept {
+        return block == 0 || idom[block] != EXIT;
+    }
+};
+
+/**
+ * @brief Find the blocks, dominators and loops of the module.
+ */
+Cfg build_cfg(const Module &module);
+
+/**
+ * @brief Write the graph in the DOT language, one node per block listing its
+ * statements. Loop headers have a double border, and jumps back to them are
+ * dashed.
+ *
+ * @param hits, taken Execution counts of each statement, like
+ * `LowerVisitor::write_back` takes them. Blocks and edges are annotated with
+ * them unless they are empty.
+ */
+void write_dot(std::ostream &os, const Module &module, const Cfg &cfg,
+               const std::vector<int> &hits = {},
+               const std::vector<int> &taken = {});
+
+} // namespace basic_vm
+
+#endif // BASIC_CFG_H
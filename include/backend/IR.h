@@ -0,0 +1,194 @@
+#ifndef BASIC_IR_H
+#define BASIC_IR_H
+
+#include "common.h"
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace basic_vm {
+
+using namespace basic;
+
+/// Index of an expression node in `Module::exprs`.
+using ExprId = std::uint32_t;
+/// Index of an identifier in `Module::symbols`. It is also the slot of the
+/// variable at run time.
+using SymbolId = std::uint32_t;
+
+/**
+ * @brief Position of a token, in the same format as `log_error` expects.
+ */
+struct SourceLoc {
+    LSize line{};
+    /// 1-based column.
+    CSize column{};
+};
+
+enum class ExprKind : std::uint8_t {
+    CONST,
+    VAR,
+    NEG,
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    MOD,
+    POW,
+    /// A failure found at compile time and already reported. Evaluating it
+    /// fails without reporting again.
+    ERROR,
+    /// Produced by `reduce_strength`: `lhs ** 2` and `lhs ** 3`.
+    SQUARE,
+    CUBE,
+    /// Produced by `reduce_strength`: `lhs / operand` and `lhs MOD operand`,
+    /// where the divisor is a constant whose magnitude is at least 2. They
+    /// never fail on their own.
+    DIV_CONST,
+    MOD_CONST,
+    /// Produced by `hoist_invariants`: lhs, whose variables are not assigned
+    /// in the loop around it. Its value is kept from one evaluation to the
+    /// next, as long as none of the variables is assigned; the reads are
+    /// still counted every time.
+    INVARIANT,
+};
+
+struct Expr {
+    ExprKind kind{};
+    /// CONST: the value. VAR: the symbol id. DIV_CONST, MOD_CONST: the
+    /// divisor.
+    VarType operand{};
+    /// Operands of unary (lhs only, including SQUARE, CUBE, DIV_CONST,
+    /// MOD_CONST and INVARIANT) and binary nodes.
+    ExprId lhs{}, rhs{};
+    /// Where a failure of this node is reported: the ID token of a VAR, or the
+    /// first token of the right operand of DIV, MOD and POW.
+    SourceLoc loc{};
+};
+
+enum class StmKind : std::uint8_t {
+    REM,
+    LET,
+    PRINT,
+    INPUT,
+    GOTO,
+    IF,
+    END,
+    ERROR,
+};
+
+enum class CmpOp : std::uint8_t {
+    EQ,
+    LT,
+    GT,
+};
+
+struct Stm {
+    StmKind kind{};
+    LSize line{};
+    /// LET, INPUT: the assigned variable.
+    SymbolId var{};
+    /// LET, PRINT: the value. IF: the left-hand side.
+    ExprId expr{};
+    /// IF: the right-hand side.
+    ExprId rhs{};
+    CmpOp cmp{};
+    /// GOTO, IF: the line to jump to.
+    LSize target{};
+    /// LET: set by `eliminate_dead_stores` if the value is never read. The
+    /// statement still counts, and expr is still evaluated for the reads and
+    /// errors it makes, but the variable is left alone.
+    bool discard = false;
+};
+
+/**
+ * @brief `scale * counter + offset + sum of coefficient * variable`, with
+ * wrapping arithmetic. The variables are not assigned in the loop.
+ */
+struct AffineExpr {
+    VarType scale{};
+    VarType offset{};
+    std::vector<std::pair<SymbolId, VarType>> terms{};
+};
+
+/**
+ * @brief A loop of `solve_counted_loops` whose whole run can be computed at
+ * once: a single block of LET statements ending with an IF that compares the
+ * counter with a limit and jumps back to the first statement.
+ */
+struct CountedLoop {
+    /// Statements [begin, end) of the module, the IF being the last.
+    std::size_t begin{}, end{};
+    SymbolId counter{};
+    /// The counter statement is `LET counter = counter + step`.
+    std::size_t counter_stm{};
+    VarType step{};
+    /// The loop goes on while `counter cmp limit` after an iteration.
+    CmpOp cmp{};
+    AffineExpr limit{};
+
+    enum class UpdateKind : std::uint8_t {
+        /// `LET var = var + value`.
+        ACCUMULATE,
+        /// `LET var = value`.
+        ASSIGN,
+        /// A discarded store, only counted.
+        NONE,
+    };
+
+    struct Update {
+        std::size_t stm{};
+        UpdateKind kind{};
+        SymbolId var{};
+        /// The counter is scaled as it is when the statement runs.
+        AffineExpr value{};
+    };
+    /// Every LET but the counter statement, in order.
+    std::vector<Update> updates{};
+    /// How many times each variable is read by an iteration. These are
+    /// defined at the start of the loop if and only if no iteration fails.
+    std::vector<std::pair<SymbolId, int>> reads{};
+};
+
+/**
+ * @brief The whole program, lowered from the parse tree.
+ *
+ * Statements are ordered by line number. Expressions live in a flat arena and
+ * refer to each other by index, so the module can be copied and rewritten
+ * without chasing pointers.
+ */
+struct Module {
+    std::vector<Stm> stms{};
+    std::vector<Expr> exprs{};
+    std::vector<std::string> symbols{};
+    /// Found by `solve_counted_loops`.
+    std::vector<CountedLoop> counted_loops{};
+
+    ExprId add_expr(const Expr &expr) {
+        exprs.push_back(expr);
+        return static_cast<ExprId>(exprs.size() - 1);
+    }
+
+    /**
+     * @brief Resolve an identifier to its slot, allocating the next free slot
+     * at the first time the identifier appears.
+     */
+    SymbolId intern(std::string_view name) {
+        auto it = symbol_ids.find(std::string{name});
+        if (it != end(symbol_ids)) {
+            return it->second;
+        }
+        auto id = static_cast<SymbolId>(symbols.size());
+        symbols.emplace_back(name);
+        symbol_ids.emplace(symbols.back(), id);
+        return id;
+    }
+
+private:
+    std::unordered_map<std::string, SymbolId> symbol_ids{};
+};
+
+} // namespace basic_vm
+
+#endif // BASIC_IR_H
@@ -0,0 +1,63 @@
+#ifndef BASIC_INPUT_CHANNEL_H
+#define BASIC_INPUT_CHANNEL_H
+
+#include "Watchdog.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+
+namespace basic {
+
+/**
+ * @brief Lines of input passed from one thread to a program running in
+ * another, e.g. from the GUI to `INPUT`.
+ *
+ * Lines may be pushed before the program asks for them. They are kept, in
+ * order, until it does.
+ */
+class InputChannel {
+
+public:
+    InputChannel() = default;
+    ~InputChannel() = default;
+
+    // No copy or move.
+    InputChannel(const InputChannel &other) = delete;
+    InputChannel(InputChannel &&other) = delete;
+    InputChannel &operator=(const InputChannel &other) = delete;
+    InputChannel &operator=(InputChannel &&other) = delete;
+
+    void push(std::string line);
+
+    /**
+     * @brief Take the oldest line, waiting for one if there is none.
+     *
+     * @param token Stops the wait when cancelled, if `wake` is called after.
+     * @return Empty if token was cancelled first.
+     */
+    std::optional<std::string> pop(
+        const basic_vm::CancelToken *token = nullptr);
+
+    /**
+     * @brief Make waiting `pop`s check their token again.
+     */
+    void wake();
+
+    /**
+     * @brief Drop the lines that were not taken.
+     */
+    void clear();
+
+    std::size_t size() const;
+
+private:
+    mutable std::mutex mutex{};
+    std::condition_variable ready{};
+    std::deque<std::string> lines{};
+};
+
+} // namespace basic
+
+#endif // BASIC_INPUT_CHANNEL_H
@@ -2,12 +2,39 @@
 #define BASIC_INTERPRETER_H
 
 #include "Fragment.h"
+#include "Optimizer.h"
+#include "ParseStats.h"
+#include "VirtualMachine.h"
+#include <functional>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace basic_syntax {
+class SourceProgram;
+} // namespace basic_syntax
 
 namespace basic {
 
+class PreparedProgram;
+
 class Interpreter {
 public:
+    /**
+     * @brief How the program is executed.
+     */
+    enum class ExecMode {
+        /// Compile the program to bytecode and run it on the register VM.
+        BYTECODE,
+        /// Walk the parse tree. Kept as the reference implementation.
+        TREE_WALK,
+        /// Translate the bytecode to C, compile it with the system compiler
+        /// and load it. Runs on the VM if that fails.
+        AOT,
+    };
+
     /**
      * @brief Construct a new Interpreter object
      *
@@ -43,6 +70,16 @@ public:
     Interpreter &operator=(const Interpreter &other) = delete;
     Interpreter &operator=(Interpreter &&other) = delete;
 
+    /**
+     * @brief Build the parser's tables on a background thread, so the first
+     * program run is not slower than the rest.
+     *
+     * Optional: without it, the first parse builds them.
+     *
+     * @return Ready when the warm-up is done. Its destructor waits for it.
+     */
+    static std::future<void> warm_up_parser();
+
     /**
      * @brief Trigger the interpretation of the stored fragment.
      *
@@ -52,6 +89,129 @@ public:
 
     std::string show_ast();
 
+    /**
+     * @brief Choose the execution engine of the following runs. Default to
+     * `ExecMode::BYTECODE`.
+     */
+    void set_exec_mode(ExecMode mode) noexcept {
+        exec_mode = mode;
+    }
+
+    /**
+     * @brief Run on the variables of env, and update them in place, instead
+     * of starting from none. Such runs always walk the tree.
+     */
+    void set_var_env(std::shared_ptr<VariableEnv> env) noexcept {
+        shared_env = std::move(env);
+    }
+
+    /**
+     * @brief Share the parse of the fragment with other interpreters. The
+     * program is parsed again only if the fragment changed since, and then
+     * `get_prepared_program` returns the new parse. Runs on the same
+     * prepared program must not overlap.
+     */
+    void set_prepared_program(std::shared_ptr<PreparedProgram> program) {
+        prepared = std::move(program);
+    }
+
+    /**
+     * @brief The parse of the last run, or nullptr before the first one.
+     */
+    const std::shared_ptr<PreparedProgram> &
+    get_prepared_program() const noexcept {
+        return prepared;
+    }
+
+    /**
+     * @brief Choose how the program is parsed. Default to
+     * `ParseMode::TWO_STAGE`.
+     */
+    void set_parse_mode(ParseMode mode) noexcept {
+        parse_mode = mode;
+    }
+
+    /**
+     * @brief The parses done by the last run, including those that look for
+     * syntax errors. Empty if it reused the prepared program.
+     */
+    const ParseStats &get_parse_stats() const noexcept {
+        return parse_stats;
+    }
+
+    /**
+     * @brief Choose the passes run before the program is compiled to
+     * bytecode. Has no effect on `ExecMode::TREE_WALK`.
+     */
+    void set_optimize_options(const basic_vm::OptimizeOptions &options) {
+        optimize_options = options;
+    }
+
+    /**
+     * @brief Choose when hot loops are promoted to native code. Has no effect
+     * on `ExecMode::TREE_WALK`.
+     */
+    void set_tier_options(const basic_vm::TierOptions &options) {
+        tier_options = options;
+    }
+
+    /**
+     * @brief Choose whether runs that loop forever are stopped. Only has an
+     * effect on runs on the VM, not on `ExecMode::TREE_WALK` or programs
+     * loaded by `ExecMode::AOT`.
+     */
+    void set_loop_detect_options(const basic_vm::LoopDetectOptions &options) {
+        loop_detect_options = options;
+    }
+
+    /**
+     * @brief Limit the statements and the time of each run. A run that goes
+     * over stops with a runtime error. Programs loaded by `ExecMode::AOT` are
+     * not limited.
+     */
+    void set_exec_budget(const basic_vm::ExecBudget &budget) noexcept {
+        exec_budget = budget;
+    }
+
+    /**
+     * @brief Stop runs when token is cancelled, e.g. from another thread, with
+     * a runtime error. nullptr for runs that can't be cancelled.
+     */
+    void set_cancel_token(std::shared_ptr<const basic_vm::CancelToken> token) {
+        cancel_token = std::move(token);
+    }
+
+    /**
+     * @brief Choose the compiler and cache used by `ExecMode::AOT`.
+     */
+    void set_aot_options(const basic_vm::AotOptions &options) {
+        aot_options = options;
+    }
+
+    /**
+     * @brief Why the last run on `ExecMode::AOT` fell back to the VM. Empty
+     * if it didn't.
+     */
+    const std::string &get_aot_log() const noexcept {
+        return aot_log;
+    }
+
+    /**
+     * @brief Write the control-flow graph of each run on bytecode to os, in
+     * the DOT language and annotated with execution counts. nullptr to stop.
+     */
+    void set_cfg_dump(std::ostream *os) noexcept {
+        cfg_dump = os;
+    }
+
+    /**
+     * @brief What each tier did in the last run on bytecode. Empty if the
+     * last run walked the tree.
+     */
+    const basic_vm::TierStats &get_tier_stats() const noexcept {
+        return tier_stats;
+    }
+
 private:
     /// The Basic code to be interpreted.
     std::shared_ptr<Fragment> frag{};
@@ -61,11 +221,66 @@ private:
     std::ostream &out, &err;
     std::string ast_res{};
     bool has_exec = false;
+    ExecMode exec_mode = ExecMode::BYTECODE;
+    basic_vm::OptimizeOptions optimize_options{};
+    basic_vm::TierOptions tier_options{};
+    basic_vm::TierStats tier_stats{};
+    basic_vm::LoopDetectOptions loop_detect_options{};
+    basic_vm::ExecBudget exec_budget{};
+    std::shared_ptr<const basic_vm::CancelToken> cancel_token{};
+    std::shared_ptr<VariableEnv> shared_env{};
+    /// Parsed at most once per revision of the fragment.
+    std::shared_ptr<PreparedProgram> prepared{};
+    /// The parse of `ParseMode::HAND_WRITTEN`, kept like `prepared`.
+    std::shared_ptr<const basic_syntax::SourceProgram> source{};
+    ParseMode parse_mode = ParseMode::TWO_STAGE;
+    ParseStats parse_stats{};
+    basic_vm::AotOptions aot_options{};
+    std::string aot_log{};
+    std::ostream *cfg_dump = nullptr;
 
     std::function<std::string()> input_action;
 
-    void rewrite();
-    bool already_rewritten = false;
+    /**
+     * @brief Parse the fragment unless the prepared program is up to date.
+     * Lines with a syntax error are replaced by `ERROR_LINE` first.
+     *
+     * @return false if the rewritten program still doesn't parse. That
+     * would be a bug: each of its statements was parsed from the same token
+     * by `find_syntax_errors`.
+     */
+    bool prepare();
+    /**
+     * @brief Report a program that `prepare` could not parse, in place of a
+     * run.
+     */
+    void fail_to_parse();
+    /**
+     * @brief Like `prepare`, with the hand-written parser.
+     */
+    bool prepare_source();
+    /**
+     * @brief Run on the program of the hand-written parser, which
+     * `prepare_source` must have parsed.
+     *
+     * @return false, with nothing reported, if the program doesn't fit in
+     * the bytecode and must be walked instead. The tree walker then parses
+     * the fragment, with its bad lines already rewritten, again with ANTLR,
+     * which reads it the same way.
+     */
+    bool interpret_source();
+    /**
+     * @brief Compile the module, and run it on the VM or load it with AOT.
+     *
+     * @param static_errors Reported before the errors of the run.
+     * @param hits, taken Receive the execution counts of each statement.
+     * @return The variables left by the run, or nullptr, with nothing
+     * reported, if the module doesn't fit in the bytecode.
+     */
+    std::shared_ptr<VariableEnv> run_module(basic_vm::Module &module,
+                                            std::string_view static_errors,
+                                            std::vector<int> &hits,
+                                            std::vector<int> &taken);
 };
 
 }; // namespace basic
@@ -0,0 +1,75 @@
+#ifndef BASIC_JIT_H
+#define BASIC_JIT_H
+
+#include "Bytecode.h"
+#include <memory>
+
+namespace basic_vm {
+
+/**
+ * @brief The VM state that compiled code reads and updates. All arrays are
+ * indexed like the corresponding arrays of `VirtualMachine` and `Profile`.
+ */
+struct JitContext {
+    VarType *vars{};
+    int *ref_times{};
+    int *hits{};
+    int *taken{};
+    /// Decremented at each backward jump inside the region. The code returns
+    /// to the interpreter when it runs out.
+    std::int32_t fuel{};
+    /// Statements executed by compiled code.
+    std::int64_t steps{};
+};
+
+/**
+ * @brief Native code for a range of instructions, usually a loop.
+ *
+ * The code is entered at the first instruction of the range and returns the
+ * pc where the interpreter should continue: the target of a jump that leaves
+ * the range, the end of the range, or the first instruction of a statement it
+ * could not compile. It returns right away if a variable used in the range is
+ * not defined, since it never reports errors.
+ */
+class JitRegion {
+
+public:
+    using EntryPoint = std::uint32_t (*)(JitContext *ctx);
+
+    JitRegion(void *memory, std::size_t size) noexcept;
+
+    // No copy or move.
+    JitRegion(const JitRegion &other) = delete;
+    JitRegion(JitRegion &&other) = delete;
+    JitRegion &operator=(const JitRegion &other) = delete;
+    JitRegion &operator=(JitRegion &&other) = delete;
+
+    ~JitRegion();
+
+    std::uint32_t run(JitContext &ctx) const noexcept {
+        return reinterpret_cast<EntryPoint>(memory)(&ctx);
+    }
+
+private:
+    void *memory;
+    std::size_t size;
+};
+
+/**
+ * @return Whether this build can compile to native code.
+ */
+bool jit_available() noexcept;
+
+/**
+ * @brief Compile the instructions in [begin, end) to x86-64 code.
+ *
+ * @pre begin is the first instruction of a statement, and end - 1 the last.
+ * @return nullptr if the JIT is not available, or nothing in the range can be
+ * compiled.
+ */
+std::unique_ptr<JitRegion> jit_compile(const Program &program,
+                                       std::size_t begin, std::size_t end);
+
+} // namespace basic_vm
+
+#endif // BASIC_JIT_H
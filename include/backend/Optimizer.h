@@ -0,0 +1,99 @@
+#ifndef BASIC_OPTIMIZER_H
+#define BASIC_OPTIMIZER_H
+
+#include "IR.h"
+#include <iostream>
+
+namespace basic_vm {
+
+/**
+ * @brief Switches of the passes run by `optimize`. Every pass preserves the
+ * output, the errors and the AST counters of the program, except where noted.
+ */
+struct OptimizeOptions {
+    /**
+     * Fold constant subexpressions and simplify identities such as `x + 0`.
+     * A constant division or modulus by zero, or a constant negative
+     * exponent, is reported once at compile time instead of each time the
+     * statement runs.
+     */
+    bool fold_constants = true;
+    /**
+     * Replace `** 2` and `** 3` by multiplications, and division and `MOD` by
+     * a constant by shifts, masks or multiplications.
+     */
+    bool reduce_strength = true;
+    /**
+     * Drop the store of a LET whose value is never read, because every path
+     * assigns the variable again first. The statement still counts, and its
+     * expression is evaluated for the reads and errors it makes, but
+     * operations that can't fail are skipped.
+     */
+    bool eliminate_dead_stores = true;
+    /**
+     * Keep the value of expressions whose variables are not assigned inside
+     * the loop around them, instead of computing them again at each
+     * iteration. Their reads are still counted each time.
+     */
+    bool hoist_invariants = true;
+    /**
+     * Run counted loops whose body only adds affine functions of the counter
+     * to variables in constant time, when the counter doesn't wrap around
+     * before the loop ends. The counts, reads and values are the same as if
+     * every iteration ran; the sums wrap around like the loop would.
+     */
+    bool solve_counted_loops = true;
+};
+
+/**
+ * @brief Run the enabled passes over the module.
+ *
+ * @param err Where errors found at compile time are reported, in the same
+ * format as the static errors of a run.
+ */
+void optimize(Module &module, const OptimizeOptions &options,
+              std::ostream &err);
+
+/**
+ * @brief Fold the constant subexpressions of every statement.
+ */
+void fold_constants(Module &module, std::ostream &err);
+
+/**
+ * @brief Rewrite powers, divisions and moduli whose right operand is a
+ * suitable constant into the cheaper node kinds. Best run after
+ * `fold_constants`, which turns negated literals into constants.
+ */
+void reduce_strength(Module &module);
+
+/**
+ * @brief Mark the LET statements whose value is never read as `discard`.
+ *
+ * Every variable is considered read at the end of the program. A LET only
+ * counts as assigning the variable again if its expression can't fail, so
+ * that the old value can't survive.
+ */
+void eliminate_dead_stores(Module &module);
+
+/**
+ * @brief Wrap the loop-invariant subexpressions worth keeping in INVARIANT
+ * nodes: those with an operation that may fail, like a division by a
+ * variable, or with at least two operations.
+ */
+void hoist_invariants(Module &module);
+
+/**
+ * @brief Find the counted loops: a single block of LET statements, one of
+ * which steps the counter by a constant, ending with an IF that compares the
+ * counter with a value the loop doesn't change. Every other LET assigns or
+ * adds an affine function of the counter, and only reads the variables the
+ * loop doesn't assign, its own variable and the counter.
+ *
+ * The loops are only recorded in `Module::counted_loops`; whether one can be
+ * skipped depends on the values at run time.
+ */
+void solve_counted_loops(Module &module);
+
+} // namespace basic_vm
+
+#endif // BASIC_OPTIMIZER_H
@@ -0,0 +1,45 @@
+#ifndef BASIC_OUTPUT_CHANNEL_H
+#define BASIC_OUTPUT_CHANNEL_H
+
+#include <mutex>
+#include <streambuf>
+#include <string>
+
+namespace basic {
+
+/**
+ * @brief Output of a program running in one thread, taken while it runs by
+ * another, e.g. by the GUI. Write to it through an `std::ostream`.
+ *
+ * Nothing is buffered on the writer's side, so everything written is there
+ * for the next `take`. Only what was not taken yet is kept.
+ */
+class OutputChannel : public std::streambuf {
+
+public:
+    OutputChannel() = default;
+    ~OutputChannel() override = default;
+
+    // No copy or move.
+    OutputChannel(const OutputChannel &other) = delete;
+    OutputChannel(OutputChannel &&other) = delete;
+    OutputChannel &operator=(const OutputChannel &other) = delete;
+    OutputChannel &operator=(OutputChannel &&other) = delete;
+
+    /**
+     * @return Everything written since the last call.
+     */
+    std::string take();
+
+protected:
+    int_type overflow(int_type ch) override;
+    std::streamsize xsputn(const char *s, std::streamsize count) override;
+
+private:
+    std::mutex mutex{};
+    std::string pending{};
+};
+
+} // namespace basic
+
+#endif // BASIC_OUTPUT_CHANNEL_H
@@ -0,0 +1,55 @@
+#ifndef BASIC_PARSE_STATS_H
+#define BASIC_PARSE_STATS_H
+
+#include <chrono>
+#include <cstdint>
+
+namespace basic {
+
+/**
+ * @brief How the parser predicts which alternative to take.
+ */
+enum class ParseMode {
+    /// Try the fast SLL prediction first, bailing out at the first error, and
+    /// parse again with full LL prediction only if it failed. SLL is exact on
+    /// programs it accepts, so the result is the same as `LL`'s.
+    TWO_STAGE,
+    /// Always use full LL prediction.
+    LL,
+    /// Skip ANTLR, and read the program with the hand-written lexer and
+    /// parser of `basic_syntax::SourceProgram`. Runs that walk the tree
+    /// still need the ANTLR tree, and parse it in `TWO_STAGE`.
+    HAND_WRITTEN,
+};
+
+/**
+ * @brief What the parser did, summed over the parses it counts.
+ */
+struct ParseStats {
+    /// Parses done in each prediction mode. A parse that falls back from SLL
+    /// counts in both.
+    std::int64_t sll_parses = 0;
+    std::int64_t ll_parses = 0;
+    std::chrono::nanoseconds sll_time{};
+    std::chrono::nanoseconds ll_time{};
+    /// Parses done without ANTLR, each of which finds every syntax error.
+    std::int64_t hand_written_parses = 0;
+    std::chrono::nanoseconds hand_written_time{};
+    /// ANTLR parsers taken from the thread's cache instead of built.
+    std::int64_t reused_parsers = 0;
+
+    ParseStats &operator+=(const ParseStats &other) noexcept {
+        sll_parses += other.sll_parses;
+        ll_parses += other.ll_parses;
+        sll_time += other.sll_time;
+        ll_time += other.ll_time;
+        hand_written_parses += other.hand_written_parses;
+        hand_written_time += other.hand_written_time;
+        reused_parsers += other.reused_parsers;
+        return *this;
+    }
+};
+
+} // namespace basic
+
+#endif // BASIC_PARSE_STATS_H
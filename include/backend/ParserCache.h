@@ -0,0 +1,83 @@
+#ifndef BASIC_PARSER_CACHE_H
+#define BASIC_PARSER_CACHE_H
+
+#include "ParseStats.h"
+#include <BasicANTLR.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace basic {
+
+/**
+ * @brief An input stream, lexer, token stream and parser wired together, to
+ * be reset for each text instead of built again.
+ *
+ * The parse trees and tokens of a text live until the next reset.
+ */
+class CachedParser {
+
+public:
+    CachedParser();
+    ~CachedParser() = default;
+
+    // No copy or move: the lexer, tokens and parser point to each other.
+    CachedParser(const CachedParser &other) = delete;
+    CachedParser(CachedParser &&other) = delete;
+    CachedParser &operator=(const CachedParser &other) = delete;
+    CachedParser &operator=(CachedParser &&other) = delete;
+
+    /**
+     * @brief Read text from the start, and drop the tokens and trees of the
+     * last text.
+     */
+    void reset(const std::string &text);
+
+    antlr4::ANTLRInputStream input{};
+    antlr_basic::BasicLexer lexer;
+    antlr4::CommonTokenStream tokens;
+    antlr_basic::BasicParser parser;
+};
+
+/**
+ * @brief The idle parsers of a thread.
+ *
+ * Parsers are taken for as long as their trees are used, and given back to
+ * the cache of the thread that gives them back. Each thread only touches its
+ * own cache, so there is no locking.
+ */
+class ParserCache {
+
+public:
+    /**
+     * @return The cache of the calling thread.
+     */
+    static ParserCache &local();
+
+    /**
+     * @brief Take an idle parser, or build one, and reset it to the text.
+     *
+     * @param stats Counts the parsers reused, unless nullptr.
+     */
+    std::unique_ptr<CachedParser> acquire(const std::string &text,
+                                          ParseStats *stats = nullptr);
+
+    /**
+     * @brief Give a parser back, and free its tokens and trees.
+     */
+    void release(std::unique_ptr<CachedParser> parser);
+
+private:
+    ParserCache() = default;
+
+    /// A program is prepared while the last one is still held, so two
+    /// parsers take turns.
+    static constexpr std::size_t MAX_IDLE = 2;
+
+    std::vector<std::unique_ptr<CachedParser>> idle{};
+};
+
+} // namespace basic
+
+#endif // BASIC_PARSER_CACHE_H
@@ -0,0 +1,107 @@
+#ifndef BASIC_PREPARED_PROGRAM_H
+#define BASIC_PREPARED_PROGRAM_H
+
+#include "Fragment.h"
+#include "ParseStats.h"
+#include "ParserCache.h"
+#include <BasicANTLR.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace basic {
+
+/**
+ * @brief A program parsed once, for any number of runs and AST renderings.
+ *
+ * The parse tree points into the token stream and is owned by the parser, so
+ * the parser is held here, and given back to the cache of the thread that
+ * drops the program. The literals are decoded when the program is
+ * prepared. Runs store their execution counters in the tree, so they must
+ * not overlap, and must start with `reset_counters`.
+ */
+class PreparedProgram {
+
+public:
+    /**
+     * @brief Parse the fragment as it is now.
+     *
+     * @param stats Incremented by the parses done, unless nullptr.
+     * @return nullptr if a line has a syntax error.
+     */
+    static std::unique_ptr<PreparedProgram>
+    prepare(const Fragment &frag, ParseMode mode = ParseMode::TWO_STAGE,
+            ParseStats *stats = nullptr);
+
+    /**
+     * @brief Find the lines of the fragment with a syntax error.
+     *
+     * The statements are parsed one at a time on the tokens of the whole
+     * program, since one may run onto the next lines when its end of line is
+     * deleted. A statement that fails there has only its own line reported,
+     * and the next line is parsed as if the bad line were `ERROR_LINE`, so
+     * that the rewritten program parses. Every bad line is found in a single
+     * pass.
+     *
+     * @param stats Incremented by the parses done, unless nullptr.
+     * @return Their line numbers, in ascending order.
+     */
+    static std::vector<LSize>
+    find_syntax_errors(const Fragment &frag,
+                       ParseMode mode = ParseMode::TWO_STAGE,
+                       ParseStats *stats = nullptr);
+
+    /**
+     * @brief Deserialize the ATNs of the lexer and parser, and fill the DFA
+     * caches that all threads share, by parsing a program of every statement
+     * in each parse mode. The first program prepared is then as fast as the
+     * rest.
+     */
+    static void warm_up();
+
+    ~PreparedProgram();
+
+    // No copy or move.
+    PreparedProgram(const PreparedProgram &other) = delete;
+    PreparedProgram(PreparedProgram &&other) = delete;
+    PreparedProgram &operator=(const PreparedProgram &other) = delete;
+    PreparedProgram &operator=(PreparedProgram &&other) = delete;
+
+    /// The revision of the fragment it was parsed from.
+    std::uint64_t get_revision() const noexcept {
+        return revision;
+    }
+
+    antlr_basic::BasicParser::ProgContext *get_tree() const noexcept {
+        return tree;
+    }
+
+    /// The errors found while decoding the literals, for each run to report.
+    const std::string &get_decode_errors() const noexcept {
+        return decode_errors;
+    }
+
+    /// The variable names, indexed by the `slot` fields of the tree.
+    const std::vector<std::string> &get_symbols() const noexcept {
+        return symbols;
+    }
+
+    /**
+     * @brief Clear the execution counters left in the tree by the last run.
+     */
+    void reset_counters();
+
+private:
+    PreparedProgram(const Fragment &frag, ParseStats &stats);
+
+    std::uint64_t revision;
+    std::unique_ptr<CachedParser> cached;
+    antlr_basic::BasicParser::ProgContext *tree{};
+    std::string decode_errors{};
+    std::vector<std::string> symbols{};
+};
+
+} // namespace basic
+
+#endif // BASIC_PREPARED_PROGRAM_H
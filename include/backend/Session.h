@@ -0,0 +1,73 @@
+#ifndef BASIC_SESSION_H
+#define BASIC_SESSION_H
+
+#include "VariableEnv.h"
+#include "Watchdog.h"
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+
+namespace basic {
+
+/**
+ * @brief Immediate mode: statements typed without a line number, run one at
+ * a time on variables that live as long as the session.
+ *
+ * Each command is parsed and run on its own, so its cost doesn't grow with
+ * the commands before it, and an earlier `INPUT` is never asked again.
+ */
+class Session {
+
+public:
+    Session() = default;
+    ~Session() = default;
+
+    // No copy or move.
+    Session(const Session &other) = delete;
+    Session(Session &&other) = delete;
+    Session &operator=(const Session &other) = delete;
+    Session &operator=(Session &&other) = delete;
+
+    /**
+     * @brief Run one statement, e.g. `LET a = 1` or `PRINT a`, on the
+     * variables of the session.
+     *
+     * Errors are reported like for a program of that single line. `GOTO` and
+     * `IF` are not run, since there is no other line to jump to.
+     *
+     * @param out, err The output and error streams.
+     * @param input_action Gives the values read by `INPUT`.
+     * @return The AST of the statement, as `Interpreter::show_ast` shows it.
+     */
+    std::string execute(const std::string &command, std::ostream &out,
+                        std::ostream &err,
+                        std::function<std::string()> input_action);
+
+    /**
+     * @brief Stop the following commands when token is cancelled. nullptr for
+     * commands that can't be cancelled.
+     */
+    void set_cancel_token(std::shared_ptr<const basic_vm::CancelToken> token) {
+        cancel_token = std::move(token);
+    }
+
+    /**
+     * @brief Forget all variables.
+     */
+    void clear() {
+        v_env = std::make_shared<VariableEnv>();
+    }
+
+    std::shared_ptr<const VariableEnv> get_var_env() const noexcept {
+        return v_env;
+    }
+
+private:
+    std::shared_ptr<VariableEnv> v_env{std::make_shared<VariableEnv>()};
+    std::shared_ptr<const basic_vm::CancelToken> cancel_token{};
+};
+
+} // namespace basic
+
+#endif // BASIC_SESSION_H
@@ -0,0 +1,207 @@
+#ifndef BASIC_SYNTAX_H
+#define BASIC_SYNTAX_H
+
+#include "Fragment.h"
+#include "IR.h"
+#include "VariableEnv.h"
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace basic_syntax {
+
+using namespace basic;
+
+/**
+ * @brief The tokens of `Basic.g4`, and the end of the input.
+ */
+enum class TokenKind : std::uint8_t {
+    LET,
+    GOTO,
+    IF,
+    THEN,
+    REM,
+    PRINT,
+    INPUT,
+    END,
+    MOD,
+    ERROR,
+    ID,
+    INT,
+    POWER,
+    MULT,
+    DIV,
+    PLUS,
+    MINUS,
+    GT,
+    LT,
+    EQUAL,
+    LPAREN,
+    RPAREN,
+    COMMENT,
+    NL,
+    EXTRA,
+    END_OF_INPUT,
+};
+
+struct Token {
+    TokenKind kind = TokenKind::END_OF_INPUT;
+    /// A view of the source.
+    std::string_view text{};
+    basic_vm::SourceLoc loc{};
+};
+
+/**
+ * @brief Split Basic source into the tokens `BasicLexer` would make, one at
+ * a time, without copying them.
+ *
+ * Whitespace is skipped. Columns count code points, as ANTLR's do.
+ */
+class Lexer {
+
+public:
+    explicit Lexer(std::string_view source) noexcept;
+
+    /**
+     * @return The next token, or `TokenKind::END_OF_INPUT` at the end.
+     */
+    Token next() noexcept;
+
+private:
+    std::string_view source;
+    std::size_t pos = 0;
+    basic_vm::SourceLoc loc{1, 1};
+
+    /// Move past the next n bytes.
+    void advance(std::size_t n) noexcept;
+};
+
+/**
+ * @brief An expression as written. Parentheses only group, and leave no
+ * node, as in `basic_vm::Module`.
+ */
+struct Expr {
+    /// CONST, VAR, NEG or one of the binary operators.
+    basic_vm::ExprKind kind{};
+    basic_vm::ExprId lhs{}, rhs{};
+    /// CONST: the literal. VAR: the identifier.
+    std::string_view text{};
+    /// CONST: the value of the literal, or 0 if it is out of range.
+    VarType value{};
+    /// VAR: the identifier. Binary operators: the first token of the right
+    /// operand.
+    basic_vm::SourceLoc loc{};
+};
+
+/**
+ * @brief A statement as written.
+ */
+struct Stm {
+    /// REM for comments.
+    basic_vm::StmKind kind{};
+    /// False if a literal is out of range. The statement then runs as an
+    /// ERROR, like `DecodeVisitor` marks it.
+    bool valid = true;
+    LSize line{};
+    std::string_view line_text{};
+    /// LET, INPUT: the variable. REM: the comment, as the AST shows it.
+    std::string_view text{};
+    /// LET, PRINT: the value. IF: the left-hand side.
+    basic_vm::ExprId expr{};
+    /// IF: the right-hand side.
+    basic_vm::ExprId rhs{};
+    basic_vm::CmpOp cmp{};
+    /// GOTO, IF: the line to jump to, and its literal.
+    LSize target{};
+    std::string_view target_text{};
+};
+
+/**
+ * @brief A program read by the hand-written lexer and parser, without the
+ * ANTLR runtime.
+ *
+ * It accepts the programs `BasicParser` accepts, and gives the same results:
+ * `lower` the module of `basic_visitor::LowerVisitor`, the decode errors
+ * those of `basic_visitor::DecodeVisitor`, and `render_ast` the AST of
+ * `basic_visitor::ASTConstructVisitor`. Expressions are parsed by precedence
+ * climbing, with the precedence levels ANTLR gives the alternatives of
+ * `expr`.
+ *
+ * This includes the recovery of ANTLR, which deletes a token that can't
+ * start an operand where one is expected, if the next token can. The new
+ * line is such a token: `10 PRINT` followed by `20 + 1` is `10 PRINT 20 + 1`
+ * and prints 21, and there is no line 20.
+ */
+class SourceProgram {
+
+public:
+    /**
+     * @brief Parse the fragment as it is now.
+     *
+     * @param bad_lines Receives the line numbers of every line with a syntax
+     * error, in ascending order, unless nullptr. The statement of a bad line
+     * may fail on a later line; the next line is then parsed as if the bad
+     * line were `ERROR_LINE`, so that the rewritten program parses.
+     * @return nullptr if a line has a syntax error.
+     */
+    static std::unique_ptr<SourceProgram>
+    parse(const Fragment &frag, std::vector<LSize> *bad_lines = nullptr);
+
+    ~SourceProgram() = default;
+
+    // No copy or move.
+    SourceProgram(const SourceProgram &other) = delete;
+    SourceProgram(SourceProgram &&other) = delete;
+    SourceProgram &operator=(const SourceProgram &other) = delete;
+    SourceProgram &operator=(SourceProgram &&other) = delete;
+
+    /// The revision of the fragment it was parsed from.
+    std::uint64_t get_revision() const noexcept {
+        return revision;
+    }
+
+    /// The errors found while decoding the literals, for each run to report.
+    const std::string &get_decode_errors() const noexcept {
+        return decode_errors;
+    }
+
+    /// In ascending order of line numbers.
+    const std::vector<Stm> &get_stms() const noexcept {
+        return stms;
+    }
+
+    const std::vector<Expr> &get_exprs() const noexcept {
+        return exprs;
+    }
+
+    /**
+     * @brief Lower the program to a module, one statement per statement.
+     */
+    basic_vm::Module lower() const;
+
+    /**
+     * @brief Show the AST after a run.
+     *
+     * @param hits, taken Execution counts of each statement, like
+     * `basic_vm::write_dot` takes them.
+     * @param v_env The variables left by the run.
+     */
+    std::string render_ast(const std::vector<int> &hits,
+                           const std::vector<int> &taken,
+                           const VariableEnv &v_env) const;
+
+private:
+    explicit SourceProgram(const Fragment &frag);
+
+    std::uint64_t revision;
+    /// Viewed by the statements and expressions.
+    std::string source;
+    std::vector<Stm> stms{};
+    std::vector<Expr> exprs{};
+    std::string decode_errors{};
+};
+
+} // namespace basic_syntax
+
+#endif // BASIC_SYNTAX_H
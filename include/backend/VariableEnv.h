@@ -0,0 +1,48 @@
+#ifndef BASIC_VARIABLE_ENV_H
+#define BASIC_VARIABLE_ENV_H
+
+#include "common.h"
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace basic {
+
+struct VariableEnv {
+    /// Value and ref time.
+    using EnvInformation = std::pair<VarType, int>;
+
+    std::optional<VarType> lookup(const std::string &var_name) noexcept {
+        auto it = var_env.find(var_name);
+        if (it == end(var_env)) {
+            return std::nullopt;
+        }
+        it->second.second++;
+        return it->second.first;
+    };
+
+    int get_ref_time(const std::string &var_name) const noexcept {
+        if (!exist(var_name)) {
+            return -1;
+        }
+        return var_env.at(var_name).second;
+    }
+
+    bool exist(const std::string &var_name) const noexcept {
+        return var_env.find(var_name) != end(var_env);
+    }
+
+    void enter(const std::string &var_name, VarType value) noexcept {
+        if (exist(var_name)) {
+            var_env.at(var_name).first = value;
+        } else {
+            var_env.emplace(var_name, EnvInformation{value, 0});
+        }
+    }
+
+    std::unordered_map<std::string, EnvInformation> var_env;
+};
+
+} // namespace basic
+
+#endif // BASIC_VARIABLE_ENV_H
@@ -0,0 +1,288 @@
+#ifndef BASIC_VIRTUAL_MACHINE_H
+#define BASIC_VIRTUAL_MACHINE_H
+
+#include "Aot.h"
+#include "Bytecode.h"
+#include "Jit.h"
+#include "VariableEnv.h"
+#include "Watchdog.h"
+#include <chrono>
+#include <functional>
+#include <memory>
+
+namespace basic_vm {
+
+/**
+ * @brief Execution counters of a run, indexed by pc.
+ */
+struct Profile {
+    /// How many times each instruction completed.
+    std::vector<int> hits{};
+    /// For IF instructions, how many times the jump was taken.
+    std::vector<int> taken{};
+};
+
+/**
+ * @brief When code is promoted from the interpreter to native code.
+ *
+ * Every run starts interpreting the bytecode. A loop whose header is jumped
+ * back to `hot_threshold` times, from any of its latches, is compiled and
+ * continues natively, in the middle of the run. Passes through a latch that
+ * don't jump back don't count.
+ */
+struct TierOptions {
+    /// Promote hot loops at all. Has no effect where the JIT is not available.
+    bool native = true;
+    int hot_threshold = 1000;
+    /// Backward jumps inside native code before it returns to the
+    /// interpreter.
+    std::int32_t native_fuel = 1 << 20;
+    /// How many times native code may refuse to run, because a variable it
+    /// uses is not defined yet, before it is dropped.
+    int max_bails = 16;
+};
+
+/**
+ * @brief Stopping runs that loop forever.
+ *
+ * The state of a run is the pc and the values of the variables, so a run that
+ * gets back to a state it was in before loops forever, unless it read input
+ * in between. The state is sampled at jumps back, and the samples are checked
+ * for a cycle with Brent's algorithm: the sample is compared with a saved
+ * one, which is replaced after 1, 2, 4, ... samples. States are hashed, and
+ * only compared in full when the hashes match.
+ *
+ * Only runs on the interpreter and the JIT are checked.
+ */
+struct LoopDetectOptions {
+    bool enabled = false;
+    /// Jumps back between two samples.
+    int sample_period = 256;
+};
+
+/**
+ * @brief What each tier did during a run.
+ */
+struct TierStats {
+    /// Statements executed by the interpreter and by native code. Statements
+    /// that fail without completing (e.g. an IF with an undefined variable)
+    /// are not counted.
+    std::int64_t interpreted_steps = 0;
+    std::int64_t native_steps = 0;
+    /// Loops compiled, and loops that could not be compiled.
+    int promoted = 0;
+    int rejected = 0;
+    /// Times native code was entered, and times it refused to run.
+    int native_entries = 0;
+    int bails = 0;
+    std::chrono::nanoseconds compile_time{};
+    /// First and last line of each compiled loop.
+    std::vector<std::pair<LSize, LSize>> hot_lines{};
+};
+
+/**
+ * @brief Register machine that executes a `Program`.
+ *
+ * Produces the same output, errors and variable environment as
+ * `basic_visitor::InterpretVisitor` does on the same source.
+ */
+class VirtualMachine {
+
+public:
+    VirtualMachine(const Program &program, std::ostream &out,
+                   std::ostream &err,
+                   const std::function<std::string()> &input_action) noexcept;
+
+    // No copy or move.
+    VirtualMachine(const VirtualMachine &other) = delete;
+    VirtualMachine(VirtualMachine &&other) = delete;
+    VirtualMachine &operator=(const VirtualMachine &other) = delete;
+    VirtualMachine &operator=(VirtualMachine &&other) = delete;
+
+    ~VirtualMachine() = default;
+
+    void run();
+
+    /**
+     * @brief Run the program compiled ahead of time instead of interpreting
+     * it. The output, errors, profile and variables are the same as `run`
+     * gives.
+     *
+     * @pre module was compiled from the program of this machine.
+     */
+    void run(const AotModule &module);
+
+    void set_tier_options(const TierOptions &options) noexcept {
+        tier_options = options;
+        jit_enabled = options.native && jit_available();
+    }
+
+    void set_loop_detect_options(const LoopDetectOptions &options) noexcept {
+        loop_detect_options = options;
+    }
+
+    /**
+     * @brief Stop runs that go over a budget or are cancelled, with a
+     * runtime error. Checked at jumps back, after counted loops and after
+     * input, so only loops and input may go on for long between checks.
+     * Programs loaded ahead of time are not checked.
+     */
+    void set_watchdog(const Watchdog &watchdog) noexcept {
+        this->watchdog = watchdog;
+    }
+
+    const TierStats &get_tier_stats() const noexcept {
+        return tier_stats;
+    }
+
+    const Profile &get_profile() const noexcept {
+        return profile;
+    }
+
+    /**
+     * @brief Collect the variables of the last run by name.
+     */
+    std::shared_ptr<VariableEnv> get_var_env() const;
+
+private:
+    const Program &program;
+    std::ostream &out, &err;
+    std::reference_wrapper<const std::function<std::string()>> input_action_ref;
+
+    Profile profile{};
+
+    /// Value of each variable slot.
+    std::vector<VarType> vars{};
+    /// How many times each variable is read, -1 if it is not defined yet.
+    std::vector<int> ref_times{};
+
+    std::vector<VarType> regs{};
+    /**
+     * Registers holding the result of a failed evaluation. An error is only
+     * reported by the node that fails first, so every operation has to know
+     * whether its operands are valid. As long as `failed` is false, no
+     * register of the current statement is poisoned and the flags need not
+     * be consulted.
+     */
+    std::vector<std::uint8_t> poison{};
+    bool failed = false;
+
+    TierOptions tier_options{};
+    TierStats tier_stats{};
+    /// Statements executed by the interpreter, including those of counted
+    /// loops run at once. Native code counts its own in `jit_ctx`.
+    std::int64_t steps = 0;
+
+    struct JitEntry {
+        std::unique_ptr<JitRegion> region{};
+        /// Jumps back to the header taken while it was interpreted, from
+        /// any latch.
+        int back_edges = 0;
+        int bails = 0;
+        bool failed = false;
+    };
+
+    bool jit_enabled = jit_available();
+    /// Whether jumps back go through `on_back_edge`.
+    bool hooks_back_edges = false;
+    /// Compiled code, by the pc of the loop header it starts at.
+    std::vector<JitEntry> jit_entries{};
+    JitContext jit_ctx{};
+
+    LoopDetectOptions loop_detect_options{};
+
+    /// A sample of the state, for `LoopDetectOptions`.
+    struct State {
+        std::size_t pc = 0;
+        std::uint64_t hash = 0;
+        std::vector<VarType> vars{};
+        std::vector<bool> defined{};
+    };
+    /// The saved sample, and the samples taken since it was saved.
+    State saved_state{};
+    int samples_saved = 0;
+    int power = 1;
+    int until_sample = 0;
+    /// Whether input was read since the state was saved.
+    bool has_input = false;
+
+    Watchdog watchdog{};
+    /// Jumps back until the watchdog is checked again.
+    int until_check = 0;
+
+    /// The address of the handler of each instruction, with threaded
+    /// dispatch. The addresses are only known inside `execute`, so its first
+    /// call fills the table, and the later runs of the program reuse it.
+    std::vector<const void *> threaded{};
+
+    /**
+     * @brief Called when a jump from latch goes back to header. Checks for an
+     * infinite loop, then runs the compiled loop if there is one, compiling
+     * it first if it is hot.
+     *
+     * @return The pc to continue at, or NO_PC to stop.
+     */
+    std::size_t on_back_edge(std::size_t header, std::size_t latch);
+
+    /**
+     * @brief Take a sample of the state at pc.
+     *
+     * @return Whether the run went back to a state it was in.
+     */
+    bool sample_state(std::size_t pc);
+
+    /**
+     * @brief Check the watchdog, reporting why the run must stop if it must.
+     *
+     * @return Whether the run may go on.
+     */
+    bool check_watchdog();
+
+    /// Prepare the state of a new run.
+    void reset();
+    /// The dispatch loop of `run`.
+    void execute();
+
+    /// Callbacks of the compiled program, `host` being the machine.
+    static void aot_undefined(void *host, std::uint32_t pc,
+                              std::uint32_t slot, int rhs);
+    static void aot_fail(void *host, std::uint32_t pc, VarType lhs,
+                         VarType rhs);
+    static void aot_print(void *host, VarType value);
+    static void aot_input(void *host, std::uint32_t slot);
+    static int aot_solve_loop(void *host, std::uint32_t index);
+
+    /**
+     * @brief Apply the effect of the whole counted loop, from its first
+     * statement, unless an iteration would fail, the counter would wrap
+     * around first, or the loop would go past the statement limit.
+     *
+     * @return Whether the loop is done.
+     */
+    bool solve_loop(const CountedLoop &loop);
+
+    void define(std::uint32_t slot, VarType value) noexcept;
+    /// Read a value into the variable slot, or report why it can't.
+    void input(std::uint32_t slot);
+    /**
+     * @brief Count a read of the variable, or report it at loc if it is not
+     * defined.
+     *
+     * @return Whether the variable is defined.
+     */
+    bool read_var(std::uint32_t slot, const SourceLoc &loc);
+
+    void poison_reg(Reg reg) noexcept;
+    bool is_poisoned(Reg reg) const noexcept;
+    /// Called by the instruction that ends a statement.
+    void clear_poison() noexcept;
+
+    /// Report that the DIV, MOD or POW at pc fails on these operands.
+    void arithmetic_error(std::size_t pc, VarType lhs, VarType rhs);
+    void static_error(std::size_t pc, const std::string &msg);
+    void runtime_error(std::string_view msg);
+};
+
+} // namespace basic_vm
+
+#endif // BASIC_VIRTUAL_MACHINE_H
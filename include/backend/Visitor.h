@@ -1,9 +1,11 @@
 #ifndef BASIC_VISITOR_H
 #define BASIC_VISITOR_H
 
+#include "IR.h"
+#include "VariableEnv.h"
+#include "VirtualMachine.h"
 #include "common.h"
 #include <BasicANTLR.h>
-#include <unordered_map>
 
 namespace basic_visitor {
 
@@ -11,39 +13,22 @@ using namespace basic;
 using namespace antlr4;
 using namespace antlr_basic;
 
-struct VariableEnv {
-    /// Value and ref time.
-    using EnvInformation = std::pair<VarType, int>;
-
-    std::optional<VarType> lookup(const std::string &var_name) noexcept {
-        if (!exist(var_name)) {
-            return std::nullopt;
-        }
-        auto &var = var_env.at(var_name);
-        var.second++;
-        return var.first;
-    };
-
-    int get_ref_time(const std::string &var_name) const noexcept {
-        if (!exist(var_name)) {
-            return -1;
-        }
-        return var_env.at(var_name).second;
-    }
-
-    bool exist(const std::string &var_name) const noexcept {
-        return var_env.find(var_name) != end(var_env);
-    }
-
-    void enter(const std::string &var_name, VarType value) noexcept {
-        if (exist(var_name)) {
-            var_env.at(var_name).first = value;
-        } else {
-            var_env.emplace(var_name, EnvInformation{value, 0});
-        }
-    }
-
-    std::unordered_map<std::string, EnvInformation> var_env;
+/**
+ * @brief The labeled alternative of an `expr`, stored in its `alt` field by
+ * `DecodeVisitor`.
+ */
+enum class ExprAlt : int {
+    UNDECODED,
+    INT,
+    VAR,
+    NEG,
+    PAREN,
+    POWER,
+    MULT,
+    DIV,
+    MOD,
+    PLUS,
+    MINUS,
 };
 
 class InterpretVisitor : public BasicBaseVisitor {
@@ -65,6 +50,29 @@ public:
         return v_env;
     }
 
+    /**
+     * @brief Run on the variables of env instead of fresh ones.
+     */
+    void set_var_env(std::shared_ptr<VariableEnv> env) noexcept {
+        v_env = std::move(env);
+    }
+
+    /**
+     * @brief The names interned by `DecodeVisitor`, which the `slot` fields
+     * of the tree index. Must outlive the runs.
+     */
+    void set_symbols(const std::vector<std::string> &symbols) noexcept {
+        this->symbols = &symbols;
+    }
+
+    /**
+     * @brief Stop the run when the watchdog says so. Checked every few
+     * statements and after input.
+     */
+    void set_watchdog(const basic_vm::Watchdog &watchdog) noexcept {
+        this->watchdog = watchdog;
+    }
+
     /**
      * @brief
      *
@@ -91,43 +99,47 @@ public:
 
     std::any visitLetStm(BasicParser::LetStmContext *ctx) override;
 
-    std::any visitPowerExpr(BasicParser::PowerExprContext *ctx) override;
-
-    std::any visitDivExpr(BasicParser::DivExprContext *ctx) override;
-
-    std::any visitPlusExpr(BasicParser::PlusExprContext *ctx) override;
-
-    std::any visitMinusExpr(BasicParser::MinusExprContext *ctx) override;
-
-    std::any visitMultExpr(BasicParser::MultExprContext *ctx) override;
+private:
+    std::ostream &out, &err;
+    std::reference_wrapper<const std::function<std::string()>> input_action_ref;
 
-    std::any visitIntExpr(BasicParser::IntExprContext *ctx) override;
+    std::shared_ptr<VariableEnv> v_env{std::make_unique<VariableEnv>()};
 
-    std::any visitVarExpr(BasicParser::VarExprContext *ctx) override;
+    basic_vm::Watchdog watchdog{};
 
-    std::any visitNegExpr(BasicParser::NegExprContext *ctx) override;
+    const std::vector<std::string> *symbols{};
+    /// The entry of each slot in `v_env`, looked up by name at the first use
+    /// of the slot in a run. Entries of an unordered_map never move.
+    std::vector<VariableEnv::EnvInformation *> resolved{};
 
-    std::any visitModExpr(BasicParser::ModExprContext *ctx) override;
+    /**
+     * @brief Result of evaluating an expression. `ok` is false if the
+     * evaluation failed, and the error is already reported.
+     */
+    struct EvalResult {
+        VarType value{};
+        bool ok{};
+    };
 
-    std::any visitParenExpr(BasicParser::ParenExprContext *ctx) override;
+    /**
+     * @brief Evaluate an expression without going through `std::any`.
+     *
+     * The alternative of `expr` is read from its `alt` field instead of
+     * `accept`, which needs a `dynamic_cast` to reach the visitor.
+     */
+    EvalResult evaluate(BasicParser::ExprContext *ctx);
 
-private:
-    std::ostream &out, &err;
-    std::reference_wrapper<const std::function<std::string()>> input_action_ref;
+    EvalResult evaluateVar(BasicParser::VarExprContext *ctx);
 
-    std::shared_ptr<VariableEnv> v_env{std::make_unique<VariableEnv>()};
+    EvalResult evaluateBinary(BasicParser::ExprContext *lhs_ctx,
+                              BasicParser::ExprContext *rhs_ctx, ExprAlt op);
 
-    VarType unwrap_val(std::any val) noexcept;
-        
     /**
-     * @brief Retrieve the Id from the lexer node.
-     *
-     * @param node
-     * @return std::string
+     * @brief The entry of a variable, or nullptr if it was never assigned.
      */
-    static std::string parseId(tree::TerminalNode *node) noexcept;
+    VariableEnv::EnvInformation *resolve(unsigned slot);
 
-    static VarType quickPower(VarType base, VarType exponent) noexcept;
+    void enter(unsigned slot, VarType value);
 
     void static_error(Token *wrong_token, const std::string &msg);
 
@@ -220,6 +232,172 @@ private:
     }
 };
 
+/**
+ * @brief Decode the integer literals of a program once, before it runs.
+ *
+ * The values are stored in the parse tree: `value` of `line_num` and of an
+ * IntExpr, `target` of GOTO and IF. A literal that doesn't fit is reported,
+ * and its statement is marked invalid. Both engines skip invalid statements
+ * like ERROR statements.
+ *
+ * The visitor also tags each `expr` with its `alt`, and interns the variable
+ * names into the `slot` of LET, INPUT and VarExpr, for the tree walker.
+ */
+class DecodeVisitor : public BasicBaseVisitor {
+
+public:
+    explicit DecodeVisitor(std::ostream &err) noexcept;
+
+    std::any visitStm0(BasicParser::Stm0Context *ctx) override;
+
+    std::any visitLineNum(BasicParser::LineNumContext *ctx) override;
+
+    std::any visitGotoStm(BasicParser::GotoStmContext *ctx) override;
+
+    std::any visitIfStm(BasicParser::IfStmContext *ctx) override;
+
+    std::any visitLetStm(BasicParser::LetStmContext *ctx) override;
+
+    std::any visitInputStm(BasicParser::InputStmContext *ctx) override;
+
+    std::any visitIntExpr(BasicParser::IntExprContext *ctx) override;
+
+    std::any visitVarExpr(BasicParser::VarExprContext *ctx) override;
+
+    std::any visitNegExpr(BasicParser::NegExprContext *ctx) override;
+
+    std::any visitParenExpr(BasicParser::ParenExprContext *ctx) override;
+
+    std::any visitPowerExpr(BasicParser::PowerExprContext *ctx) override;
+
+    std::any visitMultExpr(BasicParser::MultExprContext *ctx) override;
+
+    std::any visitDivExpr(BasicParser::DivExprContext *ctx) override;
+
+    std::any visitModExpr(BasicParser::ModExprContext *ctx) override;
+
+    std::any visitPlusExpr(BasicParser::PlusExprContext *ctx) override;
+
+    std::any visitMinusExpr(BasicParser::MinusExprContext *ctx) override;
+
+    /// The interned names, indexed by slot.
+    std::vector<std::string> take_symbols() noexcept {
+        symbol_ids.clear();
+        return std::move(symbols);
+    }
+
+private:
+    std::ostream &err;
+    /// Whether the literals of the current statement are all valid.
+    bool valid = true;
+    std::vector<std::string> symbols{};
+    std::unordered_map<std::string, unsigned> symbol_ids{};
+
+    unsigned intern(const std::string &name);
+
+    std::any decode_alt(BasicParser::ExprContext *ctx, ExprAlt alt) {
+        ctx->alt = static_cast<int>(alt);
+        return visitChildren(ctx);
+    }
+
+    template <typename T>
+    T decode(tree::TerminalNode *node, std::string_view what) {
+        auto value = decode_int<T>(node->getText());
+        if (!value.has_value()) {
+            auto token = node->getSymbol();
+            std::stringstream err_ss{};
+            err_ss << what << " out of range: " << node->getText();
+            log_error(err, token->getLine(),
+                      token->getCharPositionInLine() + 1, err_ss.str());
+            valid = false;
+        }
+        return value.value_or(0);
+    }
+};
+
+/**
+ * @brief Lower the parse tree of a program to `basic_vm::Module`.
+ *
+ * Expression visitors return the `basic_vm::ExprId` of the lowered node,
+ * statement visitors return a `basic_vm::Stm`.
+ */
+class LowerVisitor : public BasicBaseVisitor {
+
+public:
+    LowerVisitor() noexcept = default;
+
+    /**
+     * @brief Lower the whole program.
+     *
+     * The visitor remembers the statement contexts, so that the counters of a
+     * run can be written back with `write_back`.
+     */
+    basic_vm::Module lower(BasicParser::ProgContext *ctx);
+
+    /**
+     * @brief Store the execution counters of a VM run into the parse tree, as
+     * `InterpretVisitor` would have done.
+     *
+     * @param hits, taken Execution counts of each statement of the module.
+     */
+    void write_back(const std::vector<int> &hits,
+                    const std::vector<int> &taken) const;
+
+    std::any visitEndStm(BasicParser::EndStmContext *ctx) override;
+
+    std::any visitErrStm(BasicParser::ErrStmContext *ctx) override;
+
+    std::any visitGotoStm(BasicParser::GotoStmContext *ctx) override;
+
+    std::any visitIfStm(BasicParser::IfStmContext *ctx) override;
+
+    std::any visitPrintStm(BasicParser::PrintStmContext *ctx) override;
+
+    std::any visitInputStm(BasicParser::InputStmContext *ctx) override;
+
+    std::any visitLetStm(BasicParser::LetStmContext *ctx) override;
+
+    std::any visitPowerExpr(BasicParser::PowerExprContext *ctx) override;
+
+    std::any visitDivExpr(BasicParser::DivExprContext *ctx) override;
+
+    std::any visitPlusExpr(BasicParser::PlusExprContext *ctx) override;
+
+    std::any visitMinusExpr(BasicParser::MinusExprContext *ctx) override;
+
+    std::any visitMultExpr(BasicParser::MultExprContext *ctx) override;
+
+    std::any visitIntExpr(BasicParser::IntExprContext *ctx) override;
+
+    std::any visitVarExpr(BasicParser::VarExprContext *ctx) override;
+
+    std::any visitNegExpr(BasicParser::NegExprContext *ctx) override;
+
+    std::any visitModExpr(BasicParser::ModExprContext *ctx) override;
+
+    std::any visitParenExpr(BasicParser::ParenExprContext *ctx) override;
+
+private:
+    basic_vm::Module module{};
+    /// The context of each statement in `module.stms`.
+    std::vector<BasicParser::StmContext *> stm_ctx{};
+
+    basic_vm::ExprId lowerExpr(BasicParser::ExprContext *ctx);
+
+    template <typename Context>
+    basic_vm::ExprId lowerBinaryOpExpr(Context *ctx, basic_vm::ExprKind kind) {
+        static_assert(std::is_base_of_v<BasicParser::ExprContext, Context>,
+                      "Context must be derived from ExprContext");
+        basic_vm::Expr expr{kind};
+        expr.lhs = lowerExpr(ctx->expr(0));
+        expr.rhs = lowerExpr(ctx->expr(1));
+        expr.loc = token_loc(ctx->expr(1)->getStart());
+        return module.add_expr(expr);
+    }
+
+    static basic_vm::SourceLoc token_loc(Token *token) noexcept;
+};
+
 } // namespace basic_visitor
 
 #endif // BASIC_VISITOR_H
\ No newline at end of file
@@ -0,0 +1,95 @@
+#ifndef BASIC_WATCHDOG_H
+#define BASIC_WATCHDOG_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace basic_vm {
+
+/**
+ * @brief Limits on a run. Zero for no limit.
+ */
+struct ExecBudget {
+    /// Statements executed.
+    std::int64_t max_steps = 0;
+    /// Wall time since the run started.
+    std::chrono::milliseconds max_time{0};
+};
+
+/**
+ * @brief Asks a run to stop. May be cancelled from any thread while another
+ * one runs the program.
+ */
+class CancelToken {
+
+public:
+    void cancel() noexcept {
+        cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    /// Clear the request, to use the token for another run.
+    void reset() noexcept {
+        cancelled.store(false, std::memory_order_relaxed);
+    }
+
+    bool is_cancelled() const noexcept {
+        return cancelled.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<bool> cancelled{false};
+};
+
+/**
+ * @brief Checks a run against its budget and its cancellation token.
+ *
+ * The check reads the clock, so interpreters call it every so often rather
+ * than at each statement, and a run may go a little past its budget.
+ */
+class Watchdog {
+
+public:
+    Watchdog() noexcept = default;
+
+    Watchdog(const ExecBudget &budget,
+             std::shared_ptr<const CancelToken> token) noexcept
+        : budget(budget), token(std::move(token)) {}
+
+    /// Whether there is anything to check.
+    bool is_active() const noexcept {
+        return budget.max_steps > 0 || budget.max_time.count() > 0 || token;
+    }
+
+    bool is_cancelled() const noexcept {
+        return token && token->is_cancelled();
+    }
+
+    /// Start counting the time of a run.
+    void start() noexcept {
+        start_time = std::chrono::steady_clock::now();
+    }
+
+    /// Whether a run may execute this many statements in all.
+    bool allows_steps(std::int64_t steps) const noexcept {
+        return budget.max_steps <= 0 || steps <= budget.max_steps;
+    }
+
+    /**
+     * @param steps Statements executed since the run started.
+     * @return Why the run must stop, as a runtime error, or an empty string
+     * if it may go on.
+     */
+    std::string check(std::int64_t steps) const;
+
+private:
+    ExecBudget budget{};
+    std::shared_ptr<const CancelToken> token{};
+    std::chrono::steady_clock::time_point start_time{};
+};
+
+} // namespace basic_vm
+
+#endif // BASIC_WATCHDOG_H
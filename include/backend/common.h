@@ -1,8 +1,11 @@
 #ifndef BASIC_COMMON_H
 #define BASIC_COMMON_H
 
+#include <charconv>
 #include <cstdint>
 #include <iostream>
+#include <optional>
+#include <string_view>
 
 namespace basic {
 
@@ -27,6 +30,93 @@ const char *const ERROR_LINE = "___ERROR___";
 void log_error(std::ostream &err, LSize line, CSize column,
                std::string_view msg);
 
+/**
+ * @brief Decode a string of decimal digits.
+ *
+ * @return std::optional<T> Empty if the text is not a number, or the number
+ * doesn't fit in T.
+ */
+template <typename T>
+std::optional<T> decode_int(std::string_view text) noexcept {
+    T value{};
+    const char *last = text.data() + text.size();
+    auto [ptr, ec] = std::from_chars(text.data(), last, value);
+    if (ec != std::errc{} || ptr != last) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+/**
+ * Arithmetic on VarType wraps around on overflow, as 32-bit two's complement.
+ * The operations are carried out in unsigned arithmetic, where overflow is
+ * well-defined.
+ */
+inline VarType wrapping_add(VarType lhs, VarType rhs) noexcept {
+    return static_cast<VarType>(static_cast<std::uint32_t>(lhs) +
+                                static_cast<std::uint32_t>(rhs));
+}
+
+inline VarType wrapping_sub(VarType lhs, VarType rhs) noexcept {
+    return static_cast<VarType>(static_cast<std::uint32_t>(lhs) -
+                                static_cast<std::uint32_t>(rhs));
+}
+
+inline VarType wrapping_mul(VarType lhs, VarType rhs) noexcept {
+    return static_cast<VarType>(static_cast<std::uint32_t>(lhs) *
+                                static_cast<std::uint32_t>(rhs));
+}
+
+inline VarType wrapping_neg(VarType val) noexcept {
+    return wrapping_sub(0, val);
+}
+
+/**
+ * @brief Truncating division, where the minimum divided by -1 wraps around to
+ * the minimum.
+ *
+ * @pre rhs != 0
+ */
+inline VarType wrapping_div(VarType lhs, VarType rhs) noexcept {
+    if (rhs == -1) {
+        return wrapping_neg(lhs);
+    }
+    return lhs / rhs;
+}
+
+/**
+ * @brief Raise base to a non-negative power by squaring.
+ *
+ * @pre exponent >= 0
+ */
+inline VarType power_of(VarType base, VarType exponent) noexcept {
+    VarType result = 1;
+    while (exponent > 0) {
+        if (exponent & 1) {
+            result = wrapping_mul(result, base);
+        }
+        base = wrapping_mul(base, base);
+        exponent >>= 1;
+    }
+    return result;
+}
+
+/**
+ * @brief The Basic `MOD` operator: the result takes the sign of the divisor.
+ *
+ * @pre quotient != 0
+ */
+inline VarType modulo_of(VarType dividend, VarType quotient) noexcept {
+    if (quotient == -1) {
+        return 0;
+    }
+    if (dividend != 0 && (dividend < 0) != (quotient < 0)) {
+        auto times = wrapping_sub(dividend / quotient, 1);
+        dividend = wrapping_sub(dividend, wrapping_mul(times, quotient));
+    }
+    return dividend % quotient;
+}
+
 } // namespace basic
 
 #endif // BASIC_COMMON_H
\ No newline at end of file
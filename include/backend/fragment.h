@@ -2,6 +2,7 @@
 #define BASIC_FRAGMENT_H
 
 #include "common.h"
+#include <cstdint>
 #include <map>
 #include <optional>
 #include <sstream>
@@ -13,6 +14,8 @@ namespace basic {
 class Fragment {
 
 public:
+    using LineContainer = std::map<LSize, std::string>;
+
     explicit Fragment();
 
     /**
@@ -103,6 +106,22 @@ public:
         return lines_.size();
     }
 
+    /**
+     * @brief The lines by line number, without the delimiter.
+     */
+    const LineContainer &get_lines() const noexcept {
+        return lines_;
+    }
+
+    /**
+     * @brief Identifies the content of the fragment. It changes with each
+     * modification, and no two fragments with different content ever share
+     * one, so anything derived from the content can be kept until it changes.
+     */
+    std::uint64_t get_revision() const noexcept {
+        return revision_;
+    }
+
     /**
      * @brief Get the line number at the "absolute" position of the fragment.
      *
@@ -114,7 +133,6 @@ public:
     std::optional<LSize> get_line_number_at(std::size_t pos) const noexcept;
 
 private:
-    using LineContainer = std::map<LSize, std::string>;
     using LineIter = LineContainer::iterator;
     using LineConstIter = LineContainer::const_iterator;
 
@@ -124,6 +142,10 @@ private:
     /// Expected to be immutable.
     std::string delimiter_{"\n"};
 
+    std::uint64_t revision_{next_revision_()};
+
+    static std::uint64_t next_revision_() noexcept;
+
     LineConstIter get_iter_(LSize pos) const;
     bool is_valid_iter_(LineConstIter iter) const noexcept;
     bool is_valid_line_(LSize pos) const noexcept;
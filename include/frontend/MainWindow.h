@@ -3,10 +3,16 @@
 
 #include "Fragment.h"
 #include "Interpreter.h"
+#include "Session.h"
 
 #include <QWidget>
 #include <memory>
 
+QT_BEGIN_NAMESPACE
+class QThread;
+class QTimer;
+QT_END_NAMESPACE
+
 // See "Qt In Namespace": https://wiki.qt.io/Qt_In_Namespace
 QT_USE_NAMESPACE
 
@@ -16,10 +22,20 @@ class Window;
 
 namespace basic {
 
+class QBInterpreterWorker;
+
 class MainWindow : public QWidget {
     Q_OBJECT
 public:
     explicit MainWindow(QWidget *parent = nullptr);
+    ~MainWindow() override;
+
+    // No copy or move.
+    MainWindow(const MainWindow &) = delete;
+    MainWindow(MainWindow &&) = delete;
+    MainWindow &operator=(const MainWindow &) = delete;
+    MainWindow &operator=(MainWindow &&) = delete;
+
     void execute(std::string_view command);
 
 protected:
@@ -28,20 +44,33 @@ protected:
 
 public slots:
     // Respond to the finish of the worker. Update UI and clean some states.
-    void workerFinish(QString output, QString error, QString ast_out);
-
-signals:
-    void sendInput(QString input);
+    void workerFinish(QString error, QString ast_out);
 
 private:
     Ui::Window *ui;
     std::shared_ptr<Fragment> frag{};
-    std::shared_ptr<Fragment> frag_mini{};
+    /// Runs the commands typed without a line number.
+    std::shared_ptr<Session> session{};
     bool is_runnning{false};
     bool is_inputting{false};
+    /// Lines typed after "? ", for the `INPUT`s of programs.
+    std::shared_ptr<InputChannel> input_channel{};
+    /// What the running program printed and was not shown yet.
+    std::shared_ptr<OutputChannel> output_channel{};
+    /// Shows the output every frame while a program runs, rather than at
+    /// each PRINT.
+    QTimer *output_timer{};
+    bool has_output{false};
+    /// Stops the running program, if any.
+    std::shared_ptr<basic_vm::CancelToken> cancel_token{};
+    /// Runs every program and command, one at a time, as long as the window
+    /// lives.
+    QThread *exec_thread{};
+    QBInterpreterWorker *worker{};
 
     enum class CommandType {
         RUN,
+        STOP,
         LOAD,
         LIST,
         CLEAR,
@@ -57,6 +86,7 @@ private:
     CommandType getCommandType(std::string_view command);
     std::optional<MiniBasicCmd> getMiniBasicCmd(std::string_view command);
     void run();
+    void stop();
     void load();
     void list();
     void clear();
@@ -65,6 +95,10 @@ private:
     void syncCodeFrag();
 
     void doRun(std::shared_ptr<Fragment> frag);
+    void doRun(std::shared_ptr<Session> session, std::string command);
+    void startRun();
+    /// Append the output printed since the last call to the result.
+    void showOutput();
 };
 } // namespace basic
 
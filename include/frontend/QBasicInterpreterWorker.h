@@ -2,22 +2,33 @@
 #define QBASIC_INTERPRETER_WORKER_H
 
 #include "Fragment.h"
+#include "InputChannel.h"
+#include "OutputChannel.h"
+#include "Session.h"
+#include "Watchdog.h"
 
 #include <QObject>
 #include <memory>
 
-QT_BEGIN_NAMESPACE
-class QEventLoop;
-QT_END_NAMESPACE
-
 namespace basic {
 
+class PreparedProgram;
+
+/**
+ * @brief Runs programs and immediate commands on the interpreter thread.
+ *
+ * One worker lives as long as the window, in a thread of its own. Runs are
+ * queued to it with `QMetaObject::invokeMethod`, and done one at a time, in
+ * order. Each run ends with `resultReady`. `INPUT` takes the lines of the
+ * input channel, and waits for one if there is none. The output goes to the
+ * output channel as it is printed.
+ */
 class QBInterpreterWorker : public QObject {
     Q_OBJECT
 
 public:
-    explicit QBInterpreterWorker(const std::shared_ptr<Fragment> &frag,
-                                 QWidget *input_sender);
+    QBInterpreterWorker(std::shared_ptr<InputChannel> input,
+                        std::shared_ptr<OutputChannel> output);
     ~QBInterpreterWorker() override = default;
 
     // No copy or move.
@@ -26,20 +37,34 @@ public:
     QBInterpreterWorker &operator=(const QBInterpreterWorker &) = delete;
     QBInterpreterWorker &operator=(QBInterpreterWorker &&) = delete;
 
-public slots:
-    void doWork();
-private slots:
-    void receiveInput(QString input);
+    /**
+     * @brief Run the program, until it ends or token is cancelled.
+     */
+    void runProgram(const std::shared_ptr<Fragment> &frag,
+                    std::shared_ptr<const basic_vm::CancelToken> token);
+
+    /**
+     * @brief Run a single command in the session.
+     */
+    void runCommand(const std::shared_ptr<Session> &session,
+                    const std::string &command,
+                    std::shared_ptr<const basic_vm::CancelToken> token);
 
 signals:
-    void resultReady(QString output, QString error, QString ast_out);
+    void resultReady(QString error, QString ast_out);
+    /// The program waits for input, and none is queued.
     void requestInput();
 
 private:
-    std::shared_ptr<Fragment> frag;
-    QWidget *input_sender;
-    std::string input_str{};
-    QEventLoop *loop{};
+    std::shared_ptr<InputChannel> input;
+    std::shared_ptr<OutputChannel> output;
+    /// Of the current run.
+    std::shared_ptr<const basic_vm::CancelToken> cancel_token{};
+    /// The parse of the last program run, reused while it is not edited.
+    std::shared_ptr<PreparedProgram> prepared{};
+
+    /// Take a line of input, asking the window for it if none is queued.
+    std::string waitInput();
 };
 
 } // namespace basic
@@ -0,0 +1,552 @@
+#include "Aot.h"
+
+#if defined(QBASIC_AOT) && defined(__unix__)
+#define BASIC_AOT_DLOPEN 1
+#else
+#define BASIC_AOT_DLOPEN 0
+#endif
+
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <set>
+#include <sstream>
+
+#if BASIC_AOT_DLOPEN
+#include <dlfcn.h>
+#include <unistd.h>
+#endif
+
+namespace basic_vm {
+
+namespace {
+
+/// Declarations shared by every emitted program. The arithmetic helpers
+/// mirror those of common.h, and `struct qbasic_ctx` mirrors `AotContext`.
+const char *const C_PRELUDE = R"(/* Generated by qbasic-aot, ABI 3. */
+#include <stdint.h>
+
+struct qbasic_ctx {
+    int32_t *vars;
+    int *ref_times;
+    int *hits;
+    int *taken;
+    void *host;
+    void (*undefined)(void *host, uint32_t pc, uint32_t slot, int rhs);
+    void (*fail)(void *host, uint32_t pc, int32_t lhs, int32_t rhs);
+    void (*print)(void *host, int32_t value);
+    void (*input)(void *host, uint32_t slot);
+    int (*solve_loop)(void *host, uint32_t index);
+};
+
+static inline int32_t q_add(int32_t a, int32_t b) {
+    return (int32_t)((uint32_t)a + (uint32_t)b);
+}
+
+static inline int32_t q_sub(int32_t a, int32_t b) {
+    return (int32_t)((uint32_t)a - (uint32_t)b);
+}
+
+static inline int32_t q_mul(int32_t a, int32_t b) {
+    return (int32_t)((uint32_t)a * (uint32_t)b);
+}
+
+static inline int32_t q_neg(int32_t a) {
+    return q_sub(0, a);
+}
+
+static inline int32_t q_div(int32_t a, int32_t b) {
+    return b == -1 ? q_neg(a) : a / b;
+}
+
+static inline int32_t q_mod(int32_t a, int32_t b) {
+    if (b == -1) {
+        return 0;
+    }
+    if (a != 0 && (a < 0) != (b < 0)) {
+        a = q_sub(a, q_mul(q_sub(a / b, 1), b));
+    }
+    return a % b;
+}
+
+static inline int32_t q_pow(int32_t base, int32_t e) {
+    int32_t result = 1;
+    while (e > 0) {
+        if (e & 1) {
+            result = q_mul(result, base);
+        }
+        base = q_mul(base, base);
+        e >>= 1;
+    }
+    return result;
+}
+
+/* Count a read of the variable, or report it. */
+#define READ(pc, slot, rhs)                                                    \
+    (ref_times[slot] >= 0                                                      \
+         ? (ref_times[slot]++, 1)                                              \
+         : (ctx->undefined(ctx->host, pc, slot, rhs), 0))
+#define DEFINE(slot, value)                                                    \
+    do {                                                                       \
+        vars[slot] = (value);                                                  \
+        if (ref_times[slot] < 0) {                                             \
+            ref_times[slot] = 0;                                               \
+        }                                                                      \
+    } while (0)
+
+)";
+
+/**
+ * @brief Writes one C statement per instruction.
+ *
+ * Registers become local arrays that the C compiler can keep in registers,
+ * since they are only ever indexed by constants. Poison flags are kept up to
+ * date by every instruction instead of being cleared at the end of each
+ * statement, which comes to the same, since a statement writes every register
+ * before reading it.
+ */
+class CEmitter {
+
+public:
+    CEmitter(const Program &program, std::ostream &os) noexcept
+        : program(program), os(os) {
+    }
+
+    void run() {
+        for (const auto &ins : program.code) {
+            if (is_jump(ins.op)) {
+                targets.insert(ins.index);
+            } else if (ins.op == OpCode::LOAD_INVARIANT ||
+                       ins.op == OpCode::SOLVE_LOOP) {
+                targets.insert(static_cast<std::size_t>(ins.imm));
+            }
+        }
+
+        os << C_PRELUDE;
+        auto num_regs = program.num_regs + 1;
+        os << "void qbasic_main(struct qbasic_ctx *ctx) {\n"
+           << "    int32_t *const vars = ctx->vars;\n"
+           << "    int *const ref_times = ctx->ref_times;\n"
+           << "    int *const hits = ctx->hits;\n"
+           << "    int *const taken = ctx->taken;\n"
+           << "    int32_t r[" << num_regs << "] = {0};\n"
+           << "    unsigned char p[" << num_regs << "] = {0};\n"
+           << "    int lhs_ok = 0, rhs_ok = 0;\n";
+        for (std::size_t pc = 0; pc < program.code.size(); ++pc) {
+            if (targets.count(pc) != 0) {
+                os << "L" << pc << ":\n";
+            }
+            emit(pc, program.code[pc]);
+        }
+        os << "}\n";
+    }
+
+private:
+    const Program &program;
+    std::ostream &os;
+    std::set<std::size_t> targets{};
+
+    static bool is_jump(OpCode op) noexcept {
+        switch (op) {
+        case OpCode::GOTO:
+        case OpCode::IF_EQ:
+        case OpCode::IF_LT:
+        case OpCode::IF_GT:
+        case OpCode::IF_VAR_EQ_CONST:
+        case OpCode::IF_VAR_LT_CONST:
+        case OpCode::IF_VAR_GT_CONST:
+        case OpCode::IF_VAR_EQ_VAR:
+        case OpCode::IF_VAR_LT_VAR:
+        case OpCode::IF_VAR_GT_VAR:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /// A C literal of type int32_t. The minimum has no literal of its own.
+    static std::string literal(VarType value) {
+        if (value == std::numeric_limits<VarType>::min()) {
+            return "(-2147483647 - 1)";
+        }
+        return std::to_string(value);
+    }
+
+    static const char *comparison(OpCode op) noexcept {
+        switch (op) {
+        case OpCode::IF_EQ:
+        case OpCode::IF_VAR_EQ_CONST:
+        case OpCode::IF_VAR_EQ_VAR:
+            return " == ";
+        case OpCode::IF_LT:
+        case OpCode::IF_VAR_LT_CONST:
+        case OpCode::IF_VAR_LT_VAR:
+            return " < ";
+        default:
+            return " > ";
+        }
+    }
+
+    void set(Reg dst, const std::string &value, const std::string &poison) {
+        os << "    r[" << dst << "] = " << value << ";\n"
+           << "    p[" << dst << "] = " << poison << ";\n";
+    }
+
+    void unary(const Instruction &ins, const std::string &value) {
+        set(ins.dst, value, "p[" + std::to_string(ins.a) + "]");
+    }
+
+    void binary(const Instruction &ins, const char *helper) {
+        auto a = std::to_string(ins.a);
+        auto b = std::to_string(ins.b);
+        set(ins.dst, std::string{helper} + "(r[" + a + "], r[" + b + "])",
+            "p[" + a + "] | p[" + b + "]");
+    }
+
+    void jump_if(std::size_t pc, const std::string &cond,
+                 const Instruction &ins) {
+        os << "        hits[" << pc << "]++;\n"
+           << "        if (" << cond << ") {\n"
+           << "            taken[" << pc << "]++;\n"
+           << "            goto L" << ins.index << ";\n"
+           << "        }\n"
+           << "    }\n";
+    }
+
+    void emit(std::size_t pc, const Instruction &ins) {
+        auto r = [](Reg reg) {
+            return "r[" + std::to_string(reg) + "]";
+        };
+        auto var = [](std::uint32_t slot) {
+            return "vars[" + std::to_string(slot) + "]";
+        };
+
+        switch (ins.op) {
+        case OpCode::LOAD_CONST:
+            set(ins.dst, literal(ins.imm), "0");
+            break;
+        case OpCode::LOAD_VAR:
+            os << "    if (READ(" << pc << ", " << ins.index << ", 0)) {\n"
+               << "        " << r(ins.dst) << " = " << var(ins.index)
+               << ";\n"
+               << "        p[" << ins.dst << "] = 0;\n"
+               << "    } else {\n"
+               << "        " << r(ins.dst) << " = 0;\n"
+               << "        p[" << ins.dst << "] = 1;\n"
+               << "    }\n";
+            break;
+        case OpCode::NEG:
+            unary(ins, "q_neg(" + r(ins.a) + ")");
+            break;
+        case OpCode::SQUARE:
+            unary(ins, "q_mul(" + r(ins.a) + ", " + r(ins.a) + ")");
+            break;
+        case OpCode::CUBE:
+            unary(ins, "q_mul(q_mul(" + r(ins.a) + ", " + r(ins.a) + "), " +
+                           r(ins.a) + ")");
+            break;
+        case OpCode::DIV_POW2:
+        case OpCode::DIV_MAGIC:
+            // The C compiler does its own strength reduction.
+            unary(ins, "q_div(" + r(ins.a) + ", " +
+                           literal(program.divisors[ins.index].value) + ")");
+            break;
+        case OpCode::MOD_POW2:
+        case OpCode::MOD_MAGIC:
+            unary(ins, "q_mod(" + r(ins.a) + ", " +
+                           literal(program.divisors[ins.index].value) + ")");
+            break;
+        case OpCode::ADD:
+            binary(ins, "q_add");
+            break;
+        case OpCode::SUB:
+            binary(ins, "q_sub");
+            break;
+        case OpCode::MUL:
+            binary(ins, "q_mul");
+            break;
+        case OpCode::DIV:
+        case OpCode::MOD:
+        case OpCode::POW: {
+            auto cond = ins.op == OpCode::POW ? r(ins.b) + " < 0"
+                                              : r(ins.b) + " == 0";
+            auto helper = ins.op == OpCode::DIV   ? "q_div("
+                          : ins.op == OpCode::MOD ? "q_mod("
+                                                  : "q_pow(";
+            os << "    if (p[" << ins.a << "] | p[" << ins.b << "]) {\n"
+               << "        " << r(ins.dst) << " = 0;\n"
+               << "        p[" << ins.dst << "] = 1;\n"
+               << "    } else if (" << cond << ") {\n"
+               << "        ctx->fail(ctx->host, " << pc << ", " << r(ins.a)
+               << ", " << r(ins.b) << ");\n"
+               << "        " << r(ins.dst) << " = 0;\n"
+               << "        p[" << ins.dst << "] = 1;\n"
+               << "    } else {\n"
+               << "        " << r(ins.dst) << " = " << helper << r(ins.a)
+               << ", " << r(ins.b) << ");\n"
+               << "        p[" << ins.dst << "] = 0;\n"
+               << "    }\n";
+            break;
+        }
+        case OpCode::FAIL:
+            set(ins.dst, "0", "1");
+            break;
+        case OpCode::LET:
+            os << "    hits[" << pc << "]++;\n"
+               << "    if (!p[" << ins.a << "]) {\n"
+               << "        DEFINE(" << ins.index << ", " << r(ins.a) << ");\n"
+               << "    }\n";
+            break;
+        case OpCode::PRINT:
+            os << "    hits[" << pc << "]++;\n"
+               << "    if (!p[" << ins.a << "]) {\n"
+               << "        ctx->print(ctx->host, " << r(ins.a) << ");\n"
+               << "    }\n";
+            break;
+        case OpCode::INPUT:
+            os << "    hits[" << pc << "]++;\n"
+               << "    ctx->input(ctx->host, " << ins.index << ");\n";
+            break;
+        case OpCode::GOTO:
+            os << "    hits[" << pc << "]++;\n"
+               << "    goto L" << ins.index << ";\n";
+            break;
+        case OpCode::IF_EQ:
+        case OpCode::IF_LT:
+        case OpCode::IF_GT:
+            os << "    if (!(p[" << ins.a << "] | p[" << ins.b << "])) {\n";
+            jump_if(pc, r(ins.a) + comparison(ins.op) + r(ins.b), ins);
+            break;
+        case OpCode::END:
+            os << "    return;\n";
+            break;
+        case OpCode::INC_VAR:
+            os << "    hits[" << pc << "]++;\n"
+               << "    if (READ(" << pc << ", " << ins.index << ", 0)) {\n"
+               << "        " << var(ins.index) << " = q_add("
+               << var(ins.index) << ", " << literal(ins.imm) << ");\n"
+               << "    }\n";
+            break;
+        case OpCode::MOVE_VAR:
+            os << "    hits[" << pc << "]++;\n"
+               << "    if (READ(" << pc << ", " << ins.a << ", 0)) {\n"
+               << "        DEFINE(" << ins.index << ", " << var(ins.a)
+               << ");\n"
+               << "    }\n";
+            break;
+        case OpCode::IF_VAR_EQ_CONST:
+        case OpCode::IF_VAR_LT_CONST:
+        case OpCode::IF_VAR_GT_CONST:
+            os << "    if (READ(" << pc << ", " << ins.a << ", 0)) {\n";
+            jump_if(pc, var(ins.a) + comparison(ins.op) + literal(ins.imm),
+                    ins);
+            break;
+        case OpCode::IF_VAR_EQ_VAR:
+        case OpCode::IF_VAR_LT_VAR:
+        case OpCode::IF_VAR_GT_VAR:
+            // Both variables are read, even if the first is undefined.
+            os << "    lhs_ok = READ(" << pc << ", " << ins.a << ", 0);\n"
+               << "    rhs_ok = READ(" << pc << ", " << ins.b << ", 1);\n"
+               << "    if (lhs_ok && rhs_ok) {\n";
+            jump_if(pc, var(ins.a) + comparison(ins.op) + var(ins.b), ins);
+            break;
+        case OpCode::COUNT:
+            os << "    hits[" << pc << "]++;\n";
+            break;
+        case OpCode::TOUCH_VAR:
+            os << "    (void)READ(" << pc << ", " << ins.index << ", 0);\n";
+            break;
+        case OpCode::LOAD_INVARIANT: {
+            const auto &reads =
+                program.invariant_reads[ins.index - program.symbols.size()];
+            os << "    if (ref_times[" << ins.index << "] >= 0) {\n";
+            for (auto slot : reads) {
+                os << "        ref_times[" << slot << "]++;\n";
+            }
+            os << "        " << r(ins.dst) << " = " << var(ins.index)
+               << ";\n"
+               << "        p[" << ins.dst << "] = 0;\n"
+               << "        goto L" << ins.imm << ";\n"
+               << "    }\n";
+            break;
+        }
+        case OpCode::SAVE_INVARIANT:
+            os << "    if (!p[" << ins.a << "]) {\n"
+               << "        DEFINE(" << ins.index << ", " << r(ins.a) << ");\n"
+               << "    }\n";
+            break;
+        case OpCode::DROP_INVARIANT:
+            os << "    ref_times[" << ins.index << "] = -1;\n";
+            break;
+        case OpCode::SOLVE_LOOP:
+            os << "    if (ctx->solve_loop(ctx->host, " << ins.index
+               << ")) {\n"
+               << "        goto L" << ins.imm << ";\n"
+               << "    }\n";
+            break;
+        case OpCode::BAD_LINE:
+            os << "    ctx->fail(ctx->host, " << pc << ", 0, 0);\n"
+               << "    return;\n";
+            break;
+        }
+    }
+};
+
+} // namespace
+
+AotModule::AotModule(void *handle, EntryPoint entry) noexcept
+    : handle(handle), entry(entry) {
+}
+
+AotModule::~AotModule() {
+#if BASIC_AOT_DLOPEN
+    dlclose(handle);
+#endif
+}
+
+std::string emit_c(const Program &program) {
+    std::ostringstream os{};
+    CEmitter{program, os}.run();
+    return os.str();
+}
+
+#if BASIC_AOT_DLOPEN
+
+namespace {
+
+namespace fs = std::filesystem;
+
+/// FNV-1a, which is plenty to tell programs apart.
+std::uint64_t hash_of(std::string_view text,
+                      std::uint64_t hash = 14695981039346656037ULL) noexcept {
+    for (unsigned char c : text) {
+        hash = (hash ^ c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::string shell_quote(const std::string &text) {
+    std::string quoted = "'";
+    for (char c : text) {
+        if (c == '\'') {
+            quoted += "'\\''";
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "'";
+}
+
+/**
+ * @brief Compile source to the shared library lib.
+ *
+ * Everything is written under names of its own first, so that processes
+ * compiling the same program at once never load each other's partial files.
+ */
+bool build(const std::string &source, const fs::path &lib,
+           const AotOptions &options, std::ostream &log) {
+    static std::atomic<unsigned> counter{0};
+    auto stem = lib.stem().string() + "-" + std::to_string(getpid()) + "-" +
+                std::to_string(counter++);
+    auto src = lib.parent_path() / (stem + ".c");
+    auto tmp_lib = lib.parent_path() / (stem + ".so");
+    auto diag = lib.parent_path() / (stem + ".log");
+
+    {
+        std::ofstream ofs{src};
+        ofs << source;
+        if (!ofs) {
+            log << "cannot write " << src.string() << '\n';
+            return false;
+        }
+    }
+
+    auto command = options.compiler + " " + options.flags +
+                   " -shared -fPIC -o " + shell_quote(tmp_lib.string()) +
+                   " " + shell_quote(src.string()) + " > " +
+                   shell_quote(diag.string()) + " 2>&1";
+    bool ok = std::system(command.c_str()) == 0;
+    std::error_code ec{};
+    if (ok) {
+        fs::rename(tmp_lib, lib, ec);
+        if (ec) {
+            log << "cannot create " << lib.string() << ": " << ec.message()
+                << '\n';
+            ok = false;
+        }
+    } else {
+        std::ifstream ifs{diag};
+        log << "C compiler failed: " << command << '\n' << ifs.rdbuf();
+    }
+    fs::remove(src, ec);
+    fs::remove(tmp_lib, ec);
+    fs::remove(diag, ec);
+    return ok;
+}
+
+} // namespace
+
+bool aot_available() noexcept {
+    return true;
+}
+
+std::unique_ptr<AotModule> aot_compile(const Program &program,
+                                       const AotOptions &options,
+                                       std::ostream &log) {
+    auto source = emit_c(program);
+    // The same code compiled differently is a different artifact.
+    auto hash = hash_of(source, hash_of(options.compiler + '\0' +
+                                        options.flags + '\0'));
+    std::ostringstream name{};
+    name << "qbasic-" << std::hex << hash << ".so";
+
+    std::error_code ec{};
+    auto dir = options.cache_dir;
+    if (dir.empty()) {
+        dir = fs::temp_directory_path(ec) / "qbasic-aot";
+    }
+    fs::create_directories(dir, ec);
+    if (ec) {
+        log << "cannot create " << dir.string() << ": " << ec.message()
+            << '\n';
+        return nullptr;
+    }
+
+    auto lib = dir / name.str();
+    if (!fs::exists(lib, ec) && !build(source, lib, options, log)) {
+        return nullptr;
+    }
+
+    void *handle = dlopen(lib.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr) {
+        log << "cannot load " << lib.string() << ": " << dlerror() << '\n';
+        return nullptr;
+    }
+    auto entry = reinterpret_cast<AotModule::EntryPoint>(
+        dlsym(handle, "qbasic_main"));
+    if (entry == nullptr) {
+        log << "no entry point in " << lib.string() << '\n';
+        dlclose(handle);
+        return nullptr;
+    }
+    return std::make_unique<AotModule>(handle, entry);
+}
+
+#else
+
+bool aot_available() noexcept {
+    return false;
+}
+
+std::unique_ptr<AotModule> aot_compile(const Program & /* program */,
+                                       const AotOptions & /* options */,
+                                       std::ostream &log) {
+    log << "loading compiled programs is not supported by this build\n";
+    return nullptr;
+}
+
+#endif
+
+} // namespace basic_vm
@@ -0,0 +1,577 @@
+#include "Bytecode.h"
+
+#include <cassert>
+#include <limits>
+#include <map>
+
+namespace basic_vm {
+
+namespace {
+
+/**
+ * @brief A statement compiled to a single superinstruction.
+ */
+struct Fused {
+    Instruction ins{};
+    /// Where a failure to read a (the first) variable is reported.
+    SourceLoc loc{};
+    /// Where a failure to read the second variable is reported, if any.
+    std::optional<SourceLoc> rhs_loc{};
+};
+
+/// @return The slot, if the expression is a variable whose slot fits in a
+/// register field.
+std::optional<Reg> var_slot(const Module &module, ExprId id) {
+    const auto &expr = module.exprs[id];
+    if (expr.kind != ExprKind::VAR ||
+        expr.operand > std::numeric_limits<Reg>::max()) {
+        return std::nullopt;
+    }
+    return static_cast<Reg>(expr.operand);
+}
+
+std::optional<VarType> const_value(const Module &module, ExprId id) {
+    const auto &expr = module.exprs[id];
+    if (expr.kind != ExprKind::CONST) {
+        return std::nullopt;
+    }
+    return expr.operand;
+}
+
+/// LET x = x + c, LET x = c + x and LET x = x - c.
+std::optional<Fused> fuse_inc_var(const Module &module, const Stm &stm) {
+    const auto &expr = module.exprs[stm.expr];
+    if (stm.kind != StmKind::LET ||
+        (expr.kind != ExprKind::ADD && expr.kind != ExprKind::SUB)) {
+        return std::nullopt;
+    }
+    auto var = expr.lhs;
+    auto c = const_value(module, expr.rhs);
+    if (!c && expr.kind == ExprKind::ADD) {
+        var = expr.rhs;
+        c = const_value(module, expr.lhs);
+    }
+    const auto &var_expr = module.exprs[var];
+    if (!c || var_expr.kind != ExprKind::VAR ||
+        static_cast<SymbolId>(var_expr.operand) != stm.var) {
+        return std::nullopt;
+    }
+    auto step = expr.kind == ExprKind::ADD ? *c : wrapping_neg(*c);
+    return Fused{{OpCode::INC_VAR, 0, 0, 0, step, stm.var}, var_expr.loc};
+}
+
+/// LET a = b.
+std::optional<Fused> fuse_move_var(const Module &module, const Stm &stm) {
+    if (stm.kind != StmKind::LET) {
+        return std::nullopt;
+    }
+    auto src = var_slot(module, stm.expr);
+    if (!src) {
+        return std::nullopt;
+    }
+    return Fused{{OpCode::MOVE_VAR, 0, *src, 0, 0, stm.var},
+                 module.exprs[stm.expr].loc};
+}
+
+/// IF a op c THEN n, and IF c op a THEN n with the comparison mirrored.
+std::optional<Fused> fuse_if_var_const(const Module &module, const Stm &stm) {
+    if (stm.kind != StmKind::IF) {
+        return std::nullopt;
+    }
+    auto var = stm.expr;
+    auto c = const_value(module, stm.rhs);
+    auto cmp = stm.cmp;
+    if (!c) {
+        var = stm.rhs;
+        c = const_value(module, stm.expr);
+        cmp = cmp == CmpOp::LT ? CmpOp::GT
+              : cmp == CmpOp::GT ? CmpOp::LT
+                                 : cmp;
+    }
+    auto slot = var_slot(module, var);
+    if (!c || !slot) {
+        return std::nullopt;
+    }
+    OpCode op = cmp == CmpOp::EQ   ? OpCode::IF_VAR_EQ_CONST
+                : cmp == CmpOp::LT ? OpCode::IF_VAR_LT_CONST
+                                   : OpCode::IF_VAR_GT_CONST;
+    return Fused{{op, 0, *slot, 0, *c, stm.target}, module.exprs[var].loc};
+}
+
+/// IF a op b THEN n.
+std::optional<Fused> fuse_if_var_var(const Module &module, const Stm &stm) {
+    if (stm.kind != StmKind::IF) {
+        return std::nullopt;
+    }
+    auto lhs = var_slot(module, stm.expr);
+    auto rhs = var_slot(module, stm.rhs);
+    if (!lhs || !rhs) {
+        return std::nullopt;
+    }
+    OpCode op = stm.cmp == CmpOp::EQ   ? OpCode::IF_VAR_EQ_VAR
+                : stm.cmp == CmpOp::LT ? OpCode::IF_VAR_LT_VAR
+                                       : OpCode::IF_VAR_GT_VAR;
+    return Fused{{op, 0, *lhs, *rhs, 0, stm.target},
+                 module.exprs[stm.expr].loc,
+                 module.exprs[stm.rhs].loc};
+}
+
+/**
+ * The statement shapes that compile to a superinstruction, tried in order.
+ * The instruction must behave exactly like the run it replaces, including
+ * which variables are read and which errors are reported. A fused IF jumps
+ * to the line in its index, like IF_* does.
+ */
+constexpr std::optional<Fused> (*FUSIONS[])(const Module &, const Stm &) = {
+    fuse_inc_var,
+    fuse_move_var,
+    fuse_if_var_const,
+    fuse_if_var_var,
+};
+
+class CodeGen {
+
+public:
+    explicit CodeGen(const Module &module) noexcept : module(module) {
+    }
+
+    std::optional<Program> run() {
+        program.symbols = module.symbols;
+        program.stm_pc.assign(module.stms.size(), Program::NO_PC);
+        drops.resize(module.symbols.size());
+        for (const auto &stm : module.stms) {
+            if (stm.kind == StmKind::LET || stm.kind == StmKind::PRINT ||
+                stm.kind == StmKind::IF) {
+                find_invariants(stm.expr);
+            }
+            if (stm.kind == StmKind::IF) {
+                find_invariants(stm.rhs);
+            }
+        }
+
+        std::map<std::size_t, std::size_t> loop_at{};
+        for (std::size_t l = 0; l < module.counted_loops.size(); ++l) {
+            loop_at.emplace(module.counted_loops[l].begin, l);
+        }
+        // The SOLVE_LOOP of the loop being emitted, and the pc its jump back
+        // leads to.
+        std::optional<std::pair<std::size_t, std::size_t>> open_loop{};
+
+        for (std::size_t i = 0; i < module.stms.size(); ++i) {
+            const auto &stm = module.stms[i];
+            current_line = stm.line;
+            line_to_pc.emplace(stm.line, program.code.size());
+            if (auto it = loop_at.find(i); it != end(loop_at)) {
+                auto solve_pc = emit_solve(module.counted_loops[it->second]);
+                open_loop.emplace(solve_pc, program.code.size());
+            }
+            program.stm_pc[i] = emit_stm(stm);
+            if (overflow) {
+                return std::nullopt;
+            }
+            if (open_loop && program.counted_loops.back().end == i + 1) {
+                // The jump back, which is the last jump emitted, skips the
+                // SOLVE_LOOP.
+                auto pc = program.stm_pc[i];
+                jumps.pop_back();
+                program.code[pc].index =
+                    static_cast<std::uint32_t>(open_loop->second);
+                program.code[open_loop->first].imm =
+                    static_cast<VarType>(pc + 1);
+                open_loop.reset();
+            }
+        }
+        // Falling through the last line, or jumping to line 0, ends the
+        // program.
+        current_line = 0;
+        line_to_pc.emplace(0, program.code.size());
+        emit({OpCode::END});
+
+        for (auto pc : jumps) {
+            // Resolving may emit a BAD_LINE, so don't hold a reference.
+            auto target = resolve(program.code[pc].index);
+            program.code[pc].index = target;
+        }
+
+        program.num_regs = max_reg;
+        return std::move(program);
+    }
+
+private:
+    const Module &module;
+    Program program{};
+    std::size_t max_reg = 0;
+    bool overflow = false;
+    LSize current_line = 0;
+
+    /// Line number to the first instruction of that line. Lines without code
+    /// (REM, ERROR) lead to the code of the next line.
+    std::map<LSize, std::size_t> line_to_pc{};
+    /// The jumps, whose index is a line number until they are resolved.
+    std::vector<std::size_t> jumps{};
+    /// The BAD_LINE emitted for each line that doesn't exist.
+    std::map<LSize, std::size_t> bad_lines{};
+    /// The hidden slot of each INVARIANT node.
+    std::map<ExprId, std::uint32_t> invariant_slots{};
+    /// For each variable, the hidden slots whose values depend on it.
+    std::vector<std::vector<std::uint32_t>> drops{};
+
+    void find_invariants(ExprId id) {
+        const auto &expr = module.exprs[id];
+        switch (expr.kind) {
+        case ExprKind::CONST:
+        case ExprKind::VAR:
+        case ExprKind::ERROR:
+            return;
+        case ExprKind::INVARIANT:
+            break;
+        case ExprKind::NEG:
+        case ExprKind::SQUARE:
+        case ExprKind::CUBE:
+        case ExprKind::DIV_CONST:
+        case ExprKind::MOD_CONST:
+            find_invariants(expr.lhs);
+            return;
+        default:
+            find_invariants(expr.lhs);
+            find_invariants(expr.rhs);
+            return;
+        }
+
+        auto slot = static_cast<std::uint32_t>(program.num_slots());
+        invariant_slots.emplace(id, slot);
+        auto &reads = program.invariant_reads.emplace_back();
+        collect_reads(expr.lhs, reads);
+        for (auto var : reads) {
+            if (drops[var].empty() || drops[var].back() != slot) {
+                drops[var].push_back(slot);
+            }
+        }
+    }
+
+    void collect_reads(ExprId id, std::vector<std::uint32_t> &reads) const {
+        const auto &expr = module.exprs[id];
+        switch (expr.kind) {
+        case ExprKind::CONST:
+        case ExprKind::ERROR:
+            return;
+        case ExprKind::VAR:
+            reads.push_back(static_cast<std::uint32_t>(expr.operand));
+            return;
+        case ExprKind::NEG:
+        case ExprKind::SQUARE:
+        case ExprKind::CUBE:
+        case ExprKind::DIV_CONST:
+        case ExprKind::MOD_CONST:
+        case ExprKind::INVARIANT:
+            collect_reads(expr.lhs, reads);
+            return;
+        default:
+            collect_reads(expr.lhs, reads);
+            collect_reads(expr.rhs, reads);
+            return;
+        }
+    }
+
+    /// Forget the kept values that depend on the variable, before it is
+    /// assigned.
+    void emit_drops(SymbolId var) {
+        for (auto slot : drops[var]) {
+            emit({OpCode::DROP_INVARIANT, 0, 0, 0, 0, slot});
+        }
+    }
+
+    /**
+     * @brief Emit the SOLVE_LOOP of the loop, after forgetting the kept
+     * values that depend on the variables it assigns.
+     *
+     * @return Its pc. The pc to go on at is patched once the loop is emitted.
+     */
+    std::size_t emit_solve(const CountedLoop &loop) {
+        emit_drops(loop.counter);
+        for (const auto &update : loop.updates) {
+            if (update.kind != CountedLoop::UpdateKind::NONE) {
+                emit_drops(update.var);
+            }
+        }
+        auto index = static_cast<std::uint32_t>(program.counted_loops.size());
+        program.counted_loops.push_back(loop);
+        return emit({OpCode::SOLVE_LOOP, 0, 0, 0, 0, index});
+    }
+
+    std::uint32_t resolve(LSize line) {
+        if (auto it = line_to_pc.find(line); it != end(line_to_pc)) {
+            return static_cast<std::uint32_t>(it->second);
+        }
+        auto [it, inserted] = bad_lines.emplace(line, 0);
+        if (inserted) {
+            it->second = emit({OpCode::BAD_LINE, 0, 0, 0, 0, line});
+        }
+        return static_cast<std::uint32_t>(it->second);
+    }
+
+    std::uint32_t add_divisor(const Divisor &divisor) {
+        auto &divisors = program.divisors;
+        for (std::size_t i = 0; i < divisors.size(); ++i) {
+            if (divisors[i].value == divisor.value) {
+                return static_cast<std::uint32_t>(i);
+            }
+        }
+        divisors.push_back(divisor);
+        return static_cast<std::uint32_t>(divisors.size() - 1);
+    }
+
+    std::size_t emit(const Instruction &ins, SourceLoc loc = {}) {
+        program.code.push_back(ins);
+        program.locs.push_back(loc);
+        program.lines.push_back(current_line);
+        return program.code.size() - 1;
+    }
+
+    /**
+     * @return The pc of the instruction that carries the effect of the
+     * statement, or NO_PC if the statement has no code.
+     */
+    std::size_t emit_stm(const Stm &stm) {
+        if (stm.kind == StmKind::LET && stm.discard) {
+            emit_effects(stm.expr);
+            return emit({OpCode::COUNT});
+        }
+        for (auto fusion : FUSIONS) {
+            if (auto fused = fusion(module, stm)) {
+                if (stm.kind == StmKind::LET) {
+                    emit_drops(stm.var);
+                }
+                auto pc = emit(fused->ins, fused->loc);
+                if (fused->rhs_loc) {
+                    program.rhs_locs.emplace(pc, *fused->rhs_loc);
+                }
+                if (stm.kind == StmKind::IF) {
+                    jumps.push_back(pc);
+                }
+                return pc;
+            }
+        }
+
+        switch (stm.kind) {
+        case StmKind::REM:
+        case StmKind::ERROR:
+            return Program::NO_PC;
+        case StmKind::LET:
+            emit_expr(stm.expr, 0);
+            emit_drops(stm.var);
+            return emit({OpCode::LET, 0, 0, 0, 0, stm.var});
+        case StmKind::PRINT:
+            emit_expr(stm.expr, 0);
+            return emit({OpCode::PRINT});
+        case StmKind::INPUT:
+            emit_drops(stm.var);
+            return emit({OpCode::INPUT, 0, 0, 0, 0, stm.var});
+        case StmKind::GOTO:
+            jumps.push_back(emit({OpCode::GOTO, 0, 0, 0, 0, stm.target}));
+            return jumps.back();
+        case StmKind::IF: {
+            emit_expr(stm.expr, 0);
+            emit_expr(stm.rhs, 1);
+            OpCode op{};
+            switch (stm.cmp) {
+            case CmpOp::EQ:
+                op = OpCode::IF_EQ;
+                break;
+            case CmpOp::LT:
+                op = OpCode::IF_LT;
+                break;
+            case CmpOp::GT:
+                op = OpCode::IF_GT;
+                break;
+            }
+            jumps.push_back(emit({op, 0, 0, 1, 0, stm.target}));
+            return jumps.back();
+        }
+        case StmKind::END:
+            return emit({OpCode::END});
+        }
+        assert(0);
+        return Program::NO_PC;
+    }
+
+    /**
+     * @brief Evaluate the expression into register dst. Operands of a node
+     * are evaluated into the registers above dst, so the number of registers
+     * equals the depth of the deepest expression.
+     */
+    void emit_expr(ExprId id, std::size_t dst) {
+        if (dst >= std::numeric_limits<Reg>::max()) {
+            overflow = true;
+            return;
+        }
+        max_reg = std::max(max_reg, dst + 1);
+        auto reg = static_cast<Reg>(dst);
+        const auto &expr = module.exprs[id];
+
+        switch (expr.kind) {
+        case ExprKind::CONST:
+            emit({OpCode::LOAD_CONST, reg, 0, 0, expr.operand});
+            return;
+        case ExprKind::VAR:
+            emit({OpCode::LOAD_VAR, reg, 0, 0, 0,
+                  static_cast<std::uint32_t>(expr.operand)},
+                 expr.loc);
+            return;
+        case ExprKind::NEG:
+            emit_expr(expr.lhs, dst);
+            emit({OpCode::NEG, reg, reg});
+            return;
+        case ExprKind::SQUARE:
+            emit_expr(expr.lhs, dst);
+            emit({OpCode::SQUARE, reg, reg});
+            return;
+        case ExprKind::CUBE:
+            emit_expr(expr.lhs, dst);
+            emit({OpCode::CUBE, reg, reg});
+            return;
+        case ExprKind::DIV_CONST:
+        case ExprKind::MOD_CONST: {
+            emit_expr(expr.lhs, dst);
+            auto divisor = Divisor::of(expr.operand);
+            OpCode op{};
+            if (expr.kind == ExprKind::DIV_CONST) {
+                op = divisor.is_pow2() ? OpCode::DIV_POW2 : OpCode::DIV_MAGIC;
+            } else {
+                op = divisor.is_pow2() ? OpCode::MOD_POW2 : OpCode::MOD_MAGIC;
+            }
+            emit({op, reg, reg, 0, 0, add_divisor(divisor)});
+            return;
+        }
+        case ExprKind::ERROR:
+            emit({OpCode::FAIL, reg});
+            return;
+        case ExprKind::INVARIANT: {
+            auto slot = invariant_slots.at(id);
+            auto load = emit({OpCode::LOAD_INVARIANT, reg, 0, 0, 0, slot});
+            emit_expr(expr.lhs, dst);
+            emit({OpCode::SAVE_INVARIANT, 0, reg, 0, 0, slot});
+            program.code[load].imm = static_cast<VarType>(program.code.size());
+            return;
+        }
+        default:
+            break;
+        }
+
+        emit_expr(expr.lhs, dst);
+        emit_expr(expr.rhs, dst + 1);
+        OpCode op{};
+        switch (expr.kind) {
+        case ExprKind::ADD:
+            op = OpCode::ADD;
+            break;
+        case ExprKind::SUB:
+            op = OpCode::SUB;
+            break;
+        case ExprKind::MUL:
+            op = OpCode::MUL;
+            break;
+        case ExprKind::DIV:
+            op = OpCode::DIV;
+            break;
+        case ExprKind::MOD:
+            op = OpCode::MOD;
+            break;
+        case ExprKind::POW:
+            op = OpCode::POW;
+            break;
+        default:
+            assert(0);
+        }
+        emit({op, reg, reg, static_cast<Reg>(reg + 1)}, expr.loc);
+    }
+
+    /**
+     * @brief Emit only what the evaluation of the expression may report:
+     * the reads of variables, and the operations that may fail, with their
+     * operands.
+     */
+    void emit_effects(ExprId id) {
+        const auto &expr = module.exprs[id];
+        switch (expr.kind) {
+        case ExprKind::CONST:
+        case ExprKind::ERROR:
+            return;
+        case ExprKind::VAR:
+            emit({OpCode::TOUCH_VAR, 0, 0, 0, 0,
+                  static_cast<std::uint32_t>(expr.operand)},
+                 expr.loc);
+            return;
+        case ExprKind::NEG:
+        case ExprKind::SQUARE:
+        case ExprKind::CUBE:
+        case ExprKind::DIV_CONST:
+        case ExprKind::MOD_CONST:
+            emit_effects(expr.lhs);
+            return;
+        case ExprKind::ADD:
+        case ExprKind::SUB:
+        case ExprKind::MUL:
+            emit_effects(expr.lhs);
+            emit_effects(expr.rhs);
+            return;
+        default:
+            emit_expr(id, 0);
+            return;
+        }
+    }
+};
+
+} // namespace
+
+Divisor Divisor::of(VarType value) noexcept {
+    assert(value < -1 || value > 1);
+    constexpr std::uint32_t two31 = 0x80000000;
+    auto magnitude = static_cast<std::uint32_t>(value < 0 ? -std::int64_t{value}
+                                                          : value);
+    if ((magnitude & (magnitude - 1)) == 0) {
+        std::uint32_t shift = 0;
+        while ((std::uint32_t{1} << shift) != magnitude) {
+            ++shift;
+        }
+        return {value, 0, shift};
+    }
+
+    // Find the least p >= 32 such that 2 ** p > anc * (magnitude - 2 ** p %
+    // magnitude), where anc is the largest dividend with anc % magnitude =
+    // magnitude - 1 (Hacker's Delight, figure 10-1).
+    std::uint32_t t = two31 + (static_cast<std::uint32_t>(value) >> 31);
+    std::uint32_t anc = t - 1 - t % magnitude;
+    std::uint32_t p = 31;
+    std::uint32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+    std::uint32_t q2 = two31 / magnitude, r2 = two31 - q2 * magnitude;
+    std::uint32_t delta{};
+    do {
+        ++p;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            ++q1;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= magnitude) {
+            ++q2;
+            r2 -= magnitude;
+        }
+        delta = magnitude - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    auto multiplier = static_cast<VarType>(q2 + 1);
+    if (value < 0) {
+        multiplier = wrapping_neg(multiplier);
+    }
+    return {value, multiplier, p - 32};
+}
+
+std::optional<Program> compile(const Module &module) {
+    return CodeGen{module}.run();
+}
+
+} // namespace basic_vm
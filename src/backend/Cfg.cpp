@@ -0,0 +1,334 @@
+#include "Cfg.h"
+
+#include <algorithm>
+#include <cassert>
+#include <map>
+
+namespace basic_vm {
+
+namespace {
+
+bool is_jump(StmKind kind) noexcept {
+    return kind == StmKind::GOTO || kind == StmKind::IF;
+}
+
+/// Whether control may not go on to the next statement.
+bool ends_block(StmKind kind) noexcept {
+    return is_jump(kind) || kind == StmKind::END;
+}
+
+/**
+ * @brief Cooper, Harvey and Kennedy's "A Simple, Fast Dominance Algorithm".
+ */
+void find_dominators(Cfg &cfg) {
+    auto n = cfg.blocks.size();
+    cfg.idom.assign(n, Cfg::EXIT);
+    if (n == 0) {
+        return;
+    }
+
+    // Reverse postorder of the blocks reachable from the first one.
+    std::vector<std::size_t> order{};
+    std::vector<bool> visited(n, false);
+    std::vector<std::pair<std::size_t, std::size_t>> stack{{0, 0}};
+    visited[0] = true;
+    while (!stack.empty()) {
+        auto &[block, next] = stack.back();
+        const auto &succs = cfg.blocks[block].succs;
+        if (next == succs.size()) {
+            order.push_back(block);
+            stack.pop_back();
+            continue;
+        }
+        auto succ = succs[next++];
+        if (succ != Cfg::EXIT && !visited[succ]) {
+            visited[succ] = true;
+            stack.emplace_back(succ, 0);
+        }
+    }
+    std::reverse(order.begin(), order.end());
+    std::vector<std::size_t> rank(n, 0);
+    for (std::size_t i = 0; i < order.size(); ++i) {
+        rank[order[i]] = i;
+    }
+
+    auto &idom = cfg.idom;
+    auto intersect = [&](std::size_t a, std::size_t b) {
+        while (a != b) {
+            while (rank[a] > rank[b]) {
+                a = idom[a];
+            }
+            while (rank[b] > rank[a]) {
+                b = idom[b];
+            }
+        }
+        return a;
+    };
+    idom[0] = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto block : order) {
+            if (block == 0) {
+                continue;
+            }
+            auto new_idom = Cfg::EXIT;
+            for (auto pred : cfg.blocks[block].preds) {
+                if (idom[pred] == Cfg::EXIT) {
+                    continue;
+                }
+                new_idom =
+                    new_idom == Cfg::EXIT ? pred : intersect(pred, new_idom);
+            }
+            if (idom[block] != new_idom) {
+                idom[block] = new_idom;
+                changed = true;
+            }
+        }
+    }
+    idom[0] = Cfg::EXIT;
+}
+
+bool dominates(const Cfg &cfg, std::size_t a, std::size_t b) {
+    while (b != a && b != 0) {
+        b = cfg.idom[b];
+    }
+    return b == a;
+}
+
+void find_loops(Cfg &cfg) {
+    std::map<std::size_t, Loop> loops{};
+    for (std::size_t block = 0; block < cfg.blocks.size(); ++block) {
+        if (!cfg.is_reachable(block)) {
+            continue;
+        }
+        for (auto succ : cfg.blocks[block].succs) {
+            if (succ != Cfg::EXIT && dominates(cfg, succ, block)) {
+                loops[succ].header = succ;
+                loops[succ].latches.push_back(block);
+            }
+        }
+    }
+
+    cfg.block_loop.assign(cfg.blocks.size(), Cfg::NO_LOOP);
+    for (auto &[header, loop] : loops) {
+        std::vector<bool> in_loop(cfg.blocks.size(), false);
+        in_loop[header] = true;
+        auto work = loop.latches;
+        while (!work.empty()) {
+            auto block = work.back();
+            work.pop_back();
+            if (in_loop[block]) {
+                continue;
+            }
+            in_loop[block] = true;
+            for (auto pred : cfg.blocks[block].preds) {
+                if (cfg.is_reachable(pred)) {
+                    work.push_back(pred);
+                }
+            }
+        }
+        for (std::size_t block = 0; block < in_loop.size(); ++block) {
+            if (in_loop[block]) {
+                loop.blocks.push_back(block);
+            }
+        }
+        cfg.loops.push_back(std::move(loop));
+    }
+
+    // Two natural loops are either nested or disjoint, so the smallest loop
+    // containing a block is the innermost.
+    for (std::size_t i = 0; i < cfg.loops.size(); ++i) {
+        for (auto block : cfg.loops[i].blocks) {
+            auto &inner = cfg.block_loop[block];
+            if (inner == Cfg::NO_LOOP ||
+                cfg.loops[i].blocks.size() < cfg.loops[inner].blocks.size()) {
+                inner = i;
+            }
+        }
+    }
+}
+
+std::string describe(const Module &module, const Stm &stm) {
+    auto line = std::to_string(stm.line);
+    switch (stm.kind) {
+    case StmKind::REM:
+        return line + " REM";
+    case StmKind::LET:
+        return line + " LET " + module.symbols[stm.var];
+    case StmKind::PRINT:
+        return line + " PRINT";
+    case StmKind::INPUT:
+        return line + " INPUT " + module.symbols[stm.var];
+    case StmKind::GOTO:
+        return line + " GOTO " + std::to_string(stm.target);
+    case StmKind::IF:
+        return line + " IF THEN " + std::to_string(stm.target);
+    case StmKind::END:
+        return line + " END";
+    case StmKind::ERROR:
+        return line + " ERROR";
+    }
+    assert(0);
+    return line;
+}
+
+} // namespace
+
+Cfg build_cfg(const Module &module) {
+    Cfg cfg{};
+    const auto &stms = module.stms;
+    auto n = stms.size();
+
+    std::map<LSize, std::size_t> line_to_stm{};
+    for (std::size_t i = 0; i < n; ++i) {
+        line_to_stm.emplace(stms[i].line, i);
+    }
+    auto target_of = [&](const Stm &stm) {
+        auto it = line_to_stm.find(stm.target);
+        return stm.target == 0 || it == end(line_to_stm) ? Cfg::EXIT
+                                                         : it->second;
+    };
+
+    std::vector<bool> leaders(n, false);
+    for (std::size_t i = 0; i < n; ++i) {
+        if (i == 0 || ends_block(stms[i - 1].kind)) {
+            leaders[i] = true;
+        }
+        if (is_jump(stms[i].kind)) {
+            if (auto target = target_of(stms[i]); target != Cfg::EXIT) {
+                leaders[target] = true;
+            }
+        }
+    }
+
+    cfg.stm_block.resize(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        if (leaders[i]) {
+            cfg.blocks.push_back({i, i});
+        }
+        cfg.blocks.back().end = i + 1;
+        cfg.stm_block[i] = cfg.blocks.size() - 1;
+    }
+
+    for (std::size_t block = 0; block < cfg.blocks.size(); ++block) {
+        auto &succs = cfg.blocks[block].succs;
+        const auto &last = stms[cfg.blocks[block].end - 1];
+        if (is_jump(last.kind)) {
+            auto target = target_of(last);
+            succs.push_back(target == Cfg::EXIT ? Cfg::EXIT
+                                                : cfg.stm_block[target]);
+        }
+        if (last.kind != StmKind::GOTO && last.kind != StmKind::END) {
+            auto next = block + 1 < cfg.blocks.size() ? block + 1 : Cfg::EXIT;
+            if (succs.empty() || succs.front() != next) {
+                succs.push_back(next);
+            }
+        }
+        if (last.kind == StmKind::END) {
+            succs.push_back(Cfg::EXIT);
+        }
+        for (auto succ : succs) {
+            if (succ != Cfg::EXIT) {
+                cfg.blocks[succ].preds.push_back(block);
+            }
+        }
+    }
+
+    find_dominators(cfg);
+    find_loops(cfg);
+    return cfg;
+}
+
+void write_dot(std::ostream &os, const Module &module, const Cfg &cfg,
+               const std::vector<int> &hits, const std::vector<int> &taken) {
+    bool has_counts = !hits.empty();
+    const auto &stms = module.stms;
+
+    // A statement counts when it completes, so blocks without one that does
+    // (e.g. only REM and END) are counted by the edges that lead to them.
+    std::vector<std::int64_t> block_counts(cfg.blocks.size(), 0);
+    std::vector<std::vector<std::int64_t>> edge_counts(cfg.blocks.size());
+    std::vector<std::int64_t> incoming(cfg.blocks.size(), 0);
+    for (std::size_t block = 0; has_counts && block < cfg.blocks.size();
+         ++block) {
+        const auto &bb = cfg.blocks[block];
+        auto &count = block_counts[block];
+        for (auto i = bb.begin; i < bb.end; ++i) {
+            count = std::max<std::int64_t>(count, hits[i]);
+        }
+        if (count == 0) {
+            count = incoming[block];
+        }
+
+        auto last = bb.end - 1;
+        for (std::size_t k = 0; k < bb.succs.size(); ++k) {
+            std::int64_t edge = count;
+            if (stms[last].kind == StmKind::GOTO) {
+                edge = hits[last];
+            } else if (stms[last].kind == StmKind::IF) {
+                edge = bb.succs.size() == 1 ? hits[last]
+                       : k == 0             ? taken[last]
+                                            : hits[last] - taken[last];
+            }
+            edge_counts[block].push_back(edge);
+            if (bb.succs[k] != Cfg::EXIT) {
+                incoming[bb.succs[k]] += edge;
+            }
+        }
+    }
+
+    std::vector<bool> is_header(cfg.blocks.size(), false);
+    for (const auto &loop : cfg.loops) {
+        is_header[loop.header] = true;
+    }
+
+    os << "digraph cfg {\n"
+       << "    node [shape=box, fontname=\"monospace\"];\n"
+       << "    exit [shape=oval];\n";
+    for (std::size_t block = 0; block < cfg.blocks.size(); ++block) {
+        const auto &bb = cfg.blocks[block];
+        os << "    b" << block << " [label=\"";
+        for (auto i = bb.begin; i < bb.end; ++i) {
+            os << describe(module, stms[i]) << "\\l";
+        }
+        if (has_counts) {
+            os << "count: " << block_counts[block] << "\\l";
+        }
+        os << "\"";
+        if (is_header[block]) {
+            os << ", peripheries=2";
+        }
+        if (!cfg.is_reachable(block)) {
+            os << ", style=dotted";
+        }
+        os << "];\n";
+    }
+    for (std::size_t block = 0; block < cfg.blocks.size(); ++block) {
+        const auto &succs = cfg.blocks[block].succs;
+        for (std::size_t k = 0; k < succs.size(); ++k) {
+            os << "    b" << block << " -> ";
+            if (succs[k] == Cfg::EXIT) {
+                os << "exit";
+            } else {
+                os << "b" << succs[k];
+            }
+            std::vector<std::string> attrs{};
+            if (has_counts) {
+                attrs.push_back("label=\"" +
+                                std::to_string(edge_counts[block][k]) + "\"");
+            }
+            if (succs[k] != Cfg::EXIT && cfg.is_reachable(block) &&
+                dominates(cfg, succs[k], block)) {
+                attrs.emplace_back("style=dashed");
+            }
+            for (std::size_t a = 0; a < attrs.size(); ++a) {
+                os << (a == 0 ? " [" : ", ") << attrs[a];
+            }
+            os << (attrs.empty() ? ";\n" : "];\n");
+        }
+    }
+    os << "}\n";
+}
+
+} // namespace basic_vm
@@ -0,0 +1,43 @@
+#include "InputChannel.h"
+
+namespace basic {
+
+void InputChannel::push(std::string line) {
+    {
+        std::lock_guard lock{mutex};
+        lines.push_back(std::move(line));
+    }
+    ready.notify_one();
+}
+
+std::optional<std::string> InputChannel::pop(
+    const basic_vm::CancelToken *token) {
+    std::unique_lock lock{mutex};
+    auto cancelled = [token] { return token && token->is_cancelled(); };
+    ready.wait(lock, [&] { return !lines.empty() || cancelled(); });
+    if (cancelled()) {
+        return std::nullopt;
+    }
+    auto line = std::move(lines.front());
+    lines.pop_front();
+    return line;
+}
+
+void InputChannel::wake() {
+    // Taking the lock orders the wake-up after the check of a `pop` that is
+    // about to wait, so it is not lost.
+    std::lock_guard lock{mutex};
+    ready.notify_all();
+}
+
+void InputChannel::clear() {
+    std::lock_guard lock{mutex};
+    lines.clear();
+}
+
+std::size_t InputChannel::size() const {
+    std::lock_guard lock{mutex};
+    return lines.size();
+}
+
+} // namespace basic
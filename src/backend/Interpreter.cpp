@@ -1,60 +1,17 @@
 #include "Interpreter.h"
+#include "Cfg.h"
+#include "PreparedProgram.h"
+#include "Syntax.h"
+#include "VirtualMachine.h"
 #include "Visitor.h"
 #include "common.h"
-#include <BasicANTLR.h>
 
 #include <cassert>
-
-using namespace antlr_basic;
-using namespace antlr4;
-
-namespace {
-
-class CustomErrorListener : public BaseErrorListener {
-
-    void syntaxError(Recognizer *recognizer, Token *offendingSymbol,
-                     size_t line, size_t charPositionInLine,
-                     const std::string &msg, std::exception_ptr e) override {
-        last_err_line = line;
-    }
-
-public:
-    basic::LSize last_err_line = 0;
-};
-
-class ThrowExceptionStrategy : public DefaultErrorStrategy {
-
-public:
-    void recover(Parser *recognizer, std::exception_ptr e) override {
-        throw NoViableAltException{recognizer};
-    }
-
-    Token *recoverInline(Parser *recognizer) override {
-        throw NoViableAltException{recognizer};
-    }
-};
-
-} // namespace
+#include <chrono>
+#include <sstream>
 
 namespace basic {
 
-// NOLINTNEXTLINE(cppcoreguidelines-macro-usage)
-#define GET_BASIC_PARSER()                                                     \
-    auto code_stream = frag->get_frag_stream();                                \
-    ANTLRInputStream input(code_stream);                                       \
-                                                                               \
-    /* Lexer, get tokens */                                                    \
-    BasicLexer lexer(&input);                                                  \
-    CommonTokenStream tokens(&lexer);                                          \
-    tokens.fill();                                                             \
-                                                                               \
-    /* Configure a parse */                                                    \
-    BasicParser parser(&tokens);                                               \
-    parser.setErrorHandler(std::make_shared<ThrowExceptionStrategy>());        \
-    parser.removeErrorListeners();                                             \
-    CustomErrorListener my_lister{};                                           \
-    parser.addErrorListener(&my_lister);
-
 Interpreter::Interpreter(std::shared_ptr<Fragment> frag, std::ostream &out,
                          std::ostream &err, std::istream &is)
     : Interpreter(std::move(frag), out, err, [&is]() -> std::string {
@@ -78,21 +35,125 @@ Interpreter::Interpreter(std::shared_ptr<Fragment> frag, std::ostream &out,
       input_action(std::move(input_action)) {
 }
 
+std::future<void> Interpreter::warm_up_parser() {
+    return std::async(std::launch::async, &PreparedProgram::warm_up);
+}
+
 void Interpreter::interpret() {
-    rewrite();
-    GET_BASIC_PARSER();
+    parse_stats = {};
+    tier_stats = {};
+    aot_log.clear();
+    if (parse_mode == ParseMode::HAND_WRITTEN &&
+        exec_mode != ExecMode::TREE_WALK && !shared_env) {
+        if (!prepare_source()) {
+            fail_to_parse();
+            return;
+        }
+        if (interpret_source()) {
+            has_exec = true;
+            return;
+        }
+    }
 
-    tree::ParseTree *tree = parser.prog();
+    if (!prepare()) {
+        fail_to_parse();
+        return;
+    }
+    err << prepared->get_decode_errors();
+    prepared->reset_counters();
+    auto *tree = prepared->get_tree();
+
+    std::shared_ptr<VariableEnv> v_env{};
+    if (exec_mode != ExecMode::TREE_WALK && !shared_env) {
+        basic_visitor::LowerVisitor lower_visitor{};
+        auto module = lower_visitor.lower(tree);
+        std::vector<int> hits{};
+        std::vector<int> taken{};
+        v_env = run_module(module, {}, hits, taken);
+        if (v_env) {
+            lower_visitor.write_back(hits, taken);
+        }
+    }
+    if (!v_env) {
+        // Visitor, interpret
+        basic_visitor::InterpretVisitor exec_visitor{out, err, input_action};
+        exec_visitor.set_watchdog({exec_budget, cancel_token});
+        exec_visitor.set_symbols(prepared->get_symbols());
+        if (shared_env) {
+            exec_visitor.set_var_env(shared_env);
+        }
+        exec_visitor.visit(tree);
+        v_env = exec_visitor.get_var_env();
+    }
 
-    // Visitor, interpret
-    basic_visitor::InterpretVisitor exec_visitor{out, err, input_action};
-    exec_visitor.visit(tree);
-    basic_visitor::ASTConstructVisitor ast_visitor{exec_visitor.get_var_env()};
+    basic_visitor::ASTConstructVisitor ast_visitor{v_env};
     ast_visitor.visit(tree);
     ast_res = ast_visitor.get_ast();
     has_exec = true;
 }
 
+bool Interpreter::interpret_source() {
+    auto module = source->lower();
+    std::vector<int> hits{};
+    std::vector<int> taken{};
+    auto v_env =
+        run_module(module, source->get_decode_errors(), hits, taken);
+    if (!v_env) {
+        return false;
+    }
+    ast_res = source->render_ast(hits, taken, *v_env);
+    return true;
+}
+
+std::shared_ptr<VariableEnv>
+Interpreter::run_module(basic_vm::Module &module,
+                        std::string_view static_errors,
+                        std::vector<int> &hits, std::vector<int> &taken) {
+    // Errors found at compile time are held back, since the tree walker
+    // reports them again if the program falls back.
+    std::stringstream compile_err{};
+    basic_vm::optimize(module, optimize_options, compile_err);
+    auto program = basic_vm::compile(module);
+    // Fall back to the tree walker if the program doesn't fit in the
+    // bytecode.
+    if (!program.has_value()) {
+        return nullptr;
+    }
+    err << static_errors << compile_err.str();
+    basic_vm::VirtualMachine vm{*program, out, err, input_action};
+    std::unique_ptr<basic_vm::AotModule> aot_module{};
+    if (exec_mode == ExecMode::AOT) {
+        std::stringstream aot_ss{};
+        aot_module = basic_vm::aot_compile(*program, aot_options, aot_ss);
+        aot_log = aot_ss.str();
+    }
+    if (aot_module) {
+        vm.run(*aot_module);
+    } else {
+        vm.set_tier_options(tier_options);
+        vm.set_loop_detect_options(loop_detect_options);
+        vm.set_watchdog({exec_budget, cancel_token});
+        vm.run();
+        tier_stats = vm.get_tier_stats();
+    }
+
+    const auto &profile = vm.get_profile();
+    hits.assign(module.stms.size(), 0);
+    taken.assign(module.stms.size(), 0);
+    for (std::size_t i = 0; i < module.stms.size(); ++i) {
+        auto pc = program->stm_pc[i];
+        if (pc != basic_vm::Program::NO_PC) {
+            hits[i] = profile.hits[pc];
+            taken[i] = profile.taken[pc];
+        }
+    }
+    if (cfg_dump != nullptr) {
+        basic_vm::write_dot(*cfg_dump, module, basic_vm::build_cfg(module),
+                            hits, taken);
+    }
+    return vm.get_var_env();
+}
+
 std::string Interpreter::show_ast() {
     if (has_exec) {
         return ast_res;
@@ -103,31 +164,53 @@ std::string Interpreter::show_ast() {
     }
 }
 
-void Interpreter::rewrite() {
-    if (already_rewritten) {
-        return;
+bool Interpreter::prepare() {
+    if (prepared && prepared->get_revision() == frag->get_revision()) {
+        return true;
+    }
+    // The tree walker still needs the tree of a hand-written parse.
+    auto mode =
+        parse_mode == ParseMode::HAND_WRITTEN ? ParseMode::TWO_STAGE
+                                              : parse_mode;
+    prepared = PreparedProgram::prepare(*frag, mode, &parse_stats);
+    if (prepared) {
+        return true;
+    }
+    for (auto line_num :
+         PreparedProgram::find_syntax_errors(*frag, mode, &parse_stats)) {
+        frag->remove(line_num);
+        frag->insert(line_num, ERROR_LINE);
+    }
+    prepared = PreparedProgram::prepare(*frag, mode, &parse_stats);
+    return prepared != nullptr;
+}
+
+void Interpreter::fail_to_parse() {
+    err << "syntax error: the program does not parse\n";
+    ast_res.clear();
+    has_exec = true;
+}
+
+bool Interpreter::prepare_source() {
+    if (source && source->get_revision() == frag->get_revision()) {
+        return true;
     }
-    bool already_done = false;
-    while (!already_done) {
-        GET_BASIC_PARSER();
-        try {
-            // Try to parser, get AST
-            tree::ParseTree *tree = parser.prog();
-            already_done = true;
-
-        } catch (const RecognitionException &e) {
-            auto maybe_line_num =
-                this->frag->get_line_number_at(my_lister.last_err_line);
-            assert(maybe_line_num.has_value());
-            // The line to be modified.
-            LSize line_num = maybe_line_num.value();
-            this->frag->remove(line_num);
-            this->frag->insert(line_num, ERROR_LINE);
-        } catch (const std::exception &e) {
-            assert(0);
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    std::vector<LSize> bad_lines{};
+    source = basic_syntax::SourceProgram::parse(*frag, &bad_lines);
+    parse_stats.hand_written_parses++;
+    if (!source) {
+        // Every bad line is found by the first parse.
+        for (auto line_num : bad_lines) {
+            frag->remove(line_num);
+            frag->insert(line_num, ERROR_LINE);
         }
+        source = basic_syntax::SourceProgram::parse(*frag);
+        parse_stats.hand_written_parses++;
     }
-    already_rewritten = true;
+    parse_stats.hand_written_time += clock::now() - start;
+    return source != nullptr;
 }
 
-} // namespace basic
\ No newline at end of file
+} // namespace basic
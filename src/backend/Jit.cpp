@@ -0,0 +1,843 @@
+#include "Jit.h"
+
+#if defined(QBASIC_JIT) && defined(__x86_64__) && defined(__unix__)
+#define BASIC_JIT_X86_64 1
+#else
+#define BASIC_JIT_X86_64 0
+#endif
+
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <set>
+
+#if BASIC_JIT_X86_64
+#include <sys/mman.h>
+#endif
+
+namespace basic_vm {
+
+JitRegion::JitRegion(void *memory, std::size_t size) noexcept
+    : memory(memory), size(size) {
+}
+
+JitRegion::~JitRegion() {
+#if BASIC_JIT_X86_64
+    munmap(memory, size);
+#endif
+}
+
+#if BASIC_JIT_X86_64
+
+namespace {
+
+/// x86-64 general purpose registers, by encoding.
+enum X86Reg : std::uint8_t {
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RBX = 3,
+    RSP = 4,
+    RBP = 5,
+    RSI = 6,
+    RDI = 7,
+    R8 = 8,
+    R9 = 9,
+    R10 = 10,
+    R11 = 11,
+    R12 = 12,
+    R13 = 13,
+    R14 = 14,
+    R15 = 15,
+};
+
+/// Condition codes, as in the low nibble of Jcc and CMOVcc.
+enum Cond : std::uint8_t {
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_L = 0xC,
+    CC_GE = 0xD,
+    CC_LE = 0xE,
+    CC_G = 0xF,
+};
+
+/// Where the VM registers live. Only statements that fit are compiled.
+constexpr X86Reg DATA_REGS[] = {RAX, RCX, RDX, RSI, RDI, R8, R9, R10};
+/// Temporaries of the instructions that need more than their operands.
+constexpr X86Reg SCRATCH = R11, SCRATCH2 = R13;
+/// Base pointers, loaded from the JitContext in the prologue.
+constexpr X86Reg CTX = R12, VARS = RBX, REF_TIMES = RBP, HITS = R14,
+                 TAKEN = R15;
+constexpr X86Reg SAVED_REGS[] = {RBX, RBP, R12, R13, R14, R15};
+
+/**
+ * @brief Encoder for the handful of instructions the compiler needs. All
+ * operands are 32-bit unless noted.
+ */
+class Assembler {
+
+public:
+    using Label = std::size_t;
+
+    std::vector<std::uint8_t> code{};
+
+    Label new_label() {
+        labels.push_back(UNBOUND);
+        return labels.size() - 1;
+    }
+
+    void bind(Label label) {
+        labels[label] = code.size();
+    }
+
+    bool is_bound(Label label) const {
+        return labels[label] != UNBOUND;
+    }
+
+    /// Patch the jumps, once every label is bound.
+    void finish() {
+        for (auto [pos, label] : fixups) {
+            assert(is_bound(label));
+            auto rel = static_cast<std::int32_t>(labels[label] - (pos + 4));
+            std::memcpy(&code[pos], &rel, 4);
+        }
+    }
+
+    void push(X86Reg reg) {
+        rex(false, 0, reg);
+        byte(0x50 + (reg & 7));
+    }
+
+    void pop(X86Reg reg) {
+        rex(false, 0, reg);
+        byte(0x58 + (reg & 7));
+    }
+
+    void ret() {
+        byte(0xC3);
+    }
+
+    void mov_imm(X86Reg dst, std::int32_t imm) {
+        rex(false, 0, dst);
+        byte(0xB8 + (dst & 7));
+        imm32(imm);
+    }
+
+    void mov(X86Reg dst, X86Reg src) {
+        reg_reg(0x89, src, dst);
+    }
+
+    void mov64(X86Reg dst, X86Reg src) {
+        rex(true, src, dst);
+        byte(0x89);
+        modrm(3, src, dst);
+    }
+
+    void add(X86Reg dst, X86Reg src) {
+        reg_reg(0x01, src, dst);
+    }
+
+    void sub(X86Reg dst, X86Reg src) {
+        reg_reg(0x29, src, dst);
+    }
+
+    void cmp(X86Reg lhs, X86Reg rhs) {
+        reg_reg(0x39, rhs, lhs);
+    }
+
+    void test(X86Reg lhs, X86Reg rhs) {
+        reg_reg(0x85, rhs, lhs);
+    }
+
+    void imul(X86Reg dst, X86Reg src) {
+        rex(false, dst, src);
+        byte(0x0F);
+        byte(0xAF);
+        modrm(3, dst, src);
+    }
+
+    /// dst = src * imm, 64-bit if wide.
+    void imul_imm(X86Reg dst, X86Reg src, std::int32_t imm, bool wide) {
+        rex(wide, dst, src);
+        byte(0x69);
+        modrm(3, dst, src);
+        imm32(imm);
+    }
+
+    void cmov(Cond cond, X86Reg dst, X86Reg src) {
+        rex(false, dst, src);
+        byte(0x0F);
+        byte(0x40 + cond);
+        modrm(3, dst, src);
+    }
+
+    void neg(X86Reg reg) {
+        rex(false, 0, reg);
+        byte(0xF7);
+        modrm(3, 3, reg);
+    }
+
+    void and_imm(X86Reg reg, std::int32_t imm) {
+        rex(false, 0, reg);
+        byte(0x81);
+        modrm(3, 4, reg);
+        imm32(imm);
+    }
+
+    void add_imm(X86Reg reg, std::int32_t imm) {
+        rex(false, 0, reg);
+        byte(0x81);
+        modrm(3, 0, reg);
+        imm32(imm);
+    }
+
+    /// Shift by imm: 4 is SHL, 5 is SHR, 7 is SAR. 64-bit if wide.
+    void shift(std::uint8_t kind, X86Reg reg, std::uint8_t imm,
+               bool wide = false) {
+        rex(wide, 0, reg);
+        byte(0xC1);
+        modrm(3, kind, reg);
+        byte(imm);
+    }
+
+    /// 64-bit dst = sign extension of 32-bit src.
+    void movsxd(X86Reg dst, X86Reg src) {
+        rex(true, dst, src);
+        byte(0x63);
+        modrm(3, dst, src);
+    }
+
+    void load(X86Reg dst, X86Reg base, std::int32_t disp) {
+        reg_mem(0x8B, dst, base, disp);
+    }
+
+    void load64(X86Reg dst, X86Reg base, std::int32_t disp) {
+        reg_mem(0x8B, dst, base, disp, true);
+    }
+
+    void store(X86Reg base, std::int32_t disp, X86Reg src) {
+        reg_mem(0x89, src, base, disp);
+    }
+
+    void cmp_mem(X86Reg lhs, X86Reg base, std::int32_t disp) {
+        reg_mem(0x3B, lhs, base, disp);
+    }
+
+    void inc_mem(X86Reg base, std::int32_t disp) {
+        reg_mem(0xFF, static_cast<X86Reg>(0), base, disp);
+    }
+
+    void inc_mem64(X86Reg base, std::int32_t disp) {
+        reg_mem(0xFF, static_cast<X86Reg>(0), base, disp, true);
+    }
+
+    void add_mem_imm(X86Reg base, std::int32_t disp, std::int32_t imm) {
+        reg_mem(0x81, static_cast<X86Reg>(0), base, disp);
+        imm32(imm);
+    }
+
+    void sub_mem_imm(X86Reg base, std::int32_t disp, std::int32_t imm) {
+        reg_mem(0x81, static_cast<X86Reg>(5), base, disp);
+        imm32(imm);
+    }
+
+    void cmp_mem_imm(X86Reg base, std::int32_t disp, std::int32_t imm) {
+        reg_mem(0x81, static_cast<X86Reg>(7), base, disp);
+        imm32(imm);
+    }
+
+    void jmp(Label label) {
+        byte(0xE9);
+        fixup(label);
+    }
+
+    void jcc(Cond cond, Label label) {
+        byte(0x0F);
+        byte(0x80 + cond);
+        fixup(label);
+    }
+
+private:
+    static constexpr std::size_t UNBOUND = static_cast<std::size_t>(-1);
+
+    std::vector<std::size_t> labels{};
+    /// Position of a rel32 and the label it refers to.
+    std::vector<std::pair<std::size_t, Label>> fixups{};
+
+    void byte(std::uint8_t value) {
+        code.push_back(value);
+    }
+
+    void imm32(std::int32_t value) {
+        std::uint8_t bytes[4];
+        std::memcpy(bytes, &value, 4);
+        code.insert(end(code), bytes, bytes + 4);
+    }
+
+    void fixup(Label label) {
+        fixups.emplace_back(code.size(), label);
+        imm32(0);
+    }
+
+    void rex(bool wide, std::uint8_t reg, std::uint8_t rm) {
+        std::uint8_t prefix = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) |
+                              ((rm & 8) ? 1 : 0);
+        if (prefix != 0x40) {
+            byte(prefix);
+        }
+    }
+
+    void modrm(std::uint8_t mod, std::uint8_t reg, std::uint8_t rm) {
+        byte(static_cast<std::uint8_t>((mod << 6) | ((reg & 7) << 3) |
+                                       (rm & 7)));
+    }
+
+    void reg_reg(std::uint8_t opcode, X86Reg reg, X86Reg rm) {
+        rex(false, reg, rm);
+        byte(opcode);
+        modrm(3, reg, rm);
+    }
+
+    /// [base + disp32], with reg as the register operand or the opcode
+    /// extension.
+    void reg_mem(std::uint8_t opcode, X86Reg reg, X86Reg base,
+                 std::int32_t disp, bool wide = false) {
+        rex(wide, reg, base);
+        byte(opcode);
+        modrm(2, reg, base);
+        if ((base & 7) == RSP) {
+            // RSP and R12 as a base need a SIB byte.
+            byte(0x24);
+        }
+        imm32(disp);
+    }
+};
+
+bool is_stm_end(OpCode op) {
+    switch (op) {
+    case OpCode::COUNT:
+    case OpCode::LET:
+    case OpCode::PRINT:
+    case OpCode::INPUT:
+    case OpCode::GOTO:
+    case OpCode::IF_EQ:
+    case OpCode::IF_LT:
+    case OpCode::IF_GT:
+    case OpCode::INC_VAR:
+    case OpCode::MOVE_VAR:
+    case OpCode::IF_VAR_EQ_CONST:
+    case OpCode::IF_VAR_LT_CONST:
+    case OpCode::IF_VAR_GT_CONST:
+    case OpCode::IF_VAR_EQ_VAR:
+    case OpCode::IF_VAR_LT_VAR:
+    case OpCode::IF_VAR_GT_VAR:
+    case OpCode::SOLVE_LOOP:
+    case OpCode::END:
+    case OpCode::BAD_LINE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+class RegionCompiler {
+
+public:
+    RegionCompiler(const Program &program, std::size_t begin,
+                   std::size_t end) noexcept
+        : program(program), begin(begin), end(end) {
+    }
+
+    std::unique_ptr<JitRegion> run() {
+        for (std::size_t pc = begin; pc < end; ++pc) {
+            pc_labels.push_back(as.new_label());
+        }
+        epilogue = as.new_label();
+
+        // Native code only ever uses the kept value of an invariant, and
+        // leaves computing it to the interpreter.
+        skipped.assign(end - begin, false);
+        for (std::size_t pc = begin; pc < end; ++pc) {
+            const auto &ins = program.code[pc];
+            if (ins.op == OpCode::LOAD_INVARIANT) {
+                auto resume = static_cast<std::size_t>(ins.imm);
+                for (auto i = pc + 1; i < resume; ++i) {
+                    skipped[i - begin] = true;
+                }
+            }
+        }
+
+        // Split the range into statements, and find the variables that must
+        // be defined for the compiled ones to run without errors.
+        std::vector<std::pair<std::size_t, bool>> stms{};
+        std::size_t stm_begin = begin;
+        bool compilable = true;
+        for (std::size_t pc = begin; pc < end; ++pc) {
+            if (skipped[pc - begin]) {
+                continue;
+            }
+            compilable = compilable && is_compilable(program.code[pc]);
+            if (is_stm_end(program.code[pc].op)) {
+                stms.emplace_back(stm_begin, compilable);
+                stm_begin = pc + 1;
+                compilable = true;
+            }
+        }
+        assert(stm_begin == end);
+        if (stms.empty() || !stms.front().second) {
+            return nullptr;
+        }
+        for (std::size_t i = 0; i < stms.size(); ++i) {
+            if (stms[i].second) {
+                auto stm_end = i + 1 < stms.size() ? stms[i + 1].first : end;
+                for (auto pc = stms[i].first; pc < stm_end; ++pc) {
+                    if (!skipped[pc - begin]) {
+                        collect_slots(program.code[pc]);
+                    }
+                }
+            }
+        }
+
+        emit_prologue();
+        for (std::size_t i = 0; i < stms.size(); ++i) {
+            auto stm_end = i + 1 < stms.size() ? stms[i + 1].first : end;
+            as.bind(label_of(stms[i].first));
+            if (!stms[i].second) {
+                exit_to(stms[i].first);
+                continue;
+            }
+            check_invariants(stms[i].first, stm_end);
+            for (auto pc = stms[i].first; pc < stm_end; ++pc) {
+                if (skipped[pc - begin]) {
+                    continue;
+                }
+                if (pc != stms[i].first) {
+                    as.bind(label_of(pc));
+                }
+                emit_ins(pc);
+            }
+        }
+        exit_to(end);
+
+        for (auto [pc, label] : exits) {
+            as.bind(label);
+            as.mov_imm(RAX, static_cast<std::int32_t>(pc));
+            as.jmp(epilogue);
+        }
+        as.bind(epilogue);
+        for (auto it = std::rbegin(SAVED_REGS); it != std::rend(SAVED_REGS);
+             ++it) {
+            as.pop(*it);
+        }
+        as.ret();
+        as.finish();
+
+        return install();
+    }
+
+private:
+    const Program &program;
+    std::size_t begin, end;
+    Assembler as{};
+    std::vector<Assembler::Label> pc_labels{};
+    Assembler::Label epilogue{};
+    /// Exits to the interpreter, by the pc to continue at.
+    std::map<std::size_t, Assembler::Label> exits{};
+    /// Variable slots used by the compiled statements.
+    std::set<std::uint32_t> slots{};
+    /// The instructions computing an invariant, by pc - begin.
+    std::vector<bool> skipped{};
+
+    Assembler::Label label_of(std::size_t pc) {
+        return pc_labels[pc - begin];
+    }
+
+    /// A jump to pc, inside the region or out of it.
+    Assembler::Label target_of(std::size_t pc) {
+        if (pc >= begin && pc < end) {
+            return label_of(pc);
+        }
+        return exit_label(pc);
+    }
+
+    Assembler::Label exit_label(std::size_t pc) {
+        auto [it, inserted] = exits.emplace(pc, 0);
+        if (inserted) {
+            it->second = as.new_label();
+        }
+        return it->second;
+    }
+
+    void exit_to(std::size_t pc) {
+        as.jmp(exit_label(pc));
+    }
+
+    static bool fits(Reg reg) {
+        return reg < std::size(DATA_REGS);
+    }
+
+    static X86Reg reg(Reg reg) {
+        return DATA_REGS[reg];
+    }
+
+    static std::int32_t disp(std::size_t index) {
+        return static_cast<std::int32_t>(index * 4);
+    }
+
+    bool is_compilable(const Instruction &ins) const {
+        switch (ins.op) {
+        case OpCode::LOAD_CONST:
+        case OpCode::LOAD_VAR:
+            return fits(ins.dst);
+        case OpCode::NEG:
+        case OpCode::SQUARE:
+        case OpCode::CUBE:
+        case OpCode::DIV_POW2:
+        case OpCode::DIV_MAGIC:
+        case OpCode::MOD_POW2:
+        case OpCode::MOD_MAGIC:
+            return fits(ins.dst) && ins.a == ins.dst;
+        case OpCode::ADD:
+        case OpCode::SUB:
+        case OpCode::MUL:
+            return fits(ins.dst) && fits(ins.b) && ins.a == ins.dst;
+        case OpCode::LET:
+            return fits(ins.a);
+        case OpCode::IF_EQ:
+        case OpCode::IF_LT:
+        case OpCode::IF_GT:
+            return fits(ins.a) && fits(ins.b);
+        case OpCode::LOAD_INVARIANT:
+            return fits(ins.dst);
+        case OpCode::COUNT:
+        case OpCode::TOUCH_VAR:
+        case OpCode::DROP_INVARIANT:
+        case OpCode::GOTO:
+        case OpCode::INC_VAR:
+        case OpCode::MOVE_VAR:
+        case OpCode::IF_VAR_EQ_CONST:
+        case OpCode::IF_VAR_LT_CONST:
+        case OpCode::IF_VAR_GT_CONST:
+        case OpCode::IF_VAR_EQ_VAR:
+        case OpCode::IF_VAR_LT_VAR:
+        case OpCode::IF_VAR_GT_VAR:
+            return true;
+        default:
+            // May fail or perform I/O.
+            return false;
+        }
+    }
+
+    void collect_slots(const Instruction &ins) {
+        switch (ins.op) {
+        case OpCode::LOAD_VAR:
+        case OpCode::LET:
+        case OpCode::INC_VAR:
+        case OpCode::TOUCH_VAR:
+            slots.insert(ins.index);
+            break;
+        case OpCode::MOVE_VAR:
+            slots.insert(ins.index);
+            slots.insert(ins.a);
+            break;
+        case OpCode::IF_VAR_EQ_CONST:
+        case OpCode::IF_VAR_LT_CONST:
+        case OpCode::IF_VAR_GT_CONST:
+            slots.insert(ins.a);
+            break;
+        case OpCode::IF_VAR_EQ_VAR:
+        case OpCode::IF_VAR_LT_VAR:
+        case OpCode::IF_VAR_GT_VAR:
+            slots.insert(ins.a);
+            slots.insert(ins.b);
+            break;
+        default:
+            break;
+        }
+    }
+
+    void emit_prologue() {
+        for (auto saved : SAVED_REGS) {
+            as.push(saved);
+        }
+        as.mov64(CTX, RDI);
+        as.load64(VARS, CTX, offsetof(JitContext, vars));
+        as.load64(REF_TIMES, CTX, offsetof(JitContext, ref_times));
+        as.load64(HITS, CTX, offsetof(JitContext, hits));
+        as.load64(TAKEN, CTX, offsetof(JitContext, taken));
+        for (auto slot : slots) {
+            // Variables are never undefined again, so checking them once is
+            // enough.
+            as.cmp_mem_imm(REF_TIMES, disp(slot), 0);
+            as.jcc(CC_L, exit_label(begin));
+        }
+    }
+
+    /**
+     * @brief Give the statement [stm_begin, stm_end) back to the interpreter
+     * unless the values of its invariants are kept. Checking them at the
+     * start of the statement leaves nothing half done.
+     */
+    void check_invariants(std::size_t stm_begin, std::size_t stm_end) {
+        for (auto pc = stm_begin; pc < stm_end; ++pc) {
+            const auto &ins = program.code[pc];
+            if (!skipped[pc - begin] && ins.op == OpCode::LOAD_INVARIANT) {
+                as.cmp_mem_imm(REF_TIMES, disp(ins.index), 0);
+                as.jcc(CC_L, exit_label(stm_begin));
+            }
+        }
+    }
+
+    /// Count an execution of the statement ending at pc.
+    void count(std::size_t pc) {
+        as.inc_mem(HITS, disp(pc));
+        as.inc_mem64(CTX, offsetof(JitContext, steps));
+    }
+
+    void read_var(X86Reg dst, std::uint32_t slot) {
+        as.load(dst, VARS, disp(slot));
+        as.inc_mem(REF_TIMES, disp(slot));
+    }
+
+    /// Count the statement, then jump to target if cond holds for the flags
+    /// set by set_flags.
+    template <typename F>
+    void branch(std::size_t pc, std::size_t target, Cond skip_cond,
+                F set_flags) {
+        count(pc);
+        set_flags();
+        auto skip = as.new_label();
+        as.jcc(skip_cond, skip);
+        as.inc_mem(TAKEN, disp(pc));
+        jump(pc, target);
+        as.bind(skip);
+    }
+
+    void jump(std::size_t pc, std::size_t target) {
+        if (target <= pc && target >= begin && target < end) {
+            // Give control back from time to time on loops.
+            as.sub_mem_imm(CTX, offsetof(JitContext, fuel), 1);
+            as.jcc(CC_L, exit_label(target));
+        }
+        as.jmp(target_of(target));
+    }
+
+    static Cond skip_cond(OpCode op) {
+        switch (op) {
+        case OpCode::IF_EQ:
+        case OpCode::IF_VAR_EQ_CONST:
+        case OpCode::IF_VAR_EQ_VAR:
+            return CC_NE;
+        case OpCode::IF_LT:
+        case OpCode::IF_VAR_LT_CONST:
+        case OpCode::IF_VAR_LT_VAR:
+            return CC_GE;
+        default:
+            return CC_LE;
+        }
+    }
+
+    void emit_ins(std::size_t pc) {
+        const auto &ins = program.code[pc];
+        switch (ins.op) {
+        case OpCode::LOAD_CONST:
+            as.mov_imm(reg(ins.dst), ins.imm);
+            break;
+        case OpCode::LOAD_VAR:
+            read_var(reg(ins.dst), ins.index);
+            break;
+        case OpCode::NEG:
+            as.neg(reg(ins.dst));
+            break;
+        case OpCode::ADD:
+            as.add(reg(ins.dst), reg(ins.b));
+            break;
+        case OpCode::SUB:
+            as.sub(reg(ins.dst), reg(ins.b));
+            break;
+        case OpCode::MUL:
+            as.imul(reg(ins.dst), reg(ins.b));
+            break;
+        case OpCode::SQUARE:
+            as.imul(reg(ins.dst), reg(ins.dst));
+            break;
+        case OpCode::CUBE:
+            as.mov(SCRATCH, reg(ins.dst));
+            as.imul(reg(ins.dst), reg(ins.dst));
+            as.imul(reg(ins.dst), SCRATCH);
+            break;
+        case OpCode::DIV_POW2:
+        case OpCode::MOD_POW2:
+            emit_pow2(ins);
+            break;
+        case OpCode::DIV_MAGIC:
+        case OpCode::MOD_MAGIC:
+            emit_magic(ins);
+            break;
+        case OpCode::LET:
+            as.store(VARS, disp(ins.index), reg(ins.a));
+            count(pc);
+            break;
+        case OpCode::COUNT:
+            count(pc);
+            break;
+        case OpCode::TOUCH_VAR:
+            as.inc_mem(REF_TIMES, disp(ins.index));
+            break;
+        case OpCode::LOAD_INVARIANT: {
+            const auto &reads =
+                program.invariant_reads[ins.index - program.symbols.size()];
+            for (auto slot : reads) {
+                as.inc_mem(REF_TIMES, disp(slot));
+            }
+            as.load(reg(ins.dst), VARS, disp(ins.index));
+            as.jmp(label_of(static_cast<std::size_t>(ins.imm)));
+            break;
+        }
+        case OpCode::DROP_INVARIANT:
+            as.mov_imm(SCRATCH, -1);
+            as.store(REF_TIMES, disp(ins.index), SCRATCH);
+            break;
+        case OpCode::GOTO:
+            count(pc);
+            jump(pc, ins.index);
+            break;
+        case OpCode::IF_EQ:
+        case OpCode::IF_LT:
+        case OpCode::IF_GT:
+            branch(pc, ins.index, skip_cond(ins.op),
+                   [&] { as.cmp(reg(ins.a), reg(ins.b)); });
+            break;
+        case OpCode::INC_VAR:
+            as.inc_mem(REF_TIMES, disp(ins.index));
+            as.add_mem_imm(VARS, disp(ins.index), ins.imm);
+            count(pc);
+            break;
+        case OpCode::MOVE_VAR:
+            read_var(SCRATCH, ins.a);
+            as.store(VARS, disp(ins.index), SCRATCH);
+            count(pc);
+            break;
+        case OpCode::IF_VAR_EQ_CONST:
+        case OpCode::IF_VAR_LT_CONST:
+        case OpCode::IF_VAR_GT_CONST:
+            as.inc_mem(REF_TIMES, disp(ins.a));
+            branch(pc, ins.index, skip_cond(ins.op), [&] {
+                as.cmp_mem_imm(VARS, disp(ins.a), ins.imm);
+            });
+            break;
+        case OpCode::IF_VAR_EQ_VAR:
+        case OpCode::IF_VAR_LT_VAR:
+        case OpCode::IF_VAR_GT_VAR:
+            read_var(SCRATCH, ins.a);
+            as.inc_mem(REF_TIMES, disp(ins.b));
+            branch(pc, ins.index, skip_cond(ins.op), [&] {
+                as.cmp_mem(SCRATCH, VARS, disp(ins.b));
+            });
+            break;
+        default:
+            assert(0);
+        }
+    }
+
+    /// See `Divisor::shift_divide` and `Divisor::mask_modulo`.
+    void emit_pow2(const Instruction &ins) {
+        const auto &divisor = program.divisors[ins.index];
+        auto n = reg(ins.dst);
+        if (ins.op == OpCode::DIV_POW2) {
+            as.mov(SCRATCH, n);
+            as.shift(7, SCRATCH, 31);
+            as.shift(5, SCRATCH, static_cast<std::uint8_t>(32 - divisor.shift));
+            as.add(n, SCRATCH);
+            as.shift(7, n, static_cast<std::uint8_t>(divisor.shift));
+            if (divisor.value < 0) {
+                as.neg(n);
+            }
+            return;
+        }
+        auto mask = (std::uint32_t{1} << divisor.shift) - 1;
+        as.and_imm(n, static_cast<std::int32_t>(mask));
+        if (divisor.value < 0) {
+            as.mov(SCRATCH, n);
+            as.add_imm(SCRATCH, divisor.value);
+            as.test(n, n);
+            as.cmov(CC_NE, n, SCRATCH);
+        }
+    }
+
+    /// See `Divisor::magic_divide` and `Divisor::magic_modulo`.
+    void emit_magic(const Instruction &ins) {
+        const auto &divisor = program.divisors[ins.index];
+        auto n = reg(ins.dst);
+        as.movsxd(SCRATCH, n);
+        as.imul_imm(SCRATCH, SCRATCH, divisor.multiplier, true);
+        as.shift(7, SCRATCH, 32, true);
+        if (divisor.value > 0 && divisor.multiplier < 0) {
+            as.add(SCRATCH, n);
+        } else if (divisor.value < 0 && divisor.multiplier > 0) {
+            as.sub(SCRATCH, n);
+        }
+        if (divisor.shift > 0) {
+            as.shift(7, SCRATCH, static_cast<std::uint8_t>(divisor.shift));
+        }
+        as.mov(SCRATCH2, SCRATCH);
+        as.shift(5, SCRATCH2, 31);
+        as.add(SCRATCH, SCRATCH2);
+        if (ins.op == OpCode::DIV_MAGIC) {
+            as.mov(n, SCRATCH);
+            return;
+        }
+        // rem = n - q * d, then move it to the sign of the divisor.
+        as.imul_imm(SCRATCH, SCRATCH, divisor.value, false);
+        as.mov(SCRATCH2, n);
+        as.sub(SCRATCH2, SCRATCH);
+        as.mov(SCRATCH, SCRATCH2);
+        as.add_imm(SCRATCH, divisor.value);
+        as.test(SCRATCH2, SCRATCH2);
+        as.cmov(divisor.value > 0 ? CC_L : CC_G, SCRATCH2, SCRATCH);
+        as.mov(n, SCRATCH2);
+    }
+
+    std::unique_ptr<JitRegion> install() {
+        auto size = as.code.size();
+        void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            return nullptr;
+        }
+        std::memcpy(memory, as.code.data(), size);
+        if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(memory, size);
+            return nullptr;
+        }
+        return std::make_unique<JitRegion>(memory, size);
+    }
+};
+
+} // namespace
+
+bool jit_available() noexcept {
+    return true;
+}
+
+std::unique_ptr<JitRegion> jit_compile(const Program &program,
+                                       std::size_t begin, std::size_t end) {
+    return RegionCompiler{program, begin, end}.run();
+}
+
+#else
+
+bool jit_available() noexcept {
+    return false;
+}
+
+std::unique_ptr<JitRegion> jit_compile(const Program & /* program */,
+                                       std::size_t /* begin */,
+                                       std::size_t /* end */) {
+    return nullptr;
+}
+
+#endif
+
+} // namespace basic_vm
@@ -0,0 +1,867 @@
+#include "Optimizer.h"
+#include "Cfg.h"
+
+#include <cassert>
+#include <map>
+#include <optional>
+#include <sstream>
+
+namespace basic_vm {
+
+namespace {
+
+/**
+ * @brief Fold the expressions of a module bottom-up.
+ *
+ * A subexpression is only ever removed if it is a constant: a variable read
+ * counts as a reference of the variable and may fail, so it must stay.
+ */
+class ConstantFolder {
+
+public:
+    ConstantFolder(Module &module, std::ostream &err) noexcept
+        : module(module), err(err) {
+    }
+
+    void run() {
+        for (auto &stm : module.stms) {
+            switch (stm.kind) {
+            case StmKind::LET:
+            case StmKind::PRINT:
+                stm.expr = fold(stm.expr);
+                break;
+            case StmKind::IF:
+                stm.expr = fold(stm.expr);
+                stm.rhs = fold(stm.rhs);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+private:
+    Module &module;
+    std::ostream &err;
+
+    // Nodes are copied out of the arena, since adding a node may move it.
+    Expr node(ExprId id) const {
+        return module.exprs[id];
+    }
+
+    bool is_const(ExprId id) const {
+        return module.exprs[id].kind == ExprKind::CONST;
+    }
+
+    ExprId make_const(VarType value) {
+        Expr expr{ExprKind::CONST};
+        expr.operand = value;
+        return module.add_expr(expr);
+    }
+
+    ExprId make_neg(ExprId operand) {
+        auto inner = node(operand);
+        if (inner.kind == ExprKind::NEG) {
+            return inner.lhs;
+        }
+        if (inner.kind == ExprKind::CONST) {
+            return make_const(wrapping_neg(inner.operand));
+        }
+        if (inner.kind == ExprKind::ERROR) {
+            return operand;
+        }
+        Expr expr{ExprKind::NEG};
+        expr.lhs = operand;
+        return module.add_expr(expr);
+    }
+
+    ExprId make_error() {
+        return module.add_expr(Expr{ExprKind::ERROR});
+    }
+
+    ExprId report(const Expr &expr, const std::string &msg) {
+        log_error(err, expr.loc.line, expr.loc.column, msg);
+        return make_error();
+    }
+
+    ExprId fold(ExprId id) {
+        auto expr = node(id);
+        switch (expr.kind) {
+        case ExprKind::CONST:
+        case ExprKind::VAR:
+        case ExprKind::ERROR:
+            return id;
+        case ExprKind::NEG:
+            return make_neg(fold(expr.lhs));
+        case ExprKind::SQUARE:
+        case ExprKind::CUBE:
+        case ExprKind::DIV_CONST:
+        case ExprKind::MOD_CONST:
+        case ExprKind::INVARIANT:
+            expr.lhs = fold(expr.lhs);
+            module.exprs[id] = expr;
+            return id;
+        default:
+            break;
+        }
+
+        expr.lhs = fold(expr.lhs);
+        expr.rhs = fold(expr.rhs);
+        auto lhs = node(expr.lhs);
+        auto rhs = node(expr.rhs);
+        auto is_pure = [](const Expr &e) {
+            return e.kind == ExprKind::CONST || e.kind == ExprKind::ERROR;
+        };
+
+        if (is_pure(lhs) && is_pure(rhs)) {
+            if (lhs.kind == ExprKind::ERROR || rhs.kind == ExprKind::ERROR) {
+                // The node fails without an error of its own.
+                return make_error();
+            }
+            return fold_const(expr, lhs.operand, rhs.operand);
+        }
+
+        // Constants go to the right of commutative operators.
+        if ((expr.kind == ExprKind::ADD || expr.kind == ExprKind::MUL) &&
+            lhs.kind == ExprKind::CONST) {
+            std::swap(expr.lhs, expr.rhs);
+            std::swap(lhs, rhs);
+        }
+
+        if (rhs.kind == ExprKind::CONST) {
+            if (auto simplified = simplify(expr, lhs, rhs.operand)) {
+                return simplified.value();
+            }
+        }
+        if (lhs.kind == ExprKind::CONST && lhs.operand == 0 &&
+            expr.kind == ExprKind::SUB) {
+            return make_neg(expr.rhs);
+        }
+
+        module.exprs[id] = expr;
+        return id;
+    }
+
+    ExprId fold_const(const Expr &expr, VarType lhs, VarType rhs) {
+        std::stringstream err_ss{};
+        switch (expr.kind) {
+        case ExprKind::ADD:
+            return make_const(wrapping_add(lhs, rhs));
+        case ExprKind::SUB:
+            return make_const(wrapping_sub(lhs, rhs));
+        case ExprKind::MUL:
+            return make_const(wrapping_mul(lhs, rhs));
+        case ExprKind::DIV:
+            if (rhs == 0) {
+                err_ss << "Division by zero: " << lhs << " / " << rhs;
+                return report(expr, err_ss.str());
+            }
+            return make_const(wrapping_div(lhs, rhs));
+        case ExprKind::MOD:
+            if (rhs == 0) {
+                err_ss << "Modulus by zero: " << lhs << " MOD " << rhs;
+                return report(expr, err_ss.str());
+            }
+            return make_const(modulo_of(lhs, rhs));
+        case ExprKind::POW:
+            if (rhs < 0) {
+                err_ss << "Unsupported negative exponent: " << rhs;
+                return report(expr, err_ss.str());
+            }
+            return make_const(power_of(lhs, rhs));
+        default:
+            assert(0);
+            return make_error();
+        }
+    }
+
+    /**
+     * @brief Simplify `lhs op c`, where lhs is not a constant.
+     */
+    std::optional<ExprId> simplify(const Expr &expr, const Expr &lhs,
+                                   VarType c) {
+        switch (expr.kind) {
+        case ExprKind::ADD:
+        case ExprKind::SUB: {
+            if (c == 0) {
+                return expr.lhs;
+            }
+            // (e +- c1) +- c2 => e + (+-c1 +- c2)
+            if ((lhs.kind == ExprKind::ADD || lhs.kind == ExprKind::SUB) &&
+                is_const(lhs.rhs)) {
+                auto c1 = node(lhs.rhs).operand;
+                auto sum = lhs.kind == ExprKind::ADD ? c1 : wrapping_neg(c1);
+                sum = expr.kind == ExprKind::ADD ? wrapping_add(sum, c)
+                                                 : wrapping_sub(sum, c);
+                if (sum == 0) {
+                    return lhs.lhs;
+                }
+                Expr sum_expr{ExprKind::ADD};
+                sum_expr.lhs = lhs.lhs;
+                sum_expr.rhs = make_const(sum);
+                return module.add_expr(sum_expr);
+            }
+            return std::nullopt;
+        }
+        case ExprKind::MUL:
+            if (c == 1) {
+                return expr.lhs;
+            }
+            // (e * c1) * c2 => e * (c1 * c2)
+            if (lhs.kind == ExprKind::MUL && is_const(lhs.rhs)) {
+                auto product = wrapping_mul(node(lhs.rhs).operand, c);
+                if (product == 1) {
+                    return lhs.lhs;
+                }
+                Expr product_expr{ExprKind::MUL};
+                product_expr.lhs = lhs.lhs;
+                product_expr.rhs = make_const(product);
+                return module.add_expr(product_expr);
+            }
+            return std::nullopt;
+        case ExprKind::DIV:
+        case ExprKind::POW:
+            if (c == 1) {
+                return expr.lhs;
+            }
+            return std::nullopt;
+        default:
+            return std::nullopt;
+        }
+    }
+};
+
+bool is_unary(ExprKind kind) noexcept {
+    switch (kind) {
+    case ExprKind::NEG:
+    case ExprKind::SQUARE:
+    case ExprKind::CUBE:
+    case ExprKind::DIV_CONST:
+    case ExprKind::MOD_CONST:
+    case ExprKind::INVARIANT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool is_leaf(ExprKind kind) noexcept {
+    return kind == ExprKind::CONST || kind == ExprKind::VAR ||
+           kind == ExprKind::ERROR;
+}
+
+/**
+ * @brief Call f with each variable the expression reads, in the order of
+ * evaluation.
+ */
+template <typename F>
+void for_each_read(const Module &module, ExprId id, F &&f) {
+    const auto &expr = module.exprs[id];
+    if (expr.kind == ExprKind::VAR) {
+        f(static_cast<SymbolId>(expr.operand));
+    } else if (is_unary(expr.kind)) {
+        for_each_read(module, expr.lhs, f);
+    } else if (!is_leaf(expr.kind)) {
+        for_each_read(module, expr.lhs, f);
+        for_each_read(module, expr.rhs, f);
+    }
+}
+
+/// The expressions a statement evaluates, in order.
+std::vector<ExprId> operands_of(const Stm &stm) {
+    switch (stm.kind) {
+    case StmKind::LET:
+    case StmKind::PRINT:
+        return {stm.expr};
+    case StmKind::IF:
+        return {stm.expr, stm.rhs};
+    default:
+        return {};
+    }
+}
+
+using VarSet = std::vector<bool>;
+
+/**
+ * @return Whether evaluating the expression may fail, given the variables
+ * that are surely defined.
+ */
+bool can_fail(const Module &module, ExprId id, const VarSet &defined) {
+    const auto &expr = module.exprs[id];
+    switch (expr.kind) {
+    case ExprKind::CONST:
+        return false;
+    case ExprKind::VAR:
+        return !defined[static_cast<SymbolId>(expr.operand)];
+    case ExprKind::ERROR:
+        return true;
+    case ExprKind::DIV:
+    case ExprKind::MOD:
+    case ExprKind::POW: {
+        const auto &rhs = module.exprs[expr.rhs];
+        if (rhs.kind != ExprKind::CONST ||
+            (expr.kind == ExprKind::POW ? rhs.operand < 0
+                                        : rhs.operand == 0)) {
+            return true;
+        }
+        return can_fail(module, expr.lhs, defined);
+    }
+    default:
+        break;
+    }
+    if (is_unary(expr.kind)) {
+        return can_fail(module, expr.lhs, defined);
+    }
+    return can_fail(module, expr.lhs, defined) ||
+           can_fail(module, expr.rhs, defined);
+}
+
+/**
+ * @brief Finds the variables defined on every path to each statement, then
+ * those whose value may still be read after each statement, and discards the
+ * stores to the others.
+ */
+class DeadStoreEliminator {
+
+public:
+    explicit DeadStoreEliminator(Module &module)
+        : module(module), cfg(build_cfg(module)),
+          num_vars(module.symbols.size()) {
+    }
+
+    void run() {
+        find_kills();
+        find_live_out();
+        for (std::size_t block = 0; block < cfg.blocks.size(); ++block) {
+            if (!cfg.is_reachable(block)) {
+                continue;
+            }
+            auto live = live_out[block];
+            const auto &bb = cfg.blocks[block];
+            for (auto i = bb.end; i-- > bb.begin;) {
+                auto &stm = module.stms[i];
+                if (stm.kind == StmKind::LET && !stm.discard &&
+                    !live[stm.var]) {
+                    stm.discard = true;
+                }
+                transfer_live(i, live);
+            }
+        }
+    }
+
+private:
+    Module &module;
+    Cfg cfg;
+    std::size_t num_vars;
+    /// Whether each statement surely assigns its variable.
+    std::vector<bool> kills{};
+    std::vector<VarSet> live_out{};
+
+    bool defines(const Stm &stm, const VarSet &defined) const {
+        return stm.kind == StmKind::LET && !stm.discard &&
+               !can_fail(module, stm.expr, defined);
+    }
+
+    void find_kills() {
+        auto num_blocks = cfg.blocks.size();
+        // Optimistic start for the blocks not visited yet, since this is an
+        // intersection over the predecessors.
+        std::vector<VarSet> defined_out(num_blocks, VarSet(num_vars, true));
+        auto defined_in = [&](std::size_t block) {
+            VarSet defined(num_vars, block != 0);
+            for (auto pred : cfg.blocks[block].preds) {
+                if (block != 0 && cfg.is_reachable(pred)) {
+                    for (std::size_t v = 0; v < num_vars; ++v) {
+                        defined[v] = defined[v] && defined_out[pred][v];
+                    }
+                }
+            }
+            return defined;
+        };
+
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (std::size_t block = 0; block < num_blocks; ++block) {
+                if (!cfg.is_reachable(block)) {
+                    continue;
+                }
+                auto defined = defined_in(block);
+                const auto &bb = cfg.blocks[block];
+                for (auto i = bb.begin; i < bb.end; ++i) {
+                    if (defines(module.stms[i], defined)) {
+                        defined[module.stms[i].var] = true;
+                    }
+                }
+                if (defined != defined_out[block]) {
+                    defined_out[block] = std::move(defined);
+                    changed = true;
+                }
+            }
+        }
+
+        kills.assign(module.stms.size(), false);
+        for (std::size_t block = 0; block < num_blocks; ++block) {
+            if (!cfg.is_reachable(block)) {
+                continue;
+            }
+            auto defined = defined_in(block);
+            const auto &bb = cfg.blocks[block];
+            for (auto i = bb.begin; i < bb.end; ++i) {
+                if (defines(module.stms[i], defined)) {
+                    kills[i] = true;
+                    defined[module.stms[i].var] = true;
+                }
+            }
+        }
+    }
+
+    void transfer_live(std::size_t i, VarSet &live) const {
+        const auto &stm = module.stms[i];
+        if (kills[i]) {
+            live[stm.var] = false;
+        }
+        for (auto id : operands_of(stm)) {
+            for_each_read(module, id, [&](SymbolId var) {
+                live[var] = true;
+            });
+        }
+    }
+
+    void find_live_out() {
+        auto num_blocks = cfg.blocks.size();
+        live_out.assign(num_blocks, VarSet(num_vars, false));
+        std::vector<VarSet> live_in(num_blocks, VarSet(num_vars, false));
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (auto block = num_blocks; block-- > 0;) {
+                auto &out = live_out[block];
+                for (auto succ : cfg.blocks[block].succs) {
+                    // The variables outlive the program.
+                    const auto &in =
+                        succ == Cfg::EXIT ? VarSet(num_vars, true)
+                                          : live_in[succ];
+                    for (std::size_t v = 0; v < num_vars; ++v) {
+                        out[v] = out[v] || in[v];
+                    }
+                }
+                auto live = out;
+                const auto &bb = cfg.blocks[block];
+                for (auto i = bb.end; i-- > bb.begin;) {
+                    transfer_live(i, live);
+                }
+                if (live != live_in[block]) {
+                    live_in[block] = std::move(live);
+                    changed = true;
+                }
+            }
+        }
+    }
+};
+
+class InvariantHoister {
+
+public:
+    explicit InvariantHoister(Module &module) noexcept : module(module) {
+    }
+
+    void run() {
+        auto cfg = build_cfg(module);
+        // The variables assigned in each loop.
+        std::vector<VarSet> assigned(
+            cfg.loops.size(), VarSet(module.symbols.size(), false));
+        for (std::size_t l = 0; l < cfg.loops.size(); ++l) {
+            for (auto block : cfg.loops[l].blocks) {
+                const auto &bb = cfg.blocks[block];
+                for (auto i = bb.begin; i < bb.end; ++i) {
+                    const auto &stm = module.stms[i];
+                    if ((stm.kind == StmKind::LET && !stm.discard) ||
+                        stm.kind == StmKind::INPUT) {
+                        assigned[l][stm.var] = true;
+                    }
+                }
+            }
+        }
+
+        for (std::size_t i = 0; i < module.stms.size(); ++i) {
+            auto loop = cfg.block_loop[cfg.stm_block[i]];
+            auto &stm = module.stms[i];
+            // A discarded value only needs its reads.
+            if (loop == Cfg::NO_LOOP || stm.discard) {
+                continue;
+            }
+            switch (stm.kind) {
+            case StmKind::LET:
+            case StmKind::PRINT:
+                stm.expr = hoist(stm.expr, assigned[loop]);
+                break;
+            case StmKind::IF:
+                stm.expr = hoist(stm.expr, assigned[loop]);
+                stm.rhs = hoist(stm.rhs, assigned[loop]);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+private:
+    Module &module;
+
+    struct Shape {
+        bool invariant = true;
+        int operations = 0;
+        bool may_fail = false;
+    };
+
+    Shape shape_of(ExprId id, const VarSet &assigned) const {
+        const auto &expr = module.exprs[id];
+        switch (expr.kind) {
+        case ExprKind::CONST:
+            return {};
+        case ExprKind::VAR:
+            return {!assigned[static_cast<SymbolId>(expr.operand)]};
+        case ExprKind::ERROR:
+        case ExprKind::INVARIANT:
+            return {false};
+        default:
+            break;
+        }
+        auto shape = shape_of(expr.lhs, assigned);
+        if (!is_unary(expr.kind)) {
+            auto rhs = shape_of(expr.rhs, assigned);
+            shape.invariant = shape.invariant && rhs.invariant;
+            shape.operations += rhs.operations;
+            shape.may_fail = shape.may_fail || rhs.may_fail;
+        }
+        shape.operations++;
+        shape.may_fail = shape.may_fail || expr.kind == ExprKind::DIV ||
+                         expr.kind == ExprKind::MOD ||
+                         expr.kind == ExprKind::POW;
+        return shape;
+    }
+
+    ExprId hoist(ExprId id, const VarSet &assigned) {
+        auto expr = module.exprs[id];
+        if (is_leaf(expr.kind) || expr.kind == ExprKind::INVARIANT) {
+            return id;
+        }
+        auto shape = shape_of(id, assigned);
+        if (shape.invariant && (shape.may_fail || shape.operations >= 2)) {
+            Expr invariant{ExprKind::INVARIANT};
+            invariant.lhs = id;
+            return module.add_expr(invariant);
+        }
+        expr.lhs = hoist(expr.lhs, assigned);
+        if (!is_unary(expr.kind)) {
+            expr.rhs = hoist(expr.rhs, assigned);
+        }
+        module.exprs[id] = expr;
+        return id;
+    }
+};
+
+/**
+ * @brief Finds the counted loops whose effect is an affine function of the
+ * number of iterations.
+ */
+class LoopSolver {
+
+public:
+    explicit LoopSolver(Module &module) noexcept : module(module) {
+    }
+
+    void run() {
+        auto cfg = build_cfg(module);
+        for (const auto &loop : cfg.loops) {
+            if (loop.blocks.size() != 1) {
+                continue;
+            }
+            const auto &bb = cfg.blocks[loop.header];
+            if (auto counted = solve(bb.begin, bb.end)) {
+                module.counted_loops.push_back(std::move(*counted));
+            }
+        }
+    }
+
+private:
+    Module &module;
+
+    /// `constant + sum of coefficient * variable`.
+    struct Linear {
+        VarType constant{};
+        std::map<SymbolId, VarType> coeffs{};
+
+        void scale_by(VarType factor) {
+            constant = wrapping_mul(constant, factor);
+            for (auto &[var, coeff] : coeffs) {
+                coeff = wrapping_mul(coeff, factor);
+            }
+        }
+
+        void add(const Linear &other) {
+            constant = wrapping_add(constant, other.constant);
+            for (const auto &[var, coeff] : other.coeffs) {
+                coeffs[var] = wrapping_add(coeffs[var], coeff);
+            }
+        }
+    };
+
+    /// Only operations that can't fail have a linear form.
+    std::optional<Linear> linearize(ExprId id) const {
+        const auto &expr = module.exprs[id];
+        switch (expr.kind) {
+        case ExprKind::CONST:
+            return Linear{expr.operand};
+        case ExprKind::VAR:
+            return Linear{0, {{static_cast<SymbolId>(expr.operand), 1}}};
+        case ExprKind::INVARIANT:
+            return linearize(expr.lhs);
+        case ExprKind::NEG: {
+            auto lhs = linearize(expr.lhs);
+            if (lhs) {
+                lhs->scale_by(-1);
+            }
+            return lhs;
+        }
+        case ExprKind::ADD:
+        case ExprKind::SUB:
+        case ExprKind::MUL: {
+            auto lhs = linearize(expr.lhs);
+            auto rhs = linearize(expr.rhs);
+            if (!lhs || !rhs) {
+                return std::nullopt;
+            }
+            if (expr.kind == ExprKind::MUL) {
+                if (!lhs->coeffs.empty()) {
+                    std::swap(lhs, rhs);
+                }
+                if (!lhs->coeffs.empty()) {
+                    return std::nullopt;
+                }
+                rhs->scale_by(lhs->constant);
+                return rhs;
+            }
+            if (expr.kind == ExprKind::SUB) {
+                rhs->scale_by(-1);
+            }
+            lhs->add(*rhs);
+            return lhs;
+        }
+        default:
+            return std::nullopt;
+        }
+    }
+
+    /// The variable, if the expression is a variable and nothing else.
+    static std::optional<SymbolId> just_var(const Linear &linear) {
+        if (linear.constant != 0 || linear.coeffs.size() != 1 ||
+            linear.coeffs.begin()->second != 1) {
+            return std::nullopt;
+        }
+        return linear.coeffs.begin()->first;
+    }
+
+    static AffineExpr to_affine(const Linear &linear, SymbolId counter,
+                                SymbolId self) {
+        AffineExpr affine{};
+        affine.offset = linear.constant;
+        for (const auto &[var, coeff] : linear.coeffs) {
+            if (var == counter) {
+                affine.scale = coeff;
+            } else if (var != self && coeff != 0) {
+                affine.terms.emplace_back(var, coeff);
+            }
+        }
+        return affine;
+    }
+
+    std::optional<CountedLoop> solve(std::size_t begin, std::size_t end) {
+        const auto &stms = module.stms;
+        const auto &last = stms[end - 1];
+        if (last.kind != StmKind::IF || last.target != stms[begin].line) {
+            return std::nullopt;
+        }
+        VarSet assigned(module.symbols.size(), false);
+        for (auto i = begin; i + 1 < end; ++i) {
+            const auto &stm = stms[i];
+            if (stm.kind == StmKind::REM) {
+                continue;
+            }
+            if (stm.kind != StmKind::LET) {
+                return std::nullopt;
+            }
+            if (!stm.discard) {
+                // Each variable is assigned once.
+                if (assigned[stm.var]) {
+                    return std::nullopt;
+                }
+                assigned[stm.var] = true;
+            }
+        }
+
+        CountedLoop loop{begin, end};
+        auto lhs = linearize(last.expr);
+        auto rhs = linearize(last.rhs);
+        if (!lhs || !rhs) {
+            return std::nullopt;
+        }
+        loop.cmp = last.cmp;
+        if (auto var = just_var(*lhs); var && assigned[*var]) {
+            loop.counter = *var;
+        } else if (auto var = just_var(*rhs); var && assigned[*var]) {
+            loop.counter = *var;
+            std::swap(lhs, rhs);
+            loop.cmp = loop.cmp == CmpOp::LT   ? CmpOp::GT
+                       : loop.cmp == CmpOp::GT ? CmpOp::LT
+                                               : CmpOp::EQ;
+        } else {
+            return std::nullopt;
+        }
+
+        // The variables assigned in the loop may only be read by their own
+        // statement, except for the counter.
+        std::map<SymbolId, int> reads{};
+        auto count_reads = [&](ExprId id, SymbolId self) {
+            bool ok = true;
+            for_each_read(module, id, [&](SymbolId var) {
+                ++reads[var];
+                ok = ok && (!assigned[var] || var == loop.counter ||
+                            var == self);
+            });
+            return ok;
+        };
+        const auto NO_VAR = static_cast<SymbolId>(-1);
+        if (!count_reads(last.expr, NO_VAR) ||
+            !count_reads(last.rhs, NO_VAR)) {
+            return std::nullopt;
+        }
+        loop.limit = to_affine(*rhs, loop.counter, NO_VAR);
+        if (loop.limit.scale != 0) {
+            return std::nullopt;
+        }
+
+        bool has_counter = false;
+        for (auto i = begin; i + 1 < end; ++i) {
+            const auto &stm = stms[i];
+            if (stm.kind != StmKind::LET) {
+                continue;
+            }
+            auto self = stm.discard ? NO_VAR : stm.var;
+            auto linear = linearize(stm.expr);
+            if (!linear || !count_reads(stm.expr, self)) {
+                return std::nullopt;
+            }
+            auto self_coeff = stm.discard || linear->coeffs.count(stm.var) == 0
+                                  ? 0
+                                  : linear->coeffs.at(stm.var);
+            if (stm.var == loop.counter && !stm.discard) {
+                linear->coeffs.erase(stm.var);
+                if (self_coeff != 1 || !linear->coeffs.empty() ||
+                    linear->constant == 0) {
+                    return std::nullopt;
+                }
+                loop.counter_stm = i;
+                loop.step = linear->constant;
+                has_counter = true;
+                continue;
+            }
+
+            CountedLoop::Update update{i, CountedLoop::UpdateKind::NONE,
+                                       stm.var,
+                                       to_affine(*linear, loop.counter, self)};
+            if (!stm.discard) {
+                bool reads_self = linear->coeffs.count(stm.var) != 0;
+                if (reads_self && self_coeff != 1) {
+                    return std::nullopt;
+                }
+                update.kind = reads_self ? CountedLoop::UpdateKind::ACCUMULATE
+                                         : CountedLoop::UpdateKind::ASSIGN;
+            }
+            loop.updates.push_back(std::move(update));
+        }
+        if (!has_counter) {
+            return std::nullopt;
+        }
+        loop.reads.assign(reads.begin(), reads.end());
+        return loop;
+    }
+};
+
+} // namespace
+
+void reduce_strength(Module &module) {
+    // Rewriting in place is safe even for nodes that are no longer reachable.
+    for (auto &expr : module.exprs) {
+        bool binary = expr.kind == ExprKind::POW ||
+                      expr.kind == ExprKind::DIV || expr.kind == ExprKind::MOD;
+        if (!binary || module.exprs[expr.rhs].kind != ExprKind::CONST) {
+            continue;
+        }
+        auto c = module.exprs[expr.rhs].operand;
+        switch (expr.kind) {
+        case ExprKind::POW:
+            if (c == 2) {
+                expr.kind = ExprKind::SQUARE;
+            } else if (c == 3) {
+                expr.kind = ExprKind::CUBE;
+            }
+            break;
+        case ExprKind::DIV:
+            if (c == -1) {
+                // Dividing by -1 wraps around just like negating.
+                expr.kind = ExprKind::NEG;
+            } else if (c < -1 || c > 1) {
+                expr.kind = ExprKind::DIV_CONST;
+                expr.operand = c;
+            }
+            break;
+        case ExprKind::MOD:
+            if (c < -1 || c > 1) {
+                expr.kind = ExprKind::MOD_CONST;
+                expr.operand = c;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void fold_constants(Module &module, std::ostream &err) {
+    ConstantFolder{module, err}.run();
+}
+
+void eliminate_dead_stores(Module &module) {
+    DeadStoreEliminator{module}.run();
+}
+
+void hoist_invariants(Module &module) {
+    InvariantHoister{module}.run();
+}
+
+void solve_counted_loops(Module &module) {
+    LoopSolver{module}.run();
+}
+
+void optimize(Module &module, const OptimizeOptions &options,
+              std::ostream &err) {
+    if (options.fold_constants) {
+        fold_constants(module, err);
+    }
+    if (options.reduce_strength) {
+        reduce_strength(module);
+    }
+    if (options.eliminate_dead_stores) {
+        eliminate_dead_stores(module);
+    }
+    if (options.hoist_invariants) {
+        hoist_invariants(module);
+    }
+    if (options.solve_counted_loops) {
+        solve_counted_loops(module);
+    }
+}
+
+} // namespace basic_vm
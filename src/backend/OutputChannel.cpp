@@ -0,0 +1,27 @@
+#include "OutputChannel.h"
+
+namespace basic {
+
+std::string OutputChannel::take() {
+    std::string taken{};
+    std::lock_guard lock{mutex};
+    taken.swap(pending);
+    return taken;
+}
+
+auto OutputChannel::overflow(int_type ch) -> int_type {
+    if (traits_type::eq_int_type(ch, traits_type::eof())) {
+        return traits_type::not_eof(ch);
+    }
+    std::lock_guard lock{mutex};
+    pending.push_back(traits_type::to_char_type(ch));
+    return ch;
+}
+
+std::streamsize OutputChannel::xsputn(const char *s, std::streamsize count) {
+    std::lock_guard lock{mutex};
+    pending.append(s, static_cast<std::size_t>(count));
+    return count;
+}
+
+} // namespace basic
@@ -0,0 +1,47 @@
+#include "ParserCache.h"
+
+namespace basic {
+
+CachedParser::CachedParser() : lexer(&input), tokens(&lexer), parser(&tokens) {
+    parser.removeErrorListeners();
+}
+
+void CachedParser::reset(const std::string &text) {
+    // The trees point into the tokens, so they go first.
+    parser.reset();
+    input.load(text, false);
+    lexer.reset();
+    tokens.setTokenSource(&lexer);
+    parser.setTokenStream(&tokens);
+}
+
+ParserCache &ParserCache::local() {
+    thread_local ParserCache cache{};
+    return cache;
+}
+
+std::unique_ptr<CachedParser> ParserCache::acquire(const std::string &text,
+                                                   ParseStats *stats) {
+    std::unique_ptr<CachedParser> parser{};
+    if (idle.empty()) {
+        parser = std::make_unique<CachedParser>();
+    } else {
+        parser = std::move(idle.back());
+        idle.pop_back();
+        if (stats != nullptr) {
+            ++stats->reused_parsers;
+        }
+    }
+    parser->reset(text);
+    return parser;
+}
+
+void ParserCache::release(std::unique_ptr<CachedParser> parser) {
+    if (idle.size() >= MAX_IDLE) {
+        return;
+    }
+    parser->reset({});
+    idle.push_back(std::move(parser));
+}
+
+} // namespace basic
@@ -0,0 +1,179 @@
+#include "PreparedProgram.h"
+#include "Visitor.h"
+
+#include <chrono>
+#include <sstream>
+
+using namespace antlr_basic;
+using namespace antlr4;
+
+namespace {
+
+class ThrowExceptionStrategy : public DefaultErrorStrategy {
+
+public:
+    // `sync` is kept: where an operand is expected, a single token that
+    // can't start one is deleted if the next token can. The deleted token
+    // stays in the tree as an error node, and the visitors skip it by reading
+    // the tree through the typed accessors.
+    void recover(Parser *recognizer, std::exception_ptr e) override {
+        throw NoViableAltException{recognizer};
+    }
+
+    Token *recoverInline(Parser *recognizer) override {
+        throw NoViableAltException{recognizer};
+    }
+};
+
+/**
+ * @brief Parse a rule, a program or a statement, from the current token.
+ *
+ * @return nullptr on a syntax error.
+ */
+template <typename Context>
+Context *parse(BasicParser &parser, Context *(BasicParser::*rule)(),
+               basic::ParseMode mode, basic::ParseStats &stats) {
+    using clock = std::chrono::steady_clock;
+    auto *simulator = parser.getInterpreter<atn::ParserATNSimulator>();
+    if (mode == basic::ParseMode::TWO_STAGE) {
+        auto *tokens = parser.getTokenStream();
+        auto start_index = tokens->index();
+        auto start = clock::now();
+        simulator->setPredictionMode(atn::PredictionMode::SLL);
+        parser.setErrorHandler(std::make_shared<BailErrorStrategy>());
+        ++stats.sll_parses;
+        try {
+            auto *tree = (parser.*rule)();
+            stats.sll_time += clock::now() - start;
+            return tree;
+        } catch (const ParseCancellationException &e) {
+            // Either a syntax error, or SLL is too weak for this input.
+            stats.sll_time += clock::now() - start;
+            parser.reset();
+            tokens->seek(start_index);
+        }
+    }
+
+    auto start = clock::now();
+    simulator->setPredictionMode(atn::PredictionMode::LL);
+    parser.setErrorHandler(std::make_shared<ThrowExceptionStrategy>());
+    ++stats.ll_parses;
+    Context *tree = nullptr;
+    try {
+        tree = (parser.*rule)();
+    } catch (const RecognitionException &e) {
+    }
+    stats.ll_time += clock::now() - start;
+    return tree;
+}
+
+} // namespace
+
+namespace basic {
+
+PreparedProgram::PreparedProgram(const Fragment &frag, ParseStats &stats)
+    : revision(frag.get_revision()),
+      cached(ParserCache::local().acquire(frag.render(), &stats)) {
+    // The tokens are read as the parser asks for them, so that the parse
+    // times include lexing.
+}
+
+PreparedProgram::~PreparedProgram() {
+    ParserCache::local().release(std::move(cached));
+}
+
+std::unique_ptr<PreparedProgram>
+PreparedProgram::prepare(const Fragment &frag, ParseMode mode,
+                         ParseStats *stats) {
+    ParseStats parse_stats{};
+    std::unique_ptr<PreparedProgram> prepared{
+        new PreparedProgram{frag, parse_stats}};
+    prepared->tree = parse(prepared->cached->parser, &BasicParser::prog, mode,
+                           parse_stats);
+    if (stats != nullptr) {
+        *stats += parse_stats;
+    }
+    if (prepared->tree == nullptr) {
+        return nullptr;
+    }
+
+    std::stringstream decode_err{};
+    basic_visitor::DecodeVisitor decode_visitor{decode_err};
+    decode_visitor.visit(prepared->tree);
+    prepared->decode_errors = decode_err.str();
+    prepared->symbols = decode_visitor.take_symbols();
+    return prepared;
+}
+
+std::vector<LSize>
+PreparedProgram::find_syntax_errors(const Fragment &frag, ParseMode mode,
+                                    ParseStats *stats) {
+    // A statement may run onto the next lines, so the statements are parsed
+    // one at a time on the tokens of the whole program, as `prog` reads
+    // them.
+    ParseStats parse_stats{};
+    auto &cache = ParserCache::local();
+    auto cached = cache.acquire(frag.render(), &parse_stats);
+    auto &tokens = cached->tokens;
+    std::vector<LSize> bad_lines{};
+    while (tokens.LA(1) != Token::EOF) {
+        auto start_index = tokens.index();
+        auto line_num = decode_int<LSize>(tokens.LT(1)->getText());
+        if (parse(cached->parser, &BasicParser::stm0, mode, parse_stats) !=
+            nullptr) {
+            continue;
+        }
+        bad_lines.push_back(line_num.value_or(0));
+        // The statement may have failed on a later line, which is then
+        // parsed as if the bad line were an ERROR.
+        tokens.seek(start_index);
+        while (tokens.LA(1) != BasicParser::NL &&
+               tokens.LA(1) != BasicParser::COMMENT &&
+               tokens.LA(1) != Token::EOF) {
+            tokens.consume();
+        }
+        if (tokens.LA(1) != Token::EOF) {
+            tokens.consume();
+        }
+    }
+    cache.release(std::move(cached));
+    if (stats != nullptr) {
+        *stats += parse_stats;
+    }
+    return bad_lines;
+}
+
+void PreparedProgram::warm_up() {
+    Fragment frag{};
+    for (const char *line :
+         {"REM warm up", "INPUT a", "LET b = -(a + 1) * 2 - a / 3 MOD 4 ** 2",
+          "IF a < b THEN 100", "IF a = b THEN 999", "IF a > b THEN 110",
+          "GOTO 100", "PRINT b", ERROR_LINE, "END"}) {
+        frag.append(line);
+    }
+    for (auto mode : {ParseMode::TWO_STAGE, ParseMode::LL}) {
+        prepare(frag, mode);
+    }
+    // A bad line takes the fallback from SLL.
+    frag.append("LET c =");
+    find_syntax_errors(frag);
+}
+
+void PreparedProgram::reset_counters() {
+    for (auto stm0 : tree->stm0()) {
+        auto stm = stm0->stm();
+        if (stm == nullptr) {
+            continue;
+        }
+        if (auto let_stm = stm->let_stm()) {
+            let_stm->exec_times = 0;
+        } else if (auto goto_stm = stm->goto_stm()) {
+            goto_stm->exec_times = 0;
+        } else if (auto if_stm = stm->if_stm()) {
+            if_stm->true_times = 0;
+            if_stm->false_times = 0;
+        }
+    }
+}
+
+} // namespace basic
@@ -0,0 +1,32 @@
+#include "Session.h"
+#include "Interpreter.h"
+#include "Syntax.h"
+
+namespace basic {
+
+std::string Session::execute(const std::string &command, std::ostream &out,
+                             std::ostream &err,
+                             std::function<std::string()> input_action) {
+    // A command is the only line of its program, so a jump either fails or
+    // lands on the command again, forever.
+    auto first = basic_syntax::Lexer{command}.next();
+    if (first.kind == basic_syntax::TokenKind::GOTO ||
+        first.kind == basic_syntax::TokenKind::IF) {
+        err << "runtime error: " << first.text
+            << " can't be run as a command\n";
+        return {};
+    }
+
+    auto frag = std::make_shared<Fragment>();
+    frag->append(command);
+
+    // A single statement is not worth compiling, so it is walked, which also
+    // lets it start from the variables of the session.
+    Interpreter interpreter{frag, out, err, std::move(input_action)};
+    interpreter.set_var_env(v_env);
+    interpreter.set_cancel_token(cancel_token);
+    interpreter.interpret();
+    return interpreter.show_ast();
+}
+
+} // namespace basic
@@ -0,0 +1,692 @@
+#include "Syntax.h"
+
+#include <cassert>
+#include <optional>
+#include <sstream>
+
+namespace basic_syntax {
+
+namespace {
+
+using basic_vm::ExprId;
+using basic_vm::ExprKind;
+using basic_vm::StmKind;
+
+bool is_letter(char c) noexcept {
+    // Any byte of a UTF-8 sequence: LETTER takes every code point from
+    // U+0080 on.
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           static_cast<unsigned char>(c) >= 0x80;
+}
+
+bool is_digit(char c) noexcept {
+    return c >= '0' && c <= '9';
+}
+
+TokenKind keyword_or_id(std::string_view text) noexcept {
+    static constexpr std::pair<std::string_view, TokenKind> keywords[] = {
+        {"LET", TokenKind::LET},     {"GOTO", TokenKind::GOTO},
+        {"IF", TokenKind::IF},       {"THEN", TokenKind::THEN},
+        {"REM", TokenKind::REM},     {"PRINT", TokenKind::PRINT},
+        {"INPUT", TokenKind::INPUT}, {"END", TokenKind::END},
+        {"MOD", TokenKind::MOD},
+    };
+    for (auto [keyword, kind] : keywords) {
+        if (text == keyword) {
+            return kind;
+        }
+    }
+    return TokenKind::ID;
+}
+
+/**
+ * @brief The precedence level ANTLR gives the alternative of `expr` for a
+ * binary operator: the number of alternatives after it, plus one. An
+ * operator only takes an operand parsed at its level or below.
+ *
+ * @return 0 if the token is not a binary operator.
+ */
+int binary_level(TokenKind kind) noexcept {
+    switch (kind) {
+    case TokenKind::POWER:
+        return 9;
+    case TokenKind::MULT:
+        return 8;
+    case TokenKind::DIV:
+        return 7;
+    case TokenKind::MOD:
+        return 6;
+    case TokenKind::PLUS:
+        return 5;
+    case TokenKind::MINUS:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+ExprKind binary_kind(TokenKind kind) noexcept {
+    switch (kind) {
+    case TokenKind::POWER:
+        return ExprKind::POW;
+    case TokenKind::MULT:
+        return ExprKind::MUL;
+    case TokenKind::DIV:
+        return ExprKind::DIV;
+    case TokenKind::MOD:
+        return ExprKind::MOD;
+    case TokenKind::PLUS:
+        return ExprKind::ADD;
+    default:
+        assert(kind == TokenKind::MINUS);
+        return ExprKind::SUB;
+    }
+}
+
+/// The level of the operand of `MINUS expr`, above every binary operator.
+constexpr int NEG_LEVEL = 10;
+
+/**
+ * @brief Recursive descent over `Basic.g4`. A line with a syntax error is
+ * skipped, like `ThrowExceptionStrategy` rejects it.
+ *
+ * The only recovery is ANTLR's, where an operand is expected: a single token
+ * that can't start one is deleted if the next token can. That token may end
+ * the line, so a statement can take the line number of the next line as an
+ * operand and run on to the end of that line, which is then gone from the
+ * program.
+ */
+class Parser {
+
+public:
+    Parser(std::string_view source, std::vector<Stm> &stms,
+           std::vector<Expr> &exprs, std::ostream &err) noexcept
+        : lexer(source), stms(stms), exprs(exprs), err(err) {
+    }
+
+    /**
+     * @brief Parse every line, keeping the statements of the good ones.
+     */
+    void parse(std::vector<LSize> &bad_lines) {
+        consume();
+        // prog: stm0*
+        while (tok.kind == TokenKind::INT) {
+            auto line = decode_int<LSize>(tok.text).value_or(0);
+            auto line_start = lexer;
+            auto line_tok = tok;
+            Stm stm{};
+            if (parse_stm0(stm)) {
+                stms.push_back(stm);
+                continue;
+            }
+            bad_lines.push_back(line);
+            // The statement may have failed on a later line, which is then
+            // parsed as if the bad line were an ERROR.
+            lexer = line_start;
+            tok = line_tok;
+            while (tok.kind != TokenKind::NL &&
+                   tok.kind != TokenKind::COMMENT &&
+                   tok.kind != TokenKind::END_OF_INPUT) {
+                consume();
+            }
+            consume();
+        }
+    }
+
+private:
+    Lexer lexer;
+    Token tok{};
+    std::vector<Stm> &stms;
+    std::vector<Expr> &exprs;
+    std::ostream &err;
+    /// Whether the literals of the current statement are all valid.
+    bool valid = true;
+
+    void consume() noexcept {
+        tok = lexer.next();
+    }
+
+    bool accept(TokenKind kind) noexcept {
+        if (tok.kind != kind) {
+            return false;
+        }
+        consume();
+        return true;
+    }
+
+    template <typename T> T decode(const Token &token, std::string_view what) {
+        auto value = decode_int<T>(token.text);
+        if (!value.has_value()) {
+            std::stringstream err_ss{};
+            err_ss << what << " out of range: " << token.text;
+            log_error(err, token.loc.line, token.loc.column, err_ss.str());
+            valid = false;
+        }
+        return value.value_or(0);
+    }
+
+    ExprId add_expr(const Expr &expr) {
+        exprs.push_back(expr);
+        return static_cast<ExprId>(exprs.size() - 1);
+    }
+
+    // stm0: line_num stm NL | line_num COMMENT
+    bool parse_stm0(Stm &stm) {
+        valid = true;
+        stm.line_text = tok.text;
+        stm.line = decode<LSize>(tok, "Line number");
+        consume();
+        if (tok.kind == TokenKind::COMMENT) {
+            // Without `REM`, the character after it, and the new line.
+            auto comment = tok.text;
+            stm.kind = StmKind::REM;
+            stm.text = comment.size() > 4
+                           ? comment.substr(4, comment.size() - 5)
+                           : std::string_view{};
+            consume();
+        } else if (!parse_stm(stm) || !accept(TokenKind::NL)) {
+            return false;
+        }
+        stm.valid = valid;
+        return true;
+    }
+
+    bool parse_target(Stm &stm) {
+        if (tok.kind != TokenKind::INT) {
+            return false;
+        }
+        stm.target_text = tok.text;
+        stm.target = decode<LSize>(tok, "Line number");
+        consume();
+        return true;
+    }
+
+    bool parse_stm(Stm &stm) {
+        switch (tok.kind) {
+        case TokenKind::LET: {
+            consume();
+            stm.kind = StmKind::LET;
+            stm.text = tok.text;
+            if (!accept(TokenKind::ID) || !accept(TokenKind::EQUAL)) {
+                return false;
+            }
+            auto expr = parse_expr(0);
+            stm.expr = expr.value_or(0);
+            return expr.has_value();
+        }
+        case TokenKind::PRINT: {
+            consume();
+            stm.kind = StmKind::PRINT;
+            auto expr = parse_expr(0);
+            stm.expr = expr.value_or(0);
+            return expr.has_value();
+        }
+        case TokenKind::INPUT:
+            consume();
+            stm.kind = StmKind::INPUT;
+            stm.text = tok.text;
+            return accept(TokenKind::ID);
+        case TokenKind::GOTO:
+            consume();
+            stm.kind = StmKind::GOTO;
+            return parse_target(stm);
+        case TokenKind::IF: {
+            consume();
+            stm.kind = StmKind::IF;
+            auto lhs = parse_expr(0);
+            if (!lhs.has_value()) {
+                return false;
+            }
+            stm.expr = *lhs;
+            if (accept(TokenKind::EQUAL)) {
+                stm.cmp = basic_vm::CmpOp::EQ;
+            } else if (accept(TokenKind::LT)) {
+                stm.cmp = basic_vm::CmpOp::LT;
+            } else if (accept(TokenKind::GT)) {
+                stm.cmp = basic_vm::CmpOp::GT;
+            } else {
+                return false;
+            }
+            auto rhs = parse_expr(0);
+            if (!rhs.has_value()) {
+                return false;
+            }
+            stm.rhs = *rhs;
+            return accept(TokenKind::THEN) && parse_target(stm);
+        }
+        case TokenKind::END:
+            consume();
+            stm.kind = StmKind::END;
+            return true;
+        case TokenKind::ERROR:
+            consume();
+            stm.kind = StmKind::ERROR;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /**
+     * @brief Parse an expression whose operators all have at least the
+     * given level, like ANTLR's `expr(level)`.
+     */
+    std::optional<ExprId> parse_expr(int level) {
+        auto lhs = parse_primary();
+        while (lhs.has_value()) {
+            auto op_level = binary_level(tok.kind);
+            if (op_level == 0 || op_level < level) {
+                break;
+            }
+            Expr expr{binary_kind(tok.kind)};
+            consume();
+            expr.loc = tok.loc;
+            // `**` is right-associative, the others left-associative.
+            auto rhs = parse_expr(expr.kind == ExprKind::POW ? op_level
+                                                             : op_level + 1);
+            if (!rhs.has_value()) {
+                return std::nullopt;
+            }
+            expr.lhs = *lhs;
+            expr.rhs = *rhs;
+            lhs = add_expr(expr);
+        }
+        return lhs;
+    }
+
+    static bool starts_operand(TokenKind kind) noexcept {
+        return kind == TokenKind::MINUS || kind == TokenKind::LPAREN ||
+               kind == TokenKind::INT || kind == TokenKind::ID;
+    }
+
+    std::optional<ExprId> parse_primary() {
+        if (!starts_operand(tok.kind)) {
+            auto ahead = lexer;
+            if (starts_operand(ahead.next().kind)) {
+                consume();
+            }
+        }
+        Expr expr{};
+        switch (tok.kind) {
+        case TokenKind::MINUS: {
+            consume();
+            auto operand = parse_expr(NEG_LEVEL);
+            if (!operand.has_value()) {
+                return std::nullopt;
+            }
+            expr.kind = ExprKind::NEG;
+            expr.lhs = *operand;
+            return add_expr(expr);
+        }
+        case TokenKind::LPAREN: {
+            consume();
+            auto inner = parse_expr(0);
+            if (!inner.has_value() || !accept(TokenKind::RPAREN)) {
+                return std::nullopt;
+            }
+            return inner;
+        }
+        case TokenKind::INT:
+            expr.kind = ExprKind::CONST;
+            expr.text = tok.text;
+            expr.value = decode<VarType>(tok, "Integer literal");
+            consume();
+            return add_expr(expr);
+        case TokenKind::ID:
+            expr.kind = ExprKind::VAR;
+            expr.text = tok.text;
+            expr.loc = tok.loc;
+            consume();
+            return add_expr(expr);
+        default:
+            return std::nullopt;
+        }
+    }
+};
+
+/**
+ * @brief Lower an expression as `LowerVisitor` does: operands first, and
+ * variables interned in the order they appear.
+ */
+ExprId lower_expr(basic_vm::Module &module, const std::vector<Expr> &exprs,
+                  ExprId id) {
+    const auto &expr = exprs[id];
+    basic_vm::Expr lowered{expr.kind};
+    switch (expr.kind) {
+    case ExprKind::CONST:
+        lowered.operand = expr.value;
+        break;
+    case ExprKind::VAR:
+        lowered.operand = static_cast<VarType>(module.intern(expr.text));
+        lowered.loc = expr.loc;
+        break;
+    case ExprKind::NEG:
+        lowered.lhs = lower_expr(module, exprs, expr.lhs);
+        break;
+    default:
+        lowered.lhs = lower_expr(module, exprs, expr.lhs);
+        lowered.rhs = lower_expr(module, exprs, expr.rhs);
+        lowered.loc = expr.loc;
+        break;
+    }
+    return module.add_expr(lowered);
+}
+
+/**
+ * @brief Writes the AST in the format of `ASTConstructVisitor`.
+ */
+class AstWriter {
+
+public:
+    AstWriter(const std::vector<Expr> &exprs, const VariableEnv &v_env)
+        : exprs(exprs), v_env(v_env) {
+    }
+
+    std::string get_ast() const {
+        return ast_ss.str();
+    }
+
+    void write_stm(const Stm &stm, int hits, int taken) {
+        ast_out(stm.line_text);
+        switch (stm.kind) {
+        case StmKind::REM:
+            ast_out("REM\n\t");
+            ast_ss << stm.text;
+            ast_newline();
+            break;
+        case StmKind::LET:
+            ast_out("LET =");
+            ast_out(hits);
+            ast_newline();
+            indent_size++;
+            ast_indent();
+            ast_out(stm.text);
+            ast_out(v_env.get_ref_time(std::string{stm.text}));
+            ast_newline();
+            write_expr(stm.expr);
+            indent_size--;
+            break;
+        case StmKind::PRINT:
+            ast_out("PRINT");
+            ast_newline();
+            indent_size++;
+            write_expr(stm.expr);
+            indent_size--;
+            break;
+        case StmKind::INPUT:
+            ast_out("INPUT");
+            ast_newline();
+            ast_indent(1);
+            ast_out(stm.text);
+            ast_newline();
+            break;
+        case StmKind::GOTO:
+            ast_out("GOTO");
+            ast_out(hits);
+            ast_newline();
+            ast_indent(1);
+            ast_out(stm.target_text);
+            ast_newline();
+            break;
+        case StmKind::IF:
+            ast_out("IF THEN");
+            ast_out(taken);
+            ast_out(hits - taken);
+            ast_newline();
+            indent_size++;
+            write_expr(stm.expr);
+            ast_indent();
+            ast_out(stm.cmp == basic_vm::CmpOp::EQ   ? "="
+                    : stm.cmp == basic_vm::CmpOp::GT ? ">"
+                                                     : "<");
+            ast_newline();
+            write_expr(stm.rhs);
+            indent_size--;
+            break;
+        case StmKind::END:
+            ast_out("END");
+            ast_newline();
+            break;
+        case StmKind::ERROR:
+            ast_out("ERROR");
+            ast_newline();
+            break;
+        }
+    }
+
+private:
+    const std::vector<Expr> &exprs;
+    const VariableEnv &v_env;
+    std::size_t indent_size = 0;
+    std::stringstream ast_ss{};
+    bool need_space = false;
+
+    template <typename T> void ast_out(T &&msg) {
+        if (need_space) {
+            ast_ss << ' ' << std::forward<T>(msg);
+        } else {
+            ast_ss << std::forward<T>(msg);
+            need_space = true;
+        }
+    }
+    void ast_indent(std::size_t indent_cnt) {
+        ast_ss << std::string(indent_cnt, '\t');
+    }
+    void ast_indent() {
+        ast_indent(indent_size);
+    }
+    void ast_newline() {
+        ast_ss << '\n';
+        need_space = false;
+    }
+
+    void write_expr(ExprId id) {
+        const auto &expr = exprs[id];
+        ast_indent();
+        switch (expr.kind) {
+        case ExprKind::CONST:
+        case ExprKind::VAR:
+            ast_out(expr.text);
+            ast_newline();
+            return;
+        case ExprKind::NEG:
+            ast_out("-");
+            ast_newline();
+            indent_size++;
+            write_expr(expr.lhs);
+            indent_size--;
+            return;
+        case ExprKind::POW:
+            ast_out("**");
+            break;
+        case ExprKind::MUL:
+            ast_out("*");
+            break;
+        case ExprKind::DIV:
+            ast_out("/");
+            break;
+        case ExprKind::MOD:
+            ast_out("%");
+            break;
+        case ExprKind::ADD:
+            ast_out("+");
+            break;
+        case ExprKind::SUB:
+            ast_out("-");
+            break;
+        default:
+            assert(0);
+        }
+        ast_newline();
+        indent_size++;
+        write_expr(expr.lhs);
+        write_expr(expr.rhs);
+        indent_size--;
+    }
+};
+
+} // namespace
+
+Lexer::Lexer(std::string_view source) noexcept : source(source) {
+}
+
+void Lexer::advance(std::size_t n) noexcept {
+    for (auto end = pos + n; pos < end; ++pos) {
+        auto c = static_cast<unsigned char>(source[pos]);
+        if (c == '\n') {
+            loc.line++;
+            loc.column = 1;
+        } else if (c < 0x80 || c >= 0xC0) {
+            // Not a continuation byte: a new code point.
+            loc.column++;
+        }
+    }
+}
+
+Token Lexer::next() noexcept {
+    auto rest = [this] { return source.substr(pos); };
+    while (pos < source.size() &&
+           (source[pos] == ' ' || source[pos] == '\t' || source[pos] == '\r')) {
+        advance(1);
+    }
+    Token token{TokenKind::END_OF_INPUT, {}, loc};
+    if (pos == source.size()) {
+        return token;
+    }
+
+    auto c = source[pos];
+    std::size_t len = 1;
+    if (c == '\n') {
+        token.kind = TokenKind::NL;
+    } else if (rest().substr(0, 3) == "REM" &&
+               source.find('\n', pos) != std::string_view::npos) {
+        // `REM .*? NL` is longer than any keyword or identifier.
+        token.kind = TokenKind::COMMENT;
+        len = source.find('\n', pos) + 1 - pos;
+    } else if (is_letter(c)) {
+        while (pos + len < source.size() &&
+               (is_letter(source[pos + len]) || is_digit(source[pos + len]))) {
+            ++len;
+        }
+        token.kind = keyword_or_id(source.substr(pos, len));
+    } else if (is_digit(c)) {
+        // INT: [0-9] | [1-9][0-9]*, so a leading 0 stands alone.
+        while (c != '0' && pos + len < source.size() &&
+               is_digit(source[pos + len])) {
+            ++len;
+        }
+        token.kind = TokenKind::INT;
+    } else if (rest().substr(0, 11) == "___ERROR___") {
+        token.kind = TokenKind::ERROR;
+        len = 11;
+    } else if (rest().substr(0, 2) == "**") {
+        token.kind = TokenKind::POWER;
+        len = 2;
+    } else {
+        switch (c) {
+        case '*':
+            token.kind = TokenKind::MULT;
+            break;
+        case '/':
+            token.kind = TokenKind::DIV;
+            break;
+        case '+':
+            token.kind = TokenKind::PLUS;
+            break;
+        case '-':
+            token.kind = TokenKind::MINUS;
+            break;
+        case '>':
+            token.kind = TokenKind::GT;
+            break;
+        case '<':
+            token.kind = TokenKind::LT;
+            break;
+        case '=':
+            token.kind = TokenKind::EQUAL;
+            break;
+        case '(':
+            token.kind = TokenKind::LPAREN;
+            break;
+        case ')':
+            token.kind = TokenKind::RPAREN;
+            break;
+        default:
+            token.kind = TokenKind::EXTRA;
+            break;
+        }
+    }
+    token.text = source.substr(pos, len);
+    advance(len);
+    return token;
+}
+
+SourceProgram::SourceProgram(const Fragment &frag)
+    : revision(frag.get_revision()), source(frag.render()) {
+}
+
+std::unique_ptr<SourceProgram>
+SourceProgram::parse(const Fragment &frag, std::vector<LSize> *bad_lines) {
+    std::unique_ptr<SourceProgram> program{new SourceProgram{frag}};
+    std::stringstream decode_err{};
+    std::vector<LSize> bad{};
+    Parser parser{program->source, program->stms, program->exprs,
+                  decode_err};
+    parser.parse(bad);
+    if (!bad.empty()) {
+        if (bad_lines != nullptr) {
+            *bad_lines = std::move(bad);
+        }
+        return nullptr;
+    }
+    program->decode_errors = decode_err.str();
+    return program;
+}
+
+basic_vm::Module SourceProgram::lower() const {
+    basic_vm::Module module{};
+    module.stms.reserve(stms.size());
+    for (const auto &stm : stms) {
+        basic_vm::Stm lowered{stm.valid ? stm.kind : StmKind::ERROR};
+        lowered.line = stm.line;
+        if (stm.valid) {
+            switch (stm.kind) {
+            case StmKind::LET:
+                lowered.var = module.intern(stm.text);
+                lowered.expr = lower_expr(module, exprs, stm.expr);
+                break;
+            case StmKind::PRINT:
+                lowered.expr = lower_expr(module, exprs, stm.expr);
+                break;
+            case StmKind::INPUT:
+                lowered.var = module.intern(stm.text);
+                break;
+            case StmKind::IF:
+                lowered.expr = lower_expr(module, exprs, stm.expr);
+                lowered.rhs = lower_expr(module, exprs, stm.rhs);
+                lowered.cmp = stm.cmp;
+                lowered.target = stm.target;
+                break;
+            case StmKind::GOTO:
+                lowered.target = stm.target;
+                break;
+            default:
+                break;
+            }
+        }
+        module.stms.push_back(lowered);
+    }
+    return module;
+}
+
+std::string SourceProgram::render_ast(const std::vector<int> &hits,
+                                      const std::vector<int> &taken,
+                                      const VariableEnv &v_env) const {
+    AstWriter writer{exprs, v_env};
+    for (std::size_t i = 0; i < stms.size(); ++i) {
+        writer.write_stm(stms[i], hits[i], taken[i]);
+    }
+    return writer.get_ast();
+}
+
+} // namespace basic_syntax
@@ -0,0 +1,817 @@
+#include "VirtualMachine.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <sstream>
+
+// Labels as values are a GCC and Clang extension. Other compilers, or builds
+// with the QBASIC_THREADED_DISPATCH option off, dispatch with a switch.
+#if defined(QBASIC_THREADED_DISPATCH) &&                                       \
+    (defined(__GNUC__) || defined(__clang__))
+#define BASIC_VM_THREADED_DISPATCH 1
+#else
+#define BASIC_VM_THREADED_DISPATCH 0
+#endif
+
+namespace basic_vm {
+
+namespace {
+
+/**
+ * @brief How many iterations a counted loop runs, if the counter doesn't
+ * wrap around before it ends. Each iteration steps the counter, then goes on
+ * while `counter cmp limit`.
+ */
+std::optional<std::uint64_t> trip_count(VarType start, VarType step,
+                                        CmpOp cmp, VarType limit) {
+    auto goes_on = [&](VarType counter) {
+        switch (cmp) {
+        case CmpOp::EQ:
+            return counter == limit;
+        case CmpOp::LT:
+            return counter < limit;
+        case CmpOp::GT:
+            return counter > limit;
+        }
+        return false;
+    };
+    if (!goes_on(wrapping_add(start, step))) {
+        return 1;
+    }
+    if (cmp == CmpOp::EQ) {
+        // The step is not 0, so the counter moves away from the limit.
+        return 2;
+    }
+    // A counter moving away from the limit only stops after wrapping around.
+    if ((cmp == CmpOp::LT) != (step > 0)) {
+        return std::nullopt;
+    }
+    std::int64_t distance = cmp == CmpOp::LT
+                                ? std::int64_t{limit} - start
+                                : std::int64_t{start} - limit;
+    std::int64_t stride = step > 0 ? std::int64_t{step} : -std::int64_t{step};
+    auto n = (distance + stride - 1) / stride;
+    auto last = start + n * std::int64_t{step};
+    // A single iteration means the first step already wrapped around.
+    if (n < 2 || last < std::numeric_limits<VarType>::min() ||
+        last > std::numeric_limits<VarType>::max()) {
+        return std::nullopt;
+    }
+    return static_cast<std::uint64_t>(n);
+}
+
+/// Jumps back between two checks of the watchdog. Native code runs at most as
+/// many jumps back before returning, and each statement it runs counts as one.
+constexpr int WATCHDOG_PERIOD = 1024;
+
+/// Whether a count can grow by more without overflowing.
+bool has_room(int count, std::uint64_t more) noexcept {
+    return more <= static_cast<std::uint64_t>(
+                       std::numeric_limits<int>::max() - count);
+}
+
+} // namespace
+
+VirtualMachine::VirtualMachine(
+    const Program &program, std::ostream &out, std::ostream &err,
+    const std::function<std::string()> &input_action) noexcept
+    : program(program), out(out), err(err), input_action_ref(input_action) {
+    assert(input_action_ref.get());
+}
+
+void VirtualMachine::reset() {
+    const auto &code = program.code;
+    profile.hits.assign(code.size(), 0);
+    profile.taken.assign(code.size(), 0);
+    vars.assign(program.num_slots(), 0);
+    ref_times.assign(program.num_slots(), -1);
+    regs.assign(program.num_regs, 0);
+    poison.assign(program.num_regs, 0);
+    failed = false;
+    steps = 0;
+    jit_entries.clear();
+    jit_entries.resize(code.size());
+    jit_ctx = {vars.data(), ref_times.data(), profile.hits.data(),
+               profile.taken.data()};
+    tier_stats = {};
+    saved_state = {};
+    samples_saved = 0;
+    power = 1;
+    until_sample = loop_detect_options.sample_period;
+    has_input = false;
+    hooks_back_edges = jit_enabled || loop_detect_options.enabled ||
+                       watchdog.is_active();
+    watchdog.start();
+    until_check = WATCHDOG_PERIOD;
+}
+
+void VirtualMachine::run() {
+    reset();
+    execute();
+
+    tier_stats.native_steps = jit_ctx.steps;
+    tier_stats.interpreted_steps = steps;
+}
+
+void VirtualMachine::run(const AotModule &module) {
+    reset();
+    AotContext ctx{vars.data(),
+                   ref_times.data(),
+                   profile.hits.data(),
+                   profile.taken.data(),
+                   this,
+                   aot_undefined,
+                   aot_fail,
+                   aot_print,
+                   aot_input,
+                   aot_solve_loop};
+    module.run(ctx);
+}
+
+void VirtualMachine::execute() {
+    const auto &code = program.code;
+    const auto &divisors = program.divisors;
+    std::size_t pc = 0;
+    const Instruction *ins = nullptr;
+
+#if BASIC_VM_THREADED_DISPATCH
+    // Labels of the handlers, in the order of OpCode.
+    static const void *const labels[] = {
+        &&op_LOAD_CONST,
+        &&op_LOAD_VAR,
+        &&op_NEG,
+        &&op_ADD,
+        &&op_SUB,
+        &&op_MUL,
+        &&op_DIV,
+        &&op_MOD,
+        &&op_POW,
+        &&op_SQUARE,
+        &&op_CUBE,
+        &&op_DIV_POW2,
+        &&op_DIV_MAGIC,
+        &&op_MOD_POW2,
+        &&op_MOD_MAGIC,
+        &&op_FAIL,
+        &&op_LET,
+        &&op_PRINT,
+        &&op_INPUT,
+        &&op_GOTO,
+        &&op_IF_EQ,
+        &&op_IF_LT,
+        &&op_IF_GT,
+        &&op_INC_VAR,
+        &&op_MOVE_VAR,
+        &&op_IF_VAR_EQ_CONST,
+        &&op_IF_VAR_LT_CONST,
+        &&op_IF_VAR_GT_CONST,
+        &&op_IF_VAR_EQ_VAR,
+        &&op_IF_VAR_LT_VAR,
+        &&op_IF_VAR_GT_VAR,
+        &&op_COUNT,
+        &&op_TOUCH_VAR,
+        &&op_LOAD_INVARIANT,
+        &&op_SAVE_INVARIANT,
+        &&op_DROP_INVARIANT,
+        &&op_SOLVE_LOOP,
+        &&op_END,
+        &&op_BAD_LINE,
+    };
+    static_assert(std::size(labels) ==
+                  static_cast<std::size_t>(OpCode::BAD_LINE) + 1);
+    // Replace each opcode by the address of its handler, so that every
+    // handler jumps straight to the next one through its own indirect branch.
+    if (threaded.size() != code.size()) {
+        threaded.resize(code.size());
+        for (std::size_t i = 0; i < code.size(); ++i) {
+            threaded[i] = labels[static_cast<std::size_t>(code[i].op)];
+        }
+    }
+    const void *const *handlers = threaded.data();
+
+#define TARGET(op) op_##op:
+#define DISPATCH()                                                             \
+    do {                                                                       \
+        ins = &code[pc];                                                       \
+        goto *handlers[pc];                                                    \
+    } while (0)
+#else
+#define TARGET(op) case OpCode::op:
+#define DISPATCH() goto dispatch
+#endif
+#define NEXT()                                                                 \
+    do {                                                                       \
+        ++pc;                                                                  \
+        DISPATCH();                                                            \
+    } while (0)
+#define HIT()                                                                  \
+    do {                                                                       \
+        profile.hits[pc]++;                                                    \
+        ++steps;                                                               \
+    } while (0)
+#define JUMP(target)                                                           \
+    do {                                                                       \
+        auto from = pc;                                                        \
+        pc = (target);                                                         \
+        if (pc <= from && hooks_back_edges) {                                  \
+            pc = on_back_edge(pc, from);                                       \
+            if (pc == Program::NO_PC) {                                        \
+                return;                                                        \
+            }                                                                  \
+        }                                                                      \
+        DISPATCH();                                                            \
+    } while (0)
+
+#if BASIC_VM_THREADED_DISPATCH
+    DISPATCH();
+#else
+dispatch:
+    ins = &code[pc];
+    switch (ins->op) {
+#endif
+    TARGET(LOAD_CONST)
+        regs[ins->dst] = ins->imm;
+        if (failed) {
+            poison[ins->dst] = 0;
+        }
+        NEXT();
+    TARGET(LOAD_VAR)
+        if (read_var(ins->index, program.locs[pc])) {
+            regs[ins->dst] = vars[ins->index];
+            if (failed) {
+                poison[ins->dst] = 0;
+            }
+        } else {
+            poison_reg(ins->dst);
+        }
+        NEXT();
+    TARGET(NEG)
+        regs[ins->dst] = wrapping_neg(regs[ins->a]);
+        if (failed) {
+            poison[ins->dst] = poison[ins->a];
+        }
+        NEXT();
+    TARGET(SQUARE)
+        regs[ins->dst] = wrapping_mul(regs[ins->a], regs[ins->a]);
+        if (failed) {
+            poison[ins->dst] = poison[ins->a];
+        }
+        NEXT();
+    TARGET(CUBE) {
+        auto base = regs[ins->a];
+        regs[ins->dst] = wrapping_mul(wrapping_mul(base, base), base);
+        if (failed) {
+            poison[ins->dst] = poison[ins->a];
+        }
+        NEXT();
+    }
+    TARGET(DIV_POW2)
+        regs[ins->dst] = divisors[ins->index].shift_divide(regs[ins->a]);
+        if (failed) {
+            poison[ins->dst] = poison[ins->a];
+        }
+        NEXT();
+    TARGET(DIV_MAGIC)
+        regs[ins->dst] = divisors[ins->index].magic_divide(regs[ins->a]);
+        if (failed) {
+            poison[ins->dst] = poison[ins->a];
+        }
+        NEXT();
+    TARGET(MOD_POW2)
+        regs[ins->dst] = divisors[ins->index].mask_modulo(regs[ins->a]);
+        if (failed) {
+            poison[ins->dst] = poison[ins->a];
+        }
+        NEXT();
+    TARGET(MOD_MAGIC)
+        regs[ins->dst] = divisors[ins->index].magic_modulo(regs[ins->a]);
+        if (failed) {
+            poison[ins->dst] = poison[ins->a];
+        }
+        NEXT();
+    TARGET(ADD)
+        regs[ins->dst] = wrapping_add(regs[ins->a], regs[ins->b]);
+        if (failed) {
+            poison[ins->dst] = poison[ins->a] | poison[ins->b];
+        }
+        NEXT();
+    TARGET(SUB)
+        regs[ins->dst] = wrapping_sub(regs[ins->a], regs[ins->b]);
+        if (failed) {
+            poison[ins->dst] = poison[ins->a] | poison[ins->b];
+        }
+        NEXT();
+    TARGET(MUL)
+        regs[ins->dst] = wrapping_mul(regs[ins->a], regs[ins->b]);
+        if (failed) {
+            poison[ins->dst] = poison[ins->a] | poison[ins->b];
+        }
+        NEXT();
+    TARGET(DIV)
+    TARGET(MOD)
+    TARGET(POW) {
+        // These may fail themselves, but only if both operands are valid.
+        if (failed && (is_poisoned(ins->a) || is_poisoned(ins->b))) {
+            poison_reg(ins->dst);
+            NEXT();
+        }
+        auto lhs = regs[ins->a];
+        auto rhs = regs[ins->b];
+        if (ins->op == OpCode::POW ? rhs < 0 : rhs == 0) {
+            arithmetic_error(pc, lhs, rhs);
+            poison_reg(ins->dst);
+            NEXT();
+        }
+        regs[ins->dst] = ins->op == OpCode::DIV   ? wrapping_div(lhs, rhs)
+                        : ins->op == OpCode::MOD ? modulo_of(lhs, rhs)
+                                                : power_of(lhs, rhs);
+        if (failed) {
+            poison[ins->dst] = 0;
+        }
+        NEXT();
+    }
+    TARGET(FAIL)
+        poison_reg(ins->dst);
+        NEXT();
+    TARGET(LET)
+        HIT();
+        if (!is_poisoned(ins->a)) {
+            define(ins->index, regs[ins->a]);
+        }
+        clear_poison();
+        NEXT();
+    TARGET(PRINT)
+        HIT();
+        if (!is_poisoned(ins->a)) {
+            out << regs[ins->a] << '\n';
+        }
+        clear_poison();
+        NEXT();
+    TARGET(INPUT)
+        HIT();
+        input(ins->index);
+        if (watchdog.is_active() && !check_watchdog()) {
+            return;
+        }
+        NEXT();
+    TARGET(GOTO)
+        HIT();
+        JUMP(ins->index);
+    TARGET(IF_EQ)
+    TARGET(IF_LT)
+    TARGET(IF_GT) {
+        if (is_poisoned(ins->a) || is_poisoned(ins->b)) {
+            clear_poison();
+            NEXT();
+        }
+        auto lhs = regs[ins->a];
+        auto rhs = regs[ins->b];
+        bool cond = ins->op == OpCode::IF_EQ   ? lhs == rhs
+                    : ins->op == OpCode::IF_LT ? lhs < rhs
+                                               : lhs > rhs;
+        clear_poison();
+        HIT();
+        if (cond) {
+            profile.taken[pc]++;
+            JUMP(ins->index);
+        }
+        NEXT();
+    }
+    TARGET(END)
+        return;
+    TARGET(INC_VAR)
+        HIT();
+        if (read_var(ins->index, program.locs[pc])) {
+            vars[ins->index] = wrapping_add(vars[ins->index], ins->imm);
+        }
+        NEXT();
+    TARGET(MOVE_VAR)
+        HIT();
+        if (read_var(ins->a, program.locs[pc])) {
+            define(ins->index, vars[ins->a]);
+        }
+        NEXT();
+    TARGET(IF_VAR_EQ_CONST)
+    TARGET(IF_VAR_LT_CONST)
+    TARGET(IF_VAR_GT_CONST) {
+        if (!read_var(ins->a, program.locs[pc])) {
+            NEXT();
+        }
+        auto lhs = vars[ins->a];
+        bool cond = ins->op == OpCode::IF_VAR_EQ_CONST   ? lhs == ins->imm
+                    : ins->op == OpCode::IF_VAR_LT_CONST ? lhs < ins->imm
+                                                         : lhs > ins->imm;
+        HIT();
+        if (cond) {
+            profile.taken[pc]++;
+            JUMP(ins->index);
+        }
+        NEXT();
+    }
+    TARGET(IF_VAR_EQ_VAR)
+    TARGET(IF_VAR_LT_VAR)
+    TARGET(IF_VAR_GT_VAR) {
+        bool lhs_ok = read_var(ins->a, program.locs[pc]);
+        bool rhs_ok = read_var(ins->b, program.rhs_locs.at(pc));
+        if (!lhs_ok || !rhs_ok) {
+            NEXT();
+        }
+        auto lhs = vars[ins->a];
+        auto rhs = vars[ins->b];
+        bool cond = ins->op == OpCode::IF_VAR_EQ_VAR   ? lhs == rhs
+                    : ins->op == OpCode::IF_VAR_LT_VAR ? lhs < rhs
+                                                       : lhs > rhs;
+        HIT();
+        if (cond) {
+            profile.taken[pc]++;
+            JUMP(ins->index);
+        }
+        NEXT();
+    }
+    TARGET(COUNT)
+        HIT();
+        clear_poison();
+        NEXT();
+    TARGET(TOUCH_VAR)
+        read_var(ins->index, program.locs[pc]);
+        NEXT();
+    TARGET(LOAD_INVARIANT) {
+        if (ref_times[ins->index] < 0) {
+            NEXT();
+        }
+        // The variables can't be undefined, since they were read to compute
+        // the value.
+        const auto &reads =
+            program.invariant_reads[ins->index - program.symbols.size()];
+        for (auto slot : reads) {
+            ref_times[slot]++;
+        }
+        regs[ins->dst] = vars[ins->index];
+        if (failed) {
+            poison[ins->dst] = 0;
+        }
+        pc = static_cast<std::size_t>(ins->imm);
+        DISPATCH();
+    }
+    TARGET(SAVE_INVARIANT)
+        if (!is_poisoned(ins->a)) {
+            define(ins->index, regs[ins->a]);
+        }
+        NEXT();
+    TARGET(DROP_INVARIANT)
+        ref_times[ins->index] = -1;
+        NEXT();
+    TARGET(SOLVE_LOOP)
+        if (solve_loop(program.counted_loops[ins->index])) {
+            if (watchdog.is_active() && !check_watchdog()) {
+                return;
+            }
+            pc = static_cast<std::size_t>(ins->imm);
+            DISPATCH();
+        }
+        NEXT();
+    TARGET(BAD_LINE)
+        runtime_error("invalid line number: " + std::to_string(ins->index));
+        return;
+#if !BASIC_VM_THREADED_DISPATCH
+    }
+    assert(0);
+#endif
+
+#undef TARGET
+#undef DISPATCH
+#undef NEXT
+#undef HIT
+#undef JUMP
+}
+
+std::shared_ptr<VariableEnv> VirtualMachine::get_var_env() const {
+    auto v_env = std::make_shared<VariableEnv>();
+    for (std::size_t slot = 0; slot < program.symbols.size(); ++slot) {
+        if (ref_times[slot] >= 0) {
+            v_env->var_env.emplace(
+                program.symbols[slot],
+                VariableEnv::EnvInformation{vars[slot], ref_times[slot]});
+        }
+    }
+    return v_env;
+}
+
+std::size_t VirtualMachine::on_back_edge(std::size_t header,
+                                         std::size_t latch) {
+    if (watchdog.is_active() && --until_check <= 0) {
+        until_check = WATCHDOG_PERIOD;
+        if (!check_watchdog()) {
+            return Program::NO_PC;
+        }
+    }
+    if (loop_detect_options.enabled && --until_sample <= 0) {
+        until_sample = loop_detect_options.sample_period;
+        if (sample_state(header)) {
+            runtime_error("infinite loop detected at line " +
+                          std::to_string(program.lines[header]));
+            return Program::NO_PC;
+        }
+    }
+    if (!jit_enabled) {
+        return header;
+    }
+
+    auto &entry = jit_entries[header];
+    if (!entry.region) {
+        if (entry.failed || ++entry.back_edges < tier_options.hot_threshold) {
+            return header;
+        }
+        auto start = std::chrono::steady_clock::now();
+        entry.region = jit_compile(program, header, latch + 1);
+        tier_stats.compile_time += std::chrono::steady_clock::now() - start;
+        if (!entry.region) {
+            entry.failed = true;
+            tier_stats.rejected++;
+            return header;
+        }
+        tier_stats.promoted++;
+        tier_stats.hot_lines.emplace_back(program.lines[header],
+                                          program.lines[latch]);
+    }
+
+    auto steps = jit_ctx.steps;
+    jit_ctx.fuel = watchdog.is_active()
+                       ? std::min(tier_options.native_fuel, WATCHDOG_PERIOD)
+                       : tier_options.native_fuel;
+    auto next = entry.region->run(jit_ctx);
+    tier_stats.native_entries++;
+    until_check -= static_cast<int>(
+        std::min<std::int64_t>(jit_ctx.steps - steps, WATCHDOG_PERIOD));
+    if (jit_ctx.steps == steps) {
+        // Some variable of the region is not defined yet. It may never be,
+        // e.g. if it is only assigned in a branch that isn't taken.
+        tier_stats.bails++;
+        if (++entry.bails >= tier_options.max_bails) {
+            entry.region.reset();
+            entry.failed = true;
+        }
+    }
+    return next;
+}
+
+bool VirtualMachine::sample_state(std::size_t pc) {
+    // FNV-1a over the pc and the variables. Hidden slots only keep values
+    // that can be computed again, so they are not part of the state.
+    auto num_vars = program.symbols.size();
+    std::uint64_t hash = 0xcbf29ce484222325;
+    auto mix = [&](std::uint64_t value) {
+        hash = (hash ^ value) * 0x100000001b3;
+    };
+    mix(pc);
+    for (std::size_t slot = 0; slot < num_vars; ++slot) {
+        mix(ref_times[slot] < 0
+                ? std::uint64_t{1} << 32
+                : static_cast<std::uint32_t>(vars[slot]));
+    }
+
+    if (!has_input && samples_saved > 0 && hash == saved_state.hash &&
+        pc == saved_state.pc &&
+        std::equal(vars.begin(), vars.begin() + num_vars,
+                   saved_state.vars.begin())) {
+        bool same = true;
+        for (std::size_t slot = 0; slot < num_vars && same; ++slot) {
+            same = (ref_times[slot] >= 0) == saved_state.defined[slot];
+        }
+        if (same) {
+            return true;
+        }
+    }
+
+    // Input makes the states before it useless, so start again.
+    if (has_input || samples_saved == 0 || samples_saved == power) {
+        if (!has_input && samples_saved != 0) {
+            power *= 2;
+        } else {
+            power = 1;
+        }
+        saved_state.pc = pc;
+        saved_state.hash = hash;
+        saved_state.vars.assign(vars.begin(), vars.begin() + num_vars);
+        saved_state.defined.resize(num_vars);
+        for (std::size_t slot = 0; slot < num_vars; ++slot) {
+            saved_state.defined[slot] = ref_times[slot] >= 0;
+        }
+        samples_saved = 0;
+        has_input = false;
+    }
+    ++samples_saved;
+    return false;
+}
+
+bool VirtualMachine::check_watchdog() {
+    auto reason = watchdog.check(steps + jit_ctx.steps);
+    if (reason.empty()) {
+        return true;
+    }
+    runtime_error(reason);
+    return false;
+}
+
+bool VirtualMachine::solve_loop(const CountedLoop &loop) {
+    for (const auto &[slot, times] : loop.reads) {
+        if (ref_times[slot] < 0) {
+            return false;
+        }
+    }
+    auto value_of = [&](const AffineExpr &expr, VarType counter) {
+        auto value = wrapping_add(wrapping_mul(expr.scale, counter),
+                                  expr.offset);
+        for (const auto &[slot, coeff] : expr.terms) {
+            value = wrapping_add(value, wrapping_mul(coeff, vars[slot]));
+        }
+        return value;
+    };
+    auto start = vars[loop.counter];
+    auto n = trip_count(start, loop.step, loop.cmp, value_of(loop.limit, 0));
+    if (!n) {
+        return false;
+    }
+    // Counts that would overflow are left to the loop.
+    for (const auto &[slot, times] : loop.reads) {
+        if (!has_room(ref_times[slot], *n * static_cast<unsigned>(times))) {
+            return false;
+        }
+    }
+    std::int64_t loop_steps = 0;
+    for (auto i = loop.begin; i < loop.end; ++i) {
+        auto pc = program.stm_pc[i];
+        if (pc != Program::NO_PC) {
+            if (!has_room(profile.hits[pc], *n)) {
+                return false;
+            }
+            loop_steps += static_cast<std::int64_t>(*n);
+        }
+    }
+    // A loop that would go past the statement limit runs step by step, to
+    // stop where the limit is.
+    if (!watchdog.allows_steps(steps + jit_ctx.steps + loop_steps)) {
+        return false;
+    }
+
+    // Sums of n terms, modulo 2^32. n < 2^32, so n * (n - 1) fits.
+    auto count = static_cast<VarType>(static_cast<std::uint32_t>(*n));
+    auto triangle =
+        static_cast<VarType>(static_cast<std::uint32_t>(*n * (*n - 1) / 2));
+    for (const auto &update : loop.updates) {
+        // The counter as the first iteration sees it.
+        auto first = update.stm > loop.counter_stm
+                         ? wrapping_add(start, loop.step)
+                         : start;
+        switch (update.kind) {
+        case CountedLoop::UpdateKind::ACCUMULATE: {
+            auto sum = wrapping_add(
+                wrapping_mul(count, value_of(update.value, first)),
+                wrapping_mul(wrapping_mul(update.value.scale, loop.step),
+                             triangle));
+            vars[update.var] = wrapping_add(vars[update.var], sum);
+            break;
+        }
+        case CountedLoop::UpdateKind::ASSIGN: {
+            auto last = wrapping_add(
+                first, wrapping_mul(wrapping_sub(count, 1), loop.step));
+            define(update.var, value_of(update.value, last));
+            break;
+        }
+        case CountedLoop::UpdateKind::NONE:
+            break;
+        }
+    }
+    vars[loop.counter] = wrapping_add(start, wrapping_mul(count, loop.step));
+
+    for (auto i = loop.begin; i < loop.end; ++i) {
+        auto pc = program.stm_pc[i];
+        if (pc != Program::NO_PC) {
+            profile.hits[pc] += static_cast<int>(*n);
+            steps += static_cast<std::int64_t>(*n);
+        }
+    }
+    // Every jump back but the last.
+    profile.taken[program.stm_pc[loop.end - 1]] += static_cast<int>(*n - 1);
+    for (const auto &[slot, times] : loop.reads) {
+        ref_times[slot] += static_cast<int>(*n) * times;
+    }
+    return true;
+}
+
+void VirtualMachine::define(std::uint32_t slot, VarType value) noexcept {
+    vars[slot] = value;
+    if (ref_times[slot] < 0) {
+        ref_times[slot] = 0;
+    }
+}
+
+void VirtualMachine::input(std::uint32_t slot) {
+    has_input = true;
+    std::string input_str = input_action_ref();
+    auto input_val = decode_int<VarType>(input_str);
+    if (watchdog.is_cancelled()) {
+        // The input was cut short to stop the run.
+        return;
+    }
+    if (input_str.empty()) {
+        runtime_error("empty input");
+    } else if (!all_of(begin(input_str), end(input_str), ::isdigit) ||
+               !input_val.has_value()) {
+        runtime_error("invalid input: " + input_str);
+    } else {
+        define(slot, input_val.value());
+    }
+}
+
+bool VirtualMachine::read_var(std::uint32_t slot, const SourceLoc &loc) {
+    if (ref_times[slot] < 0) {
+        log_error(err, loc.line, loc.column,
+                  "Undefined variable: " + program.symbols[slot]);
+        return false;
+    }
+    ref_times[slot]++;
+    return true;
+}
+
+void VirtualMachine::poison_reg(Reg reg) noexcept {
+    regs[reg] = 0;
+    poison[reg] = 1;
+    failed = true;
+}
+
+bool VirtualMachine::is_poisoned(Reg reg) const noexcept {
+    return failed && poison[reg];
+}
+
+void VirtualMachine::clear_poison() noexcept {
+    if (failed) {
+        std::fill(begin(poison), end(poison), 0);
+        failed = false;
+    }
+}
+
+void VirtualMachine::arithmetic_error(std::size_t pc, VarType lhs,
+                                      VarType rhs) {
+    std::stringstream err_ss{};
+    switch (program.code[pc].op) {
+    case OpCode::DIV:
+        err_ss << "Division by zero: " << lhs << " / " << rhs;
+        break;
+    case OpCode::MOD:
+        err_ss << "Modulus by zero: " << lhs << " MOD " << rhs;
+        break;
+    default:
+        err_ss << "Unsupported negative exponent: " << rhs;
+        break;
+    }
+    static_error(pc, err_ss.str());
+}
+
+void VirtualMachine::static_error(std::size_t pc, const std::string &msg) {
+    const auto &loc = program.locs[pc];
+    log_error(err, loc.line, loc.column, msg);
+}
+
+void VirtualMachine::runtime_error(std::string_view msg) {
+    err << "runtime error: " << msg << '\n';
+}
+
+void VirtualMachine::aot_undefined(void *host, std::uint32_t pc,
+                                   std::uint32_t slot, int rhs) {
+    auto *vm = static_cast<VirtualMachine *>(host);
+    const auto &loc =
+        rhs != 0 ? vm->program.rhs_locs.at(pc) : vm->program.locs[pc];
+    log_error(vm->err, loc.line, loc.column,
+              "Undefined variable: " + vm->program.symbols[slot]);
+}
+
+void VirtualMachine::aot_fail(void *host, std::uint32_t pc, VarType lhs,
+                              VarType rhs) {
+    auto *vm = static_cast<VirtualMachine *>(host);
+    const auto &ins = vm->program.code[pc];
+    if (ins.op == OpCode::BAD_LINE) {
+        vm->runtime_error("invalid line number: " +
+                          std::to_string(ins.index));
+    } else {
+        vm->arithmetic_error(pc, lhs, rhs);
+    }
+}
+
+void VirtualMachine::aot_print(void *host, VarType value) {
+    static_cast<VirtualMachine *>(host)->out << value << '\n';
+}
+
+void VirtualMachine::aot_input(void *host, std::uint32_t slot) {
+    static_cast<VirtualMachine *>(host)->input(slot);
+}
+
+int VirtualMachine::aot_solve_loop(void *host, std::uint32_t index) {
+    auto *vm = static_cast<VirtualMachine *>(host);
+    return vm->solve_loop(vm->program.counted_loops[index]) ? 1 : 0;
+}
+
+} // namespace basic_vm
@@ -12,7 +12,7 @@ InterpretVisitor::InterpretVisitor(
 }
 
 std::any InterpretVisitor::visitLineNum(BasicParser::LineNumContext *ctx) {
-    return static_cast<LSize>(std::stoi(ctx->INT()->getText()));
+    return static_cast<LSize>(ctx->value);
 }
 
 std::any InterpretVisitor::visitProg(BasicParser::ProgContext *ctx) {
@@ -22,10 +22,14 @@ std::any InterpretVisitor::visitProg(BasicParser::ProgContext *ctx) {
     }
     std::map<LSize, BasicParser::StmContext *> stm_list{};
     std::map<LSize, std::string> comment_list{}; // Trimmed
+    resolved.assign(symbols ? symbols->size() : 0, nullptr);
 
     for (auto stm0 : stm0_list) {
         LSize line_num = std::any_cast<LSize>(visit(stm0->line_num()));
-        if (stm0->stm()) {
+        if (!stm0->valid) {
+            // Executed as a no-op.
+            stm_list.insert({line_num, nullptr});
+        } else if (stm0->stm()) {
             stm_list.insert({line_num, stm0->stm()});
         } else if (stm0->COMMENT()) {
             auto comment = stm0->COMMENT()->getText();
@@ -54,8 +58,20 @@ std::any InterpretVisitor::visitProg(BasicParser::ProgContext *ctx) {
         return std::min(nl_it_stm->first, nl_it_cmt->first);
     };
 
+    // Statements between two checks of the watchdog.
+    constexpr int WATCHDOG_PERIOD = 1024;
+    std::int64_t steps = 0;
+    watchdog.start();
+
     // Interpret
     for (LSize cur_line = begin(stm_list)->first; cur_line != 0;) {
+        if (watchdog.is_active() &&
+            (++steps % WATCHDOG_PERIOD == 0 || watchdog.is_cancelled())) {
+            if (auto reason = watchdog.check(steps); !reason.empty()) {
+                runtime_error(reason);
+                break;
+            }
+        }
 
         if (comment_list.find(cur_line) == end(comment_list) &&
             stm_list.find(cur_line) == end(stm_list)) {
@@ -70,6 +86,10 @@ std::any InterpretVisitor::visitProg(BasicParser::ProgContext *ctx) {
         }
 
         auto stm_to_visit = stm_list.at(cur_line);
+        if (stm_to_visit == nullptr) {
+            cur_line = get_next_line(cur_line);
+            continue;
+        }
         // The statement may return a line number, which indicates the change of
         // control flow.
         auto maybe_nl = visit(stm_to_visit);
@@ -90,16 +110,16 @@ std::any InterpretVisitor::visitEndStm(BasicParser::EndStmContext *ctx) {
 }
 std::any InterpretVisitor::visitGotoStm(BasicParser::GotoStmContext *ctx) {
     ctx->exec_times++;
-    return static_cast<LSize>(std::stoi(ctx->INT()->getText()));
+    return static_cast<LSize>(ctx->target);
 }
 std::any InterpretVisitor::visitIfStm(BasicParser::IfStmContext *ctx) {
-    auto left_expr = visit(ctx->expr(0));
-    auto right_expr = visit(ctx->expr(1));
-    if (!(left_expr.has_value() && right_expr.has_value())) {
+    auto left_expr = evaluate(ctx->expr(0));
+    auto right_expr = evaluate(ctx->expr(1));
+    if (!(left_expr.ok && right_expr.ok)) {
         return {};
     }
-    auto left_expr_res = unwrap_val(left_expr);
-    auto right_expr_res = unwrap_val(right_expr);
+    auto left_expr_res = left_expr.value;
+    auto right_expr_res = right_expr.value;
     bool cond{};
     if (ctx->cmp_op()->EQUAL()) {
         cond = left_expr_res == right_expr_res;
@@ -111,7 +131,7 @@ std::any InterpretVisitor::visitIfStm(BasicParser::IfStmContext *ctx) {
 
     if (cond) {
         ctx->true_times++;
-        return static_cast<LSize>(std::stoi(ctx->INT()->getText()));
+        return static_cast<LSize>(ctx->target);
     } else {
         ctx->false_times++;
     }
@@ -119,172 +139,153 @@ std::any InterpretVisitor::visitIfStm(BasicParser::IfStmContext *ctx) {
     return {};
 }
 std::any InterpretVisitor::visitPrintStm(BasicParser::PrintStmContext *ctx) {
-    auto val = visit(ctx->expr());
-    if (!val.has_value()) {
+    auto val = evaluate(ctx->expr());
+    if (!val.ok) {
         return {};
     }
-    out << unwrap_val(val) << '\n';
+    out << val.value << '\n';
     return {};
 }
 std::any InterpretVisitor::visitInputStm(BasicParser::InputStmContext *ctx) {
-    auto id = parseId(ctx->ID());
-
     std::string input_str = input_action_ref();
+    auto input_val = decode_int<VarType>(input_str);
+    if (watchdog.is_cancelled()) {
+        // The input was cut short to stop the run.
+        return {};
+    }
     if (input_str.empty()) {
         runtime_error("empty input");
-    } else if (!all_of(begin(input_str), end(input_str), ::isdigit)) {
+    } else if (!all_of(begin(input_str), end(input_str), ::isdigit) ||
+               !input_val.has_value()) {
         runtime_error("invalid input: " + input_str);
     } else {
-        v_env->enter(id, std::stoi(input_str));
+        enter(ctx->slot, input_val.value());
     }
     return {};
 }
 std::any InterpretVisitor::visitLetStm(BasicParser::LetStmContext *ctx) {
     ctx->exec_times++;
-    auto val = visit(ctx->expr());
-    if (!val.has_value()) {
+    auto val = evaluate(ctx->expr());
+    if (!val.ok) {
         return {};
     }
-    auto id = parseId(ctx->ID());
-    v_env->enter(id, unwrap_val(val));
+    enter(ctx->slot, val.value);
     return {};
 }
-std::any InterpretVisitor::visitPowerExpr(BasicParser::PowerExprContext *ctx) {
-    auto maybe_base = visit(ctx->expr(0));
-    auto maybe_exponent = visit(ctx->expr(1));
+auto InterpretVisitor::evaluate(BasicParser::ExprContext *ctx) -> EvalResult {
+    auto binary = [&](auto *binary_ctx) {
+        return evaluateBinary(binary_ctx->expr(0), binary_ctx->expr(1),
+                              static_cast<ExprAlt>(ctx->alt));
+    };
 
-    if (!(maybe_exponent.has_value() && maybe_base.has_value())) {
-        return {};
+    switch (static_cast<ExprAlt>(ctx->alt)) {
+    case ExprAlt::INT:
+        return {ctx->value, true};
+    case ExprAlt::VAR:
+        return evaluateVar(static_cast<BasicParser::VarExprContext *>(ctx));
+    case ExprAlt::NEG: {
+        auto val =
+            evaluate(static_cast<BasicParser::NegExprContext *>(ctx)->expr());
+        return {wrapping_neg(val.value), val.ok};
     }
-
-    auto base = unwrap_val(maybe_base);
-    auto exponent = unwrap_val(maybe_exponent);
-
-    if (exponent < 0) {
-        auto wrong_token = ctx->expr(1)->getStart();
-        std::stringstream err_ss{};
-        err_ss << "Unsupported negative exponent: " << exponent;
-        static_error(wrong_token, err_ss.str());
+    case ExprAlt::PAREN:
+        return evaluate(
+            static_cast<BasicParser::ParenExprContext *>(ctx)->expr());
+    case ExprAlt::POWER:
+        return binary(static_cast<BasicParser::PowerExprContext *>(ctx));
+    case ExprAlt::MULT:
+        return binary(static_cast<BasicParser::MultExprContext *>(ctx));
+    case ExprAlt::DIV:
+        return binary(static_cast<BasicParser::DivExprContext *>(ctx));
+    case ExprAlt::MOD:
+        return binary(static_cast<BasicParser::ModExprContext *>(ctx));
+    case ExprAlt::PLUS:
+        return binary(static_cast<BasicParser::PlusExprContext *>(ctx));
+    case ExprAlt::MINUS:
+        return binary(static_cast<BasicParser::MinusExprContext *>(ctx));
+    default:
+        assert(0);
         return {};
     }
-
-    return quickPower(base, exponent);
 }
-std::any InterpretVisitor::visitDivExpr(BasicParser::DivExprContext *ctx) {
-    auto maybe_dividend = visit(ctx->expr(0));
-    auto maybe_divisor = visit(ctx->expr(1));
-    if (!(maybe_dividend.has_value() && maybe_divisor.has_value())) {
-        return {};
-    }
-    auto dividend = unwrap_val(maybe_dividend);
-    auto divisor = unwrap_val(maybe_divisor);
-    if (divisor == 0) {
-        auto wrong_token = ctx->expr(1)->getStart();
+auto InterpretVisitor::evaluateVar(BasicParser::VarExprContext *ctx)
+    -> EvalResult {
+    auto info = resolve(ctx->slot);
+    if (info == nullptr) {
         std::stringstream err_ss{};
-        err_ss << "Division by zero: " << dividend << " / " << divisor;
-        static_error(wrong_token, err_ss.str());
+        err_ss << "Undefined variable: " << (*symbols)[ctx->slot];
+        static_error(ctx->ID()->getSymbol(), err_ss.str());
         return {};
     }
-
-    return dividend / divisor;
-}
-std::any InterpretVisitor::visitPlusExpr(BasicParser::PlusExprContext *ctx) {
-    auto left_operand = visit(ctx->expr(0));
-    auto right_operand = visit(ctx->expr(1));
-
-    if (!(left_operand.has_value() && right_operand.has_value())) {
-        return {};
-    }
-
-    return unwrap_val(left_operand) + unwrap_val(right_operand);
-}
-std::any InterpretVisitor::visitMinusExpr(BasicParser::MinusExprContext *ctx) {
-    auto left_operand = visit(ctx->expr(0));
-    auto right_operand = visit(ctx->expr(1));
-
-    if (!(left_operand.has_value() && right_operand.has_value())) {
+    info->second++;
+    return {info->first, true};
+}
+auto InterpretVisitor::evaluateBinary(BasicParser::ExprContext *lhs_ctx,
+                                      BasicParser::ExprContext *rhs_ctx,
+                                      ExprAlt op) -> EvalResult {
+    auto lhs = evaluate(lhs_ctx);
+    auto rhs = evaluate(rhs_ctx);
+    if (!(lhs.ok && rhs.ok)) {
         return {};
     }
 
-    return unwrap_val(left_operand) - unwrap_val(right_operand);
-}
-std::any InterpretVisitor::visitMultExpr(BasicParser::MultExprContext *ctx) {
-    auto left_operand = visit(ctx->expr(0));
-    auto right_operand = visit(ctx->expr(1));
-
-    if (!(left_operand.has_value() && right_operand.has_value())) {
-        return {};
-    }
-
-    return unwrap_val(left_operand) * unwrap_val(right_operand);
-}
-std::any InterpretVisitor::visitIntExpr(BasicParser::IntExprContext *ctx) {
-    auto int_str = ctx->INT()->getText();
-    return std::stoi(int_str);
-}
-std::any InterpretVisitor::visitVarExpr(BasicParser::VarExprContext *ctx) {
-    auto var_name = parseId(ctx->ID());
-    if (!v_env->exist(var_name)) {
-        auto wrong_token = ctx->ID()->getSymbol();
-        std::stringstream err_ss{};
-        err_ss << "Undefined variable: " << var_name;
-        static_error(wrong_token, err_ss.str());
-        return {};
-    } else {
-        return v_env->lookup(var_name).value();
-    }
-}
-std::any InterpretVisitor::visitNegExpr(BasicParser::NegExprContext *ctx) {
-    auto val = visit(ctx->expr());
-    if (!val.has_value()) {
+    switch (op) {
+    case ExprAlt::PLUS:
+        return {wrapping_add(lhs.value, rhs.value), true};
+    case ExprAlt::MINUS:
+        return {wrapping_sub(lhs.value, rhs.value), true};
+    case ExprAlt::MULT:
+        return {wrapping_mul(lhs.value, rhs.value), true};
+    case ExprAlt::DIV:
+        if (rhs.value == 0) {
+            std::stringstream err_ss{};
+            err_ss << "Division by zero: " << lhs.value << " / " << rhs.value;
+            static_error(rhs_ctx->getStart(), err_ss.str());
+            return {};
+        }
+        return {wrapping_div(lhs.value, rhs.value), true};
+    case ExprAlt::MOD:
+        if (rhs.value == 0) {
+            std::stringstream err_ss{};
+            err_ss << "Modulus by zero: " << lhs.value << " MOD "
+                   << rhs.value;
+            static_error(rhs_ctx->getStart(), err_ss.str());
+            return {};
+        }
+        return {modulo_of(lhs.value, rhs.value), true};
+    case ExprAlt::POWER:
+        if (rhs.value < 0) {
+            std::stringstream err_ss{};
+            err_ss << "Unsupported negative exponent: " << rhs.value;
+            static_error(rhs_ctx->getStart(), err_ss.str());
+            return {};
+        }
+        return {power_of(lhs.value, rhs.value), true};
+    default:
+        assert(0);
         return {};
     }
-    return -unwrap_val(val);
 }
-std::any InterpretVisitor::visitModExpr(BasicParser::ModExprContext *ctx) {
-    auto maybe_dividend = visit(ctx->expr(0));
-    auto maybe_quotient = visit(ctx->expr(1));
-
-    if (!(maybe_dividend.has_value() && maybe_quotient.has_value())) {
-        return {};
-    }
-
-    auto dividend = unwrap_val(maybe_dividend);
-    auto quotient = unwrap_val(maybe_quotient);
-
-    if (quotient == 0) {
-        auto wrong_token = ctx->expr(1)->getStart();
-        std::stringstream err_ss{};
-        err_ss << "Modulus by zero: " << dividend << " MOD " << quotient;
-        static_error(wrong_token, err_ss.str());
-        return {};
-    }
-
-    if (quotient * dividend < 0) {
-        dividend -= (dividend / quotient - 1) * quotient;
+auto InterpretVisitor::resolve(unsigned slot) -> VariableEnv::EnvInformation * {
+    auto &info = resolved[slot];
+    if (info == nullptr) {
+        auto it = v_env->var_env.find((*symbols)[slot]);
+        if (it != end(v_env->var_env)) {
+            info = &it->second;
+        }
     }
-
-    return dividend % quotient;
-}
-std::any InterpretVisitor::visitParenExpr(BasicParser::ParenExprContext *ctx) {
-    return visit(ctx->expr());
+    return info;
 }
-VarType InterpretVisitor::unwrap_val(std::any val) noexcept {
-    return std::any_cast<VarType>(val);
-}
-std::string InterpretVisitor::parseId(tree::TerminalNode *node) noexcept {
-    return node->getText();
-}
-VarType InterpretVisitor::quickPower(VarType base, VarType exponent) noexcept {
-    VarType result = 1;
-    while (exponent > 0) {
-        if (exponent & 1) {
-            result *= base;
-        }
-        base *= base;
-        exponent >>= 1;
+void InterpretVisitor::enter(unsigned slot, VarType value) {
+    if (auto info = resolve(slot)) {
+        info->first = value;
+        return;
     }
-    return result;
+    auto it = v_env->var_env
+                  .emplace((*symbols)[slot],
+                           VariableEnv::EnvInformation{value, 0})
+                  .first;
+    resolved[slot] = &it->second;
 }
 void InterpretVisitor::static_error(Token *wrong_token,
                                     const std::string &msg) {
@@ -446,4 +447,213 @@ std::any ASTConstructVisitor::visitErrStm(BasicParser::ErrStmContext *ctx) {
     ast_newline();
     return {};
 }
-} // namespace basic_visitor
\ No newline at end of file
+
+DecodeVisitor::DecodeVisitor(std::ostream &err) noexcept : err(err) {
+}
+std::any DecodeVisitor::visitStm0(BasicParser::Stm0Context *ctx) {
+    valid = true;
+    visitChildren(ctx);
+    ctx->valid = valid;
+    return {};
+}
+std::any DecodeVisitor::visitLineNum(BasicParser::LineNumContext *ctx) {
+    ctx->value = decode<LSize>(ctx->INT(), "Line number");
+    return {};
+}
+std::any DecodeVisitor::visitGotoStm(BasicParser::GotoStmContext *ctx) {
+    ctx->target = decode<LSize>(ctx->INT(), "Line number");
+    return {};
+}
+std::any DecodeVisitor::visitIfStm(BasicParser::IfStmContext *ctx) {
+    visitChildren(ctx);
+    ctx->target = decode<LSize>(ctx->INT(), "Line number");
+    return {};
+}
+std::any DecodeVisitor::visitLetStm(BasicParser::LetStmContext *ctx) {
+    ctx->slot = intern(ctx->ID()->getText());
+    return visitChildren(ctx);
+}
+std::any DecodeVisitor::visitInputStm(BasicParser::InputStmContext *ctx) {
+    ctx->slot = intern(ctx->ID()->getText());
+    return {};
+}
+std::any DecodeVisitor::visitIntExpr(BasicParser::IntExprContext *ctx) {
+    ctx->alt = static_cast<int>(ExprAlt::INT);
+    ctx->value = decode<VarType>(ctx->INT(), "Integer literal");
+    return {};
+}
+std::any DecodeVisitor::visitVarExpr(BasicParser::VarExprContext *ctx) {
+    ctx->alt = static_cast<int>(ExprAlt::VAR);
+    ctx->slot = intern(ctx->ID()->getText());
+    return {};
+}
+std::any DecodeVisitor::visitNegExpr(BasicParser::NegExprContext *ctx) {
+    return decode_alt(ctx, ExprAlt::NEG);
+}
+std::any DecodeVisitor::visitParenExpr(BasicParser::ParenExprContext *ctx) {
+    return decode_alt(ctx, ExprAlt::PAREN);
+}
+std::any DecodeVisitor::visitPowerExpr(BasicParser::PowerExprContext *ctx) {
+    return decode_alt(ctx, ExprAlt::POWER);
+}
+std::any DecodeVisitor::visitMultExpr(BasicParser::MultExprContext *ctx) {
+    return decode_alt(ctx, ExprAlt::MULT);
+}
+std::any DecodeVisitor::visitDivExpr(BasicParser::DivExprContext *ctx) {
+    return decode_alt(ctx, ExprAlt::DIV);
+}
+std::any DecodeVisitor::visitModExpr(BasicParser::ModExprContext *ctx) {
+    return decode_alt(ctx, ExprAlt::MOD);
+}
+std::any DecodeVisitor::visitPlusExpr(BasicParser::PlusExprContext *ctx) {
+    return decode_alt(ctx, ExprAlt::PLUS);
+}
+std::any DecodeVisitor::visitMinusExpr(BasicParser::MinusExprContext *ctx) {
+    return decode_alt(ctx, ExprAlt::MINUS);
+}
+unsigned DecodeVisitor::intern(const std::string &name) {
+    auto it = symbol_ids.find(name);
+    if (it != end(symbol_ids)) {
+        return it->second;
+    }
+    auto slot = static_cast<unsigned>(symbols.size());
+    symbols.push_back(name);
+    symbol_ids.emplace(name, slot);
+    return slot;
+}
+
+basic_vm::Module LowerVisitor::lower(BasicParser::ProgContext *ctx) {
+    module = {};
+    stm_ctx.clear();
+
+    // Order the statements by line number. If a line number appears twice,
+    // the first one wins, as in `InterpretVisitor::visitProg`.
+    std::map<LSize, BasicParser::Stm0Context *> stm0_list{};
+    for (auto stm0 : ctx->stm0()) {
+        stm0_list.emplace(static_cast<LSize>(stm0->line_num()->value), stm0);
+    }
+
+    for (auto [line_num, stm0] : stm0_list) {
+        basic_vm::Stm stm{};
+        if (!stm0->valid) {
+            stm.kind = basic_vm::StmKind::ERROR;
+        } else if (stm0->stm()) {
+            stm = std::any_cast<basic_vm::Stm>(visit(stm0->stm()));
+        } else {
+            stm.kind = basic_vm::StmKind::REM;
+        }
+        stm.line = line_num;
+        module.stms.push_back(stm);
+        stm_ctx.push_back(stm0->stm());
+    }
+
+    return std::move(module);
+}
+
+void LowerVisitor::write_back(const std::vector<int> &hits,
+                              const std::vector<int> &taken) const {
+    for (std::size_t i = 0; i < stm_ctx.size(); ++i) {
+        if (stm_ctx[i] == nullptr) {
+            // A comment.
+            continue;
+        }
+        auto stm = stm_ctx[i];
+        if (auto let_stm = stm->let_stm()) {
+            let_stm->exec_times = hits[i];
+        } else if (auto goto_stm = stm->goto_stm()) {
+            goto_stm->exec_times = hits[i];
+        } else if (auto if_stm = stm->if_stm()) {
+            if_stm->true_times = taken[i];
+            if_stm->false_times = hits[i] - taken[i];
+        }
+    }
+}
+
+std::any LowerVisitor::visitEndStm(BasicParser::EndStmContext *ctx) {
+    return basic_vm::Stm{basic_vm::StmKind::END};
+}
+std::any LowerVisitor::visitErrStm(BasicParser::ErrStmContext *ctx) {
+    return basic_vm::Stm{basic_vm::StmKind::ERROR};
+}
+std::any LowerVisitor::visitGotoStm(BasicParser::GotoStmContext *ctx) {
+    basic_vm::Stm stm{basic_vm::StmKind::GOTO};
+    stm.target = static_cast<LSize>(ctx->target);
+    return stm;
+}
+std::any LowerVisitor::visitIfStm(BasicParser::IfStmContext *ctx) {
+    basic_vm::Stm stm{basic_vm::StmKind::IF};
+    stm.expr = lowerExpr(ctx->expr(0));
+    stm.rhs = lowerExpr(ctx->expr(1));
+    if (ctx->cmp_op()->EQUAL()) {
+        stm.cmp = basic_vm::CmpOp::EQ;
+    } else if (ctx->cmp_op()->GT()) {
+        stm.cmp = basic_vm::CmpOp::GT;
+    } else if (ctx->cmp_op()->LT()) {
+        stm.cmp = basic_vm::CmpOp::LT;
+    }
+    stm.target = static_cast<LSize>(ctx->target);
+    return stm;
+}
+std::any LowerVisitor::visitPrintStm(BasicParser::PrintStmContext *ctx) {
+    basic_vm::Stm stm{basic_vm::StmKind::PRINT};
+    stm.expr = lowerExpr(ctx->expr());
+    return stm;
+}
+std::any LowerVisitor::visitInputStm(BasicParser::InputStmContext *ctx) {
+    basic_vm::Stm stm{basic_vm::StmKind::INPUT};
+    stm.var = module.intern(ctx->ID()->getText());
+    return stm;
+}
+std::any LowerVisitor::visitLetStm(BasicParser::LetStmContext *ctx) {
+    basic_vm::Stm stm{basic_vm::StmKind::LET};
+    stm.var = module.intern(ctx->ID()->getText());
+    stm.expr = lowerExpr(ctx->expr());
+    return stm;
+}
+std::any LowerVisitor::visitPowerExpr(BasicParser::PowerExprContext *ctx) {
+    return lowerBinaryOpExpr(ctx, basic_vm::ExprKind::POW);
+}
+std::any LowerVisitor::visitDivExpr(BasicParser::DivExprContext *ctx) {
+    return lowerBinaryOpExpr(ctx, basic_vm::ExprKind::DIV);
+}
+std::any LowerVisitor::visitPlusExpr(BasicParser::PlusExprContext *ctx) {
+    return lowerBinaryOpExpr(ctx, basic_vm::ExprKind::ADD);
+}
+std::any LowerVisitor::visitMinusExpr(BasicParser::MinusExprContext *ctx) {
+    return lowerBinaryOpExpr(ctx, basic_vm::ExprKind::SUB);
+}
+std::any LowerVisitor::visitMultExpr(BasicParser::MultExprContext *ctx) {
+    return lowerBinaryOpExpr(ctx, basic_vm::ExprKind::MUL);
+}
+std::any LowerVisitor::visitIntExpr(BasicParser::IntExprContext *ctx) {
+    basic_vm::Expr expr{basic_vm::ExprKind::CONST};
+    expr.operand = ctx->value;
+    return module.add_expr(expr);
+}
+std::any LowerVisitor::visitVarExpr(BasicParser::VarExprContext *ctx) {
+    basic_vm::Expr expr{basic_vm::ExprKind::VAR};
+    expr.operand =
+        static_cast<VarType>(module.intern(ctx->ID()->getText()));
+    expr.loc = token_loc(ctx->ID()->getSymbol());
+    return module.add_expr(expr);
+}
+std::any LowerVisitor::visitNegExpr(BasicParser::NegExprContext *ctx) {
+    basic_vm::Expr expr{basic_vm::ExprKind::NEG};
+    expr.lhs = lowerExpr(ctx->expr());
+    return module.add_expr(expr);
+}
+std::any LowerVisitor::visitModExpr(BasicParser::ModExprContext *ctx) {
+    return lowerBinaryOpExpr(ctx, basic_vm::ExprKind::MOD);
+}
+std::any LowerVisitor::visitParenExpr(BasicParser::ParenExprContext *ctx) {
+    return lowerExpr(ctx->expr());
+}
+basic_vm::ExprId LowerVisitor::lowerExpr(BasicParser::ExprContext *ctx) {
+    return std::any_cast<basic_vm::ExprId>(visit(ctx));
+}
+basic_vm::SourceLoc LowerVisitor::token_loc(Token *token) noexcept {
+    return {static_cast<LSize>(token->getLine()),
+            static_cast<CSize>(token->getCharPositionInLine() + 1)};
+}
+
+} // namespace basic_visitor
@@ -0,0 +1,21 @@
+#include "Watchdog.h"
+
+namespace basic_vm {
+
+std::string Watchdog::check(std::int64_t steps) const {
+    if (is_cancelled()) {
+        return "stopped";
+    }
+    if (budget.max_steps > 0 && steps > budget.max_steps) {
+        return "statement limit exceeded: " +
+               std::to_string(budget.max_steps) + " statements";
+    }
+    if (budget.max_time.count() > 0 &&
+        std::chrono::steady_clock::now() - start_time > budget.max_time) {
+        return "time limit exceeded: " +
+               std::to_string(budget.max_time.count()) + " ms";
+    }
+    return {};
+}
+
+} // namespace basic_vm
@@ -1,5 +1,7 @@
 #include "Fragment.h"
 
+#include <atomic>
+
 namespace basic {
 
 Fragment::Fragment() {
@@ -38,6 +40,7 @@ Fragment::Fragment(const Fragment &other) noexcept
 
 Fragment::Fragment(Fragment &&other) noexcept
     : lines_(std::move(other.lines_)), delimiter_(std::move(other.delimiter_)) {
+    other.revision_ = next_revision_();
 }
 
 bool Fragment::insert(LSize pos, const std::string &line) noexcept {
@@ -51,6 +54,7 @@ bool Fragment::insert(LSize pos, const std::string &line) noexcept {
         return false;
     }
     lines_.insert({pos, line});
+    revision_ = next_revision_();
     return true;
 }
 
@@ -62,6 +66,7 @@ bool Fragment::append(const std::string &line) noexcept {
     if (lines_.empty()) {
         // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers)
         lines_.insert({100, line});
+        revision_ = next_revision_();
         return true;
     }
     const auto last_line_num = lines_.rbegin()->first;
@@ -69,11 +74,16 @@ bool Fragment::append(const std::string &line) noexcept {
     // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers)
     auto next_line_num = (last_line_num / 10 + 1) * 10;
     lines_.insert({next_line_num, line});
+    revision_ = next_revision_();
     return true;
 }
 
 bool Fragment::remove(LSize pos) noexcept {
-    return lines_.erase(pos) == 1;
+    if (lines_.erase(pos) == 0) {
+        return false;
+    }
+    revision_ = next_revision_();
+    return true;
 }
 
 std::string Fragment::render() const {
@@ -103,6 +113,13 @@ std::optional<LSize> Fragment::get_line_number_at(
     return next(begin(lines_), static_cast<int>(pos - 1))->first;
 }
 
+std::uint64_t Fragment::next_revision_() noexcept {
+    // Fragments are edited on several threads, e.g. by the GUI and by the
+    // interpreter when it replaces bad lines.
+    static std::atomic<std::uint64_t> last{0};
+    return ++last;
+}
+
 auto Fragment::get_iter_(LSize pos) const -> LineConstIter {
     return lines_.find(pos);
 }
@@ -40,12 +40,16 @@ main: prog EOF;
 /** stm0: statement with the line number and a new line */
 prog: stm0*;
 
-/** Greedy: try to match a statement */
-stm0:
+/** Greedy: try to match a statement.
+ valid: false if a literal of the statement is out of range */
+stm0
+	returns[bool valid = true]:
 	line_num stm NL // "\n" or "\r\n" is necessary
 	| line_num COMMENT; // Match a comment.
 
-line_num: INT # LineNum;
+/** value: the decoded line number (basic::LSize) */
+line_num
+	returns[unsigned value = 0]: INT # LineNum;
 
 stm:
 	let_stm
@@ -58,20 +62,26 @@ stm:
 
 empty_stm: NL;
 
+/** slot: the interned name of the variable, for the tree walker */
 let_stm
-	returns[int exec_times=0]: LET ID EQUAL expr # LetStm;
+	returns[int exec_times=0, unsigned slot=0]: LET ID EQUAL expr # LetStm;
 print_stm: PRINT expr # PrintStm;
-input_stm: INPUT ID # InputStm;
+input_stm
+	returns[unsigned slot=0]: INPUT ID # InputStm;
 goto_stm
-	returns[int exec_times=0]: GOTO INT # GotoStm;
+	returns[int exec_times=0, unsigned target=0]: GOTO INT # GotoStm;
 cmp_op: EQUAL | LT | GT;
 if_stm
-	returns[int true_times=0, int false_times=0]:
+	returns[int true_times=0, int false_times=0, unsigned target=0]:
 	IF expr cmp_op expr THEN INT # IfStm;
 end_stm: END # EndStm;
 error_stm: ERROR # ErrStm;
 
-expr:
+/** value: the decoded literal of an IntExpr (basic::VarType)
+ alt: the labeled alternative (basic_visitor::ExprAlt)
+ slot: the interned name of a VarExpr, for the tree walker */
+expr
+	returns[int value = 0, int alt = 0, unsigned slot = 0]:
 	MINUS expr							# NegExpr
 	| <assoc = right> expr POWER expr	# PowerExpr
 	| expr MULT expr					# MultExpr
@@ -5,26 +5,57 @@
 #include <QFileDialog>
 #include <QKeyEvent>
 #include <QPushButton>
+#include <QTextCursor>
 #include <QThread>
+#include <QTimer>
 #include <fstream>
 
 namespace basic {
 
 MainWindow::MainWindow(QWidget *parent)
     : QWidget{parent}, ui{new Ui::Window{}}, frag{std::make_shared<Fragment>()},
-      frag_mini{std::make_shared<Fragment>()} {
+      session{std::make_shared<Session>()},
+      input_channel{std::make_shared<InputChannel>()},
+      output_channel{std::make_shared<OutputChannel>()} {
 
     this->ui->setupUi(this);
 
     connect(this->ui->btn_run, &QPushButton::clicked, this, &MainWindow::run);
+    connect(this->ui->btn_stop, &QPushButton::clicked, this, &MainWindow::stop);
     connect(this->ui->btn_load, &QPushButton::clicked, this, &MainWindow::load);
     connect(this->ui->btn_clear, &QPushButton::clicked, this,
             &MainWindow::clear);
 
+    exec_thread = new QThread{this};
+    worker = new QBInterpreterWorker{input_channel, output_channel};
+    worker->moveToThread(exec_thread);
+    connect(worker, &QBInterpreterWorker::resultReady, this,
+            &MainWindow::workerFinish);
+    connect(worker, &QBInterpreterWorker::requestInput, this, [this]() {
+        this->ui->input->setText("? ");
+        this->ui->input->setFocus();
+        this->is_inputting = true;
+    });
+    connect(exec_thread, &QThread::finished, worker, &QObject::deleteLater);
+    exec_thread->start();
+
+    output_timer = new QTimer{this};
+    // About one frame at 60 Hz.
+    output_timer->setInterval(16);
+    connect(output_timer, &QTimer::timeout, this, &MainWindow::showOutput);
+
     // Focus the cursor to the command line input.
     this->ui->input->setFocus();
 }
 
+MainWindow::~MainWindow() {
+    // A running program would keep the thread from quitting.
+    stop();
+    exec_thread->quit();
+    exec_thread->wait();
+    delete ui;
+}
+
 void MainWindow::execute(std::string_view command) {
 
     std::stringstream cmd_ss{std::string{command}};
@@ -53,9 +84,7 @@ void MainWindow::execute(std::string_view command) {
     auto maybe_mini_cmd = getMiniBasicCmd(cmd);
 
     if (maybe_mini_cmd.has_value()) {
-        auto mini_cmd = maybe_mini_cmd.value();
-        frag_mini->append(std::string{command});
-        doRun(frag_mini);
+        doRun(session, std::string{command});
         return;
     }
 
@@ -65,6 +94,9 @@ void MainWindow::execute(std::string_view command) {
     case CommandType::RUN:
         run();
         break;
+    case CommandType::STOP:
+        stop();
+        break;
     case CommandType::LOAD:
         load();
         break;
@@ -88,6 +120,8 @@ void MainWindow::execute(std::string_view command) {
 auto MainWindow::getCommandType(std::string_view command) -> CommandType {
     if (command == "RUN") {
         return CommandType::RUN;
+    } else if (command == "STOP") {
+        return CommandType::STOP;
     } else if (command == "LOAD") {
         return CommandType::LOAD;
     } else if (command == "LIST") {
@@ -119,27 +153,71 @@ void MainWindow::run() {
     doRun(this->frag);
 }
 
-void MainWindow::doRun(std::shared_ptr<Fragment> frag) {
-    QThread *thread = new QThread{};
-    QBInterpreterWorker *worker = new QBInterpreterWorker{frag, this};
-    worker->moveToThread(thread);
+void MainWindow::stop() {
+    if (!is_runnning) {
+        return;
+    }
+    cancel_token->cancel();
+    // The worker may be waiting for input.
+    input_channel->wake();
+    if (is_inputting) {
+        is_inputting = false;
+        this->ui->input->clear();
+    }
+}
 
-    connect(thread, &QThread::started, worker, &QBInterpreterWorker::doWork);
-    connect(worker, &QBInterpreterWorker::resultReady, this,
-            &MainWindow::workerFinish);
-    connect(worker, &QBInterpreterWorker::requestInput, [this]() {
-        this->ui->input->setText("? ");
-        this->ui->input->setFocus();
-        this->is_inputting = true;
-    });
+void MainWindow::doRun(std::shared_ptr<Fragment> frag) {
+    // One run at a time, so that Stop always reaches the running one.
+    if (is_runnning) {
+        return;
+    }
+    startRun();
+    // Queued to the worker's thread, which runs one request at a time.
+    QMetaObject::invokeMethod(
+        worker,
+        [worker = worker, frag = std::move(frag), token = cancel_token]() {
+            worker->runProgram(frag, token);
+        },
+        Qt::QueuedConnection);
+}
 
-    // Each thread is responsible for only one worker. After the worker
-    // finishes, the thread shuts down, and the resource is released later.
-    connect(worker, &QBInterpreterWorker::resultReady, thread, &QThread::quit);
-    connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+void MainWindow::doRun(std::shared_ptr<Session> session, std::string command) {
+    if (is_runnning) {
+        return;
+    }
+    startRun();
+    QMetaObject::invokeMethod(
+        worker,
+        [worker = worker, session = std::move(session),
+         command = std::move(command), token = cancel_token]() {
+            worker->runCommand(session, command, token);
+        },
+        Qt::QueuedConnection);
+}
 
+void MainWindow::startRun() {
+    cancel_token = std::make_shared<basic_vm::CancelToken>();
     is_runnning = true;
-    thread->start();
+    this->ui->btn_stop->setEnabled(true);
+    this->ui->btn_run->setEnabled(false);
+    this->ui->btn_load->setEnabled(false);
+    this->ui->btn_clear->setEnabled(false);
+
+    this->ui->result_browser->setPlainText("Output:\n");
+    has_output = false;
+    output_timer->start();
+}
+
+void MainWindow::showOutput() {
+    auto chunk = output_channel->take();
+    if (chunk.empty()) {
+        return;
+    }
+    has_output = true;
+    // Append at the end, without setting the whole text again.
+    QTextCursor cursor{this->ui->result_browser->document()};
+    cursor.movePosition(QTextCursor::End);
+    cursor.insertText(QString::fromStdString(chunk));
 }
 
 void MainWindow::load() {
@@ -160,8 +238,14 @@ void MainWindow::list() {
 }
 
 void MainWindow::clear() {
+    // The worker may be using the session, e.g. waiting in an immediate
+    // INPUT.
+    if (is_runnning) {
+        return;
+    }
     this->frag = std::make_shared<Fragment>();
-    this->frag_mini = std::make_shared<Fragment>();
+    this->session->clear();
+    this->input_channel->clear();
     this->ui->result_browser->clear();
     this->ui->ast_browser->clear();
     this->ui->code_browser->clear();
@@ -187,18 +271,19 @@ void MainWindow::keyPressEvent(QKeyEvent *event) {
     if (event->key() == Qt::Key_Return) {
         auto command = this->ui->input->text();
         this->ui->input->clear();
-        if (is_runnning) {
-            if (!is_inputting) {
-                return;
-            }
-
-            if (command.startsWith("? ")) {
-                qDebug() << "[main] send input to the worker thread";
-                sendInput(command.sliced(2));
-            } else {
+        if (command.startsWith("? ")) {
+            // Input may be given ahead, while a program runs or before it
+            // starts. The line is one answer, as typed.
+            qDebug() << "[main] queue input for the worker thread";
+            input_channel->push(command.sliced(2).toStdString());
+            is_inputting = false;
+        } else if (is_runnning) {
+            // The only command taken while a program runs.
+            if (command.trimmed() == "STOP") {
+                stop();
+            } else if (is_inputting) {
                 this->ui->input->setText("? ");
             }
-
         } else {
             execute(command.toStdString());
         }
@@ -208,19 +293,28 @@ void MainWindow::keyPressEvent(QKeyEvent *event) {
 void MainWindow::paintEvent(QPaintEvent *event) {
 }
 
-void MainWindow::workerFinish(QString output, QString error, QString ast_out) {
+void MainWindow::workerFinish(QString error, QString ast_out) {
     qDebug() << "[main] worker finished";
-    if (output.isEmpty()) {
-        output = "No output.";
+    // The output was all written before the worker reported.
+    output_timer->stop();
+    showOutput();
+    QTextCursor cursor{this->ui->result_browser->document()};
+    cursor.movePosition(QTextCursor::End);
+    if (!has_output) {
+        cursor.insertText("No output.");
     }
     if (error.isEmpty()) {
         error = "Everything is safe and sound.";
     }
-    auto result = QString{"Output:\n%1\n\nError:\n%2"}.arg(output).arg(error);
-    this->ui->result_browser->setText(result);
+    cursor.insertText(QString{"\n\nError:\n%1"}.arg(error));
     this->ui->ast_browser->setText(ast_out);
 
     is_runnning = false;
+    is_inputting = false;
+    this->ui->btn_stop->setEnabled(false);
+    this->ui->btn_run->setEnabled(true);
+    this->ui->btn_load->setEnabled(true);
+    this->ui->btn_clear->setEnabled(true);
 }
 
 } // namespace basic
@@ -2,46 +2,59 @@
 #include "moc_QBasicInterpreterWorker.cpp"
 
 #include <QDebug>
-#include <QEventLoop>
 
 namespace basic {
-void QBInterpreterWorker::doWork() {
-    qDebug() << "[worker] doWork()";
+void QBInterpreterWorker::runProgram(
+    const std::shared_ptr<Fragment> &frag,
+    std::shared_ptr<const basic_vm::CancelToken> token) {
+    qDebug() << "[worker] runProgram()";
 
-    std::stringstream out{};
+    cancel_token = std::move(token);
+    std::ostream out{output.get()};
     std::stringstream err{};
 
-    auto input_action = [this]() -> std::string {
-        emit requestInput();
-
-        // Start a local event loop to wait for the input.
-        qDebug() << "[worker] waiting for input...";
-        loop->exec();
-
-        return input_str;
-    };
-
-    Interpreter interpreter{frag, out, err, std::move(input_action)};
+    Interpreter interpreter{frag, out, err, [this] { return waitInput(); }};
+    basic_vm::LoopDetectOptions loop_detect_options{};
+    loop_detect_options.enabled = true;
+    interpreter.set_loop_detect_options(loop_detect_options);
+    interpreter.set_cancel_token(cancel_token);
+    interpreter.set_prepared_program(prepared);
 
     interpreter.interpret();
+    prepared = interpreter.get_prepared_program();
 
-    emit resultReady(QString::fromStdString(out.str()),
-                     QString::fromStdString(err.str()),
+    emit resultReady(QString::fromStdString(err.str()),
                      QString::fromStdString(interpreter.show_ast()));
-    this->deleteLater();
 }
 
-void QBInterpreterWorker::receiveInput(QString input) {
-    qDebug() << "[worker] receive input";
-    input_str = input.toStdString();
-    loop->quit();
+void QBInterpreterWorker::runCommand(
+    const std::shared_ptr<Session> &session, const std::string &command,
+    std::shared_ptr<const basic_vm::CancelToken> token) {
+    qDebug() << "[worker] runCommand()";
+
+    cancel_token = std::move(token);
+    std::ostream out{output.get()};
+    std::stringstream err{};
+
+    session->set_cancel_token(cancel_token);
+    auto ast =
+        session->execute(command, out, err, [this] { return waitInput(); });
+
+    emit resultReady(QString::fromStdString(err.str()),
+                     QString::fromStdString(ast));
 }
 
-QBInterpreterWorker::QBInterpreterWorker(const std::shared_ptr<Fragment> &frag,
-                                         QWidget *input_sender)
-    : frag(frag), input_sender(input_sender), loop(new QEventLoop(this)) {
+std::string QBInterpreterWorker::waitInput() {
+    if (input->size() == 0) {
+        qDebug() << "[worker] waiting for input...";
+        emit requestInput();
+    }
+    // Empty if the run is stopped, which the interpreter finds out next.
+    return input->pop(cancel_token.get()).value_or(std::string{});
+}
 
-    connect(dynamic_cast<MainWindow *>(input_sender), &MainWindow::sendInput,
-            this, &QBInterpreterWorker::receiveInput);
+QBInterpreterWorker::QBInterpreterWorker(std::shared_ptr<InputChannel> input,
+                                         std::shared_ptr<OutputChannel> output)
+    : input(std::move(input)), output(std::move(output)) {
 }
 } // namespace basic
@@ -1,10 +1,86 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include <doctest.h>
 
+#include "InputChannel.h"
 #include "Interpreter.h"
+#include "OutputChannel.h"
+#include "Session.h"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <thread>
 
 using namespace basic;
 
+namespace {
+
+/**
+ * @brief How `run_program` sets up the interpreter. The defaults are the
+ * interpreter's.
+ */
+struct RunOptions {
+    Interpreter::ExecMode exec_mode = Interpreter::ExecMode::BYTECODE;
+    basic_vm::OptimizeOptions optimize{};
+    basic_vm::TierOptions tier{};
+    basic_vm::AotOptions aot{};
+    std::ostream *cfg_dump = nullptr;
+    basic_vm::LoopDetectOptions loop_detect{};
+    basic_vm::ExecBudget budget{};
+    std::shared_ptr<const basic_vm::CancelToken> cancel_token{};
+    ParseMode parse_mode = ParseMode::TWO_STAGE;
+    /// Read by `INPUT`, one value per line.
+    std::string input{};
+};
+
+struct RunResult {
+    std::string out{};
+    std::string err{};
+    std::string ast{};
+    basic_vm::TierStats tier_stats{};
+    std::string aot_log{};
+
+    /// Whether the runs printed the same, and left the same AST.
+    bool operator==(const RunResult &other) const {
+        return out == other.out && err == other.err && ast == other.ast;
+    }
+};
+
+std::shared_ptr<Fragment> make_fragment(const std::vector<std::string> &lines) {
+    auto frag = std::make_shared<Fragment>();
+    for (const auto &line : lines) {
+        frag->append(line);
+    }
+    return frag;
+}
+
+RunResult run_program(const std::shared_ptr<Fragment> &frag,
+                      const RunOptions &options = {}) {
+    std::ostringstream out{};
+    std::ostringstream err{};
+    std::istringstream in{options.input};
+    Interpreter inter{frag, out, err, in};
+    inter.set_exec_mode(options.exec_mode);
+    inter.set_optimize_options(options.optimize);
+    inter.set_tier_options(options.tier);
+    inter.set_aot_options(options.aot);
+    inter.set_cfg_dump(options.cfg_dump);
+    inter.set_loop_detect_options(options.loop_detect);
+    inter.set_exec_budget(options.budget);
+    inter.set_cancel_token(options.cancel_token);
+    inter.set_parse_mode(options.parse_mode);
+    inter.interpret();
+    return {out.str(), err.str(), inter.show_ast(), inter.get_tier_stats(),
+            inter.get_aot_log()};
+}
+
+RunResult run_program(const std::vector<std::string> &lines,
+                      const RunOptions &options = {}) {
+    return run_program(make_fragment(lines), options);
+}
+
+} // namespace
+
 TEST_CASE("expression") {
 
     auto frag = std::make_shared<Fragment>();
@@ -223,6 +299,20 @@ TEST_CASE("semantic error") {
         CHECK(err.str() == "line 1:20 Modulus by zero: -2 MOD 0\n");
     }
 
+    SUBCASE("literal out of range") {
+        frag->append("LET x = 99999999999");
+        frag->append("PRINT 1");
+        frag->append("GOTO 99999999999");
+        frag->append("PRINT 2");
+
+        inter.interpret();
+
+        CHECK(out.str() == "1\n2\n");
+        CHECK(err.str() ==
+              "line 1:13 Integer literal out of range: 99999999999\n"
+              "line 3:10 Line number out of range: 99999999999\n");
+    }
+
     SUBCASE("invalid line number") {
         frag->append("IF 2 > 1 THEN 20");
         frag->append("GOTO 30");
@@ -286,3 +376,752 @@ TEST_CASE("syntactic error") {
         CHECK(frag->get_line(100 + 10 * i).value_or("") == ERROR_LINE);
     }
 }
+
+TEST_CASE("syntactic errors among valid lines") {
+    auto frag = std::make_shared<Fragment>();
+    std::ostringstream out{};
+    std::ostringstream err{};
+    Interpreter inter{frag, out, err};
+
+    const std::vector<std::string> lines{
+        "LET a = 1", "PRINT a +", "PRINT a", "GOTO", "REM fine", "LET = 2",
+        "PRINT a * 2"};
+    for (const auto &line : lines) {
+        frag->append(line);
+    }
+    inter.interpret();
+
+    for (std::size_t i = 0; i < lines.size(); ++i) {
+        bool bad = i == 1 || i == 3 || i == 5;
+        CHECK(frag->get_line(100 + 10 * i).value_or("") ==
+              (bad ? ERROR_LINE : lines[i]));
+    }
+    CHECK(out.str() == "1\n2\n");
+}
+
+TEST_CASE("syntactic errors after joined lines") {
+    // Lines 100 and 110 only parse together, and the bad lines are found as
+    // the program reads them.
+    for (auto mode :
+         {ParseMode::TWO_STAGE, ParseMode::LL, ParseMode::HAND_WRITTEN}) {
+        CAPTURE(static_cast<int>(mode));
+        RunOptions options{};
+        options.parse_mode = mode;
+
+        auto frag = make_fragment({"PRINT", "+ 1", "LET =", "PRINT 2"});
+        auto result = run_program(frag, options);
+        CHECK(result.out == "111\n2\n");
+        CHECK(frag->get_line(110).value_or("") == "+ 1");
+        CHECK(frag->get_line(120).value_or("") == ERROR_LINE);
+
+        // Line 100 fails on line 110, which is bad on its own too.
+        frag = make_fragment({"PRINT", "+ 1 )", "PRINT 2"});
+        result = run_program(frag, options);
+        CHECK(result.out == "2\n");
+        CHECK(frag->get_line(100).value_or("") == ERROR_LINE);
+        CHECK(frag->get_line(110).value_or("") == ERROR_LINE);
+    }
+}
+
+TEST_CASE("extra token before an operand") {
+    // ANTLR deletes a single token that can't start an operand if the next
+    // one can, and the hand-written parser does the same.
+    for (auto mode : {ParseMode::TWO_STAGE, ParseMode::HAND_WRITTEN}) {
+        CAPTURE(static_cast<int>(mode));
+        auto frag = make_fragment({"LET x = = 2", "PRINT x + ) 3",
+                                   "PRINT 1 / ) 0", "PRINT ) ) 4",
+                                   "PRINT - ] x"});
+        RunOptions options{};
+        options.parse_mode = mode;
+        auto result = run_program(frag, options);
+
+        CHECK(result.out == "5\n-2\n");
+        // Reported at the deleted token, where the operand starts.
+        CHECK(result.err == "line 3:15 Division by zero: 1 / 0\n");
+        CHECK(frag->get_line(120).value_or("") == "PRINT 1 / ) 0");
+        CHECK(frag->get_line(130).value_or("") == ERROR_LINE);
+    }
+}
+
+TEST_CASE("end of line before an operand") {
+    // The new line is deleted like any other token, so the statement goes on
+    // with the next line, line number included.
+    RunOptions antlr{};
+    auto hand_written = antlr;
+    hand_written.parse_mode = ParseMode::HAND_WRITTEN;
+
+    auto frag = make_fragment({"PRINT", "+ 1", "IF 1 <", "- 5 THEN 150",
+                               "PRINT 1", "PRINT 2"});
+    auto result = run_program(frag, hand_written);
+    CHECK(result.out == "111\n2\n");
+    CHECK(result.err.empty());
+    CHECK(frag->get_line(110).value_or("") == "+ 1");
+    CHECK(result == run_program(frag, antlr));
+
+    // Line 110 parses on its own, but not after line 100.
+    const std::vector<std::string> bad{"LET x = 2 *", "REM three", "PRINT 3"};
+    result = run_program(bad, hand_written);
+    CHECK(result.out == "3\n");
+    CHECK(result == run_program(bad, antlr));
+}
+
+TEST_CASE("prepared program") {
+    using ExecMode = Interpreter::ExecMode;
+    std::ifstream test_ifs{"test_cases/fibonacci.in"};
+    auto frag = std::make_shared<Fragment>(Fragment::read_stream(test_ifs));
+    REQUIRE(frag->size() == 11);
+
+    std::stringstream ast_ss{};
+    std::fstream ast_fs{"test_cases/fibonacci.ast", std::ios::in};
+    REQUIRE(ast_fs.is_open());
+    ast_ss << ast_fs.rdbuf();
+
+    std::shared_ptr<PreparedProgram> prepared{};
+    std::string first_out{};
+    // Later runs reuse the parse, and start with fresh counters.
+    for (auto mode : {ExecMode::TREE_WALK, ExecMode::BYTECODE,
+                      ExecMode::TREE_WALK}) {
+        CAPTURE(static_cast<int>(mode));
+        std::ostringstream out{};
+        std::ostringstream err{};
+        Interpreter inter{frag, out, err};
+        inter.set_exec_mode(mode);
+        inter.set_prepared_program(prepared);
+        inter.interpret();
+        if (prepared) {
+            CHECK(inter.get_prepared_program() == prepared);
+            CHECK(out.str() == first_out);
+        }
+        prepared = inter.get_prepared_program();
+        first_out = out.str();
+        CHECK(err.str() == "");
+        CHECK(inter.show_ast() == ast_ss.str());
+    }
+
+    // An edit is parsed again.
+    frag->insert(95, "PRINT 7");
+    std::ostringstream out{};
+    std::ostringstream err{};
+    Interpreter inter{frag, out, err};
+    inter.set_prepared_program(prepared);
+    inter.interpret();
+    CHECK(inter.get_prepared_program() != prepared);
+    CHECK(out.str() == "7\n" + first_out);
+}
+
+TEST_CASE("two-stage parsing") {
+    std::ifstream test_ifs{"test_cases/fibonacci.in"};
+    auto frag = std::make_shared<Fragment>(Fragment::read_stream(test_ifs));
+    REQUIRE(frag->size() == 11);
+
+    std::ostringstream out{};
+    std::ostringstream err{};
+    Interpreter inter{frag, out, err};
+    inter.interpret();
+    CHECK(inter.get_parse_stats().sll_parses == 1);
+    CHECK(inter.get_parse_stats().ll_parses == 0);
+    auto ast = inter.show_ast();
+
+    // The prepared program is reused.
+    inter.interpret();
+    CHECK(inter.get_parse_stats().sll_parses == 0);
+    CHECK(inter.get_parse_stats().ll_parses == 0);
+
+    SUBCASE("full LL gives the same tree") {
+        Interpreter ll_inter{frag, out, err};
+        ll_inter.set_parse_mode(ParseMode::LL);
+        CHECK(ll_inter.show_ast() == ast);
+        CHECK(ll_inter.get_parse_stats().sll_parses == 0);
+        CHECK(ll_inter.get_parse_stats().ll_parses == 1);
+    }
+
+    SUBCASE("syntax errors fall back to LL") {
+        frag->insert(155, "LET n3 =");
+        inter.interpret();
+        CHECK(frag->get_line(155).value_or("") == ERROR_LINE);
+        // The program, then each line, then the rewritten program.
+        const auto &stats = inter.get_parse_stats();
+        CHECK(stats.sll_parses == 1 + 12 + 1);
+        CHECK(stats.ll_parses == 1 + 1);
+    }
+}
+
+TEST_CASE("parser cache") {
+    std::ifstream test_ifs{"test_cases/fibonacci.in"};
+    auto frag = std::make_shared<Fragment>(Fragment::read_stream(test_ifs));
+    std::ostringstream out{};
+    std::ostringstream err{};
+    auto expected_ast = Interpreter{frag, out, err}.show_ast();
+
+    // Shares the DFA caches with the runs below.
+    auto warm_up = Interpreter::warm_up_parser();
+    std::vector<ParseStats> stats{};
+    std::string ast{};
+    // A thread of its own starts with an empty cache.
+    std::thread runner{[&] {
+        Interpreter inter{frag, out, err};
+        inter.interpret();
+        stats.push_back(inter.get_parse_stats());
+        ast = inter.show_ast();
+
+        frag->insert(155, "LET n3 =");
+        inter.interpret();
+        stats.push_back(inter.get_parse_stats());
+        frag->remove(155);
+        inter.interpret();
+        stats.push_back(inter.get_parse_stats());
+    }};
+    runner.join();
+    warm_up.get();
+
+    CHECK(ast == expected_ast);
+    REQUIRE(stats.size() == 3);
+    CHECK(stats[0].reused_parsers == 0);
+    // The parser of the failed program finds the bad line, then parses the
+    // rewritten program.
+    CHECK(stats[1].reused_parsers == 2);
+    // The parser of the first program was given back meanwhile.
+    CHECK(stats[2].reused_parsers == 1);
+}
+
+TEST_CASE("hand-written parser") {
+    RunOptions antlr{};
+    antlr.input = "7\n12\n";
+    auto hand_written = antlr;
+    hand_written.parse_mode = ParseMode::HAND_WRITTEN;
+
+    const std::vector<std::vector<std::string>> programs{
+        {"LET a = 10 - 3 + 2", "LET b = 64 / 4 * 2", "LET c = 2 ** 3 ** 2",
+         "PRINT a - -b MOD 5", "PRINT (a + b) * c", "PRINT 0 - 12"},
+        {"INPUT n", "REM read two", "INPUT m", "PRINT n + m", "END"},
+        {"LET x = 99999999999", "GOTO 99999999999", "PRINT y",
+         "IF x > 1 THEN 0"},
+    };
+    for (const auto &program : programs) {
+        CAPTURE(program.front());
+        auto frag = make_fragment(program);
+        CHECK(run_program(frag, hand_written) == run_program(frag, antlr));
+    }
+
+    std::ifstream test_ifs{"test_cases/fibonacci.in"};
+    auto frag = std::make_shared<Fragment>(Fragment::read_stream(test_ifs));
+    CHECK(run_program(frag, hand_written) == run_program(frag, antlr));
+
+    std::ostringstream out{};
+    std::ostringstream err{};
+    Interpreter inter{frag, out, err};
+    inter.set_exec_mode(Interpreter::ExecMode::BYTECODE);
+    inter.set_parse_mode(ParseMode::HAND_WRITTEN);
+    inter.interpret();
+    CHECK(inter.get_parse_stats().hand_written_parses == 1);
+    CHECK(inter.get_parse_stats().sll_parses == 0);
+    CHECK(inter.get_parse_stats().ll_parses == 0);
+
+    SUBCASE("the parsed program is reused") {
+        inter.interpret();
+        CHECK(inter.get_parse_stats().hand_written_parses == 0);
+    }
+
+    SUBCASE("bad lines are rewritten") {
+        frag->insert(155, "LET n3 =");
+        frag->insert(156, "PRINT (1");
+        inter.interpret();
+        CHECK(frag->get_line(155).value_or("") == ERROR_LINE);
+        CHECK(frag->get_line(156).value_or("") == ERROR_LINE);
+        // The program, then the rewritten program.
+        CHECK(inter.get_parse_stats().hand_written_parses == 2);
+        CHECK(inter.get_parse_stats().sll_parses == 0);
+    }
+}
+
+TEST_CASE("bytecode agrees with tree walker") {
+    using ExecMode = Interpreter::ExecMode;
+
+    RunOptions tree_walk{ExecMode::TREE_WALK, {false}};
+    tree_walk.input = "7\n\nabc\n12\n";
+    auto bytecode = tree_walk;
+    bytecode.exec_mode = ExecMode::BYTECODE;
+    auto aot = tree_walk;
+    aot.exec_mode = ExecMode::AOT;
+    auto folded = bytecode;
+    folded.optimize = {true};
+    // Errors found by folding are reported before the program runs.
+    auto sorted_lines = [](const std::string &text) {
+        std::istringstream is{text};
+        std::vector<std::string> lines{};
+        for (std::string line; std::getline(is, line);) {
+            lines.push_back(line);
+        }
+        std::sort(lines.begin(), lines.end());
+        return lines;
+    };
+
+    const std::vector<std::vector<std::string>> programs{
+        {"LET a = 3", "LET b = a * a - -a", "PRINT b / 2", "PRINT b MOD -5",
+         "PRINT (a + b) ** 3"},
+        {"INPUT n", "INPUT m", "INPUT m", "INPUT m", "PRINT n + m"},
+        {"LET i = 0", "REM loop", "LET s = s + i", "LET i = i + 1",
+         "IF i < 10 THEN 110", "PRINT s", "GOTO 0", "PRINT i"},
+        {"LET s = 0", "LET i = 0", "LET s = s + i * i", "LET i = i + 1",
+         "IF i < 10 THEN 120", "PRINT s", "IF s = 285 THEN 999"},
+        {"PRINT x / 0 + y MOD 0", "PRINT 1 / 0 + 2 MOD 0 + 3 ** -1",
+         "LET z = (x + 1) / 0", "IF z > 1 THEN 100", "___ERROR___",
+         "PRINT z"},
+        {"LET a = 1", "LET b = a + a + a", "INPUT c", "LET a = b * c",
+         "PRINT a + d", "LET d = a", "PRINT d - b"},
+        {"LET a = a + 1", "LET b = c", "IF 3 > x THEN 999", "IF x = y THEN 100",
+         "LET x = 2", "LET y = x", "LET x = 1 + x", "LET y = y - 1",
+         "IF y < x THEN 200", "PRINT 0", "IF 5 > x THEN 160", "PRINT x",
+         "IF x = x THEN 0"},
+        // Hot enough to be compiled to native code where that is available.
+        {"LET i = 0", "LET s = 0", "LET s = s + i * i - i / 3 + i MOD 7",
+         "LET t = s MOD 1000", "IF t > 500 THEN 160", "LET s = s - t",
+         "LET i = i + 1", "IF i < 5000 THEN 120", "PRINT s", "PRINT t"},
+        // Overflow wraps around, and the minimum divided by -1 doesn't trap.
+        {"LET m = 0 - 2147483647 - 1", "PRINT m - 1", "PRINT -m",
+         "PRINT m / -1", "PRINT m MOD -1", "PRINT m MOD 7",
+         "PRINT 65536 * 65536 + 1", "PRINT 3 ** 21"},
+        // Registers of a failed operand are reused by the next one.
+        {"LET y = 4", "PRINT (1 + x) + 2 / 0", "PRINT (1 + x) - y / 0",
+         "IF (1 + x) + 0 / 0 > y THEN 100"},
+    };
+
+    for (const auto &program : programs) {
+        CAPTURE(program.front());
+        auto expected = run_program(program, tree_walk);
+        CHECK(run_program(program, bytecode) == expected);
+        CHECK(run_program(program, aot) == expected);
+
+        auto result = run_program(program, folded);
+        CHECK(result.out == expected.out);
+        CHECK(sorted_lines(result.err) == sorted_lines(expected.err));
+        CHECK(result.ast == expected.ast);
+    }
+}
+
+TEST_CASE("constant folding") {
+    using ExecMode = Interpreter::ExecMode;
+    const RunOptions folded{ExecMode::BYTECODE, {true}};
+    const RunOptions not_folded{ExecMode::BYTECODE, {false}};
+
+    SUBCASE("arithmetic") {
+        const std::vector<std::string> program{
+            "LET x = 60 * 60 * 24", "PRINT x * 2 + 1 - 1",
+            "PRINT -(-(x)) * 1 + 0", "PRINT 0 - 2147483647 - 1 - 1",
+            "PRINT 7 MOD -3 + -7 / 2"};
+        auto result = run_program(program, folded);
+        CHECK(result.out == "86400\n172800\n86400\n2147483647\n-5\n");
+        CHECK(result.err.empty());
+        CHECK(run_program(program, not_folded) == result);
+    }
+
+    SUBCASE("errors are reported once") {
+        const std::vector<std::string> program{
+            "LET i = 0", "LET y = 1 / 0", "LET i = i + 1", "IF i < 3 THEN 110",
+            "PRINT i"};
+        auto result = run_program(program, folded);
+        CHECK(result.out == "3\n");
+        CHECK(result.err == "line 2:17 Division by zero: 1 / 0\n");
+
+        auto result_nf = run_program(program, not_folded);
+        CHECK(result_nf.out == result.out);
+        CHECK(result_nf.err == "line 2:17 Division by zero: 1 / 0\n"
+                               "line 2:17 Division by zero: 1 / 0\n"
+                               "line 2:17 Division by zero: 1 / 0\n");
+        CHECK(result_nf.ast == result.ast);
+    }
+}
+
+TEST_CASE("strength reduction") {
+    using ExecMode = Interpreter::ExecMode;
+
+    SUBCASE("signs") {
+        auto result = run_program(
+            {"LET a = 7", "LET b = -7", "PRINT a / 2", "PRINT b / 2",
+             "PRINT a / -2", "PRINT b / -2", "PRINT a MOD 2", "PRINT b MOD 2",
+             "PRINT a MOD -2", "PRINT b MOD -2", "PRINT b / 3",
+             "PRINT b MOD 3", "PRINT a MOD -3", "PRINT b ** 3"});
+        CHECK(result.out ==
+              "3\n-3\n-3\n3\n1\n1\n-1\n-1\n-2\n2\n-2\n-343\n");
+        CHECK(result.err.empty());
+    }
+
+    SUBCASE("corpus") {
+        const std::vector<std::string> dividends{
+            "0",           "1",          "-1",   "7",
+            "-7",          "1000",       "-1000", "123456789",
+            "-2147483647", "2147483647", "-2147483647 - 1"};
+        const std::vector<std::string> divisors{
+            "2",    "-2",          "3",          "-3", "7",
+            "-7",   "8",           "-8",         "10", "-10",
+            "641",  "-1024",       "1024",       "-1", "-2147483647",
+            "2147483647", "(-2147483647 - 1)"};
+
+        std::vector<std::string> program{};
+        for (const auto &n : dividends) {
+            program.push_back("LET n = " + n);
+            for (const auto &d : divisors) {
+                program.push_back("PRINT n / " + d);
+                program.push_back("PRINT n MOD " + d);
+            }
+            program.push_back("PRINT n ** 2");
+            program.push_back("PRINT n ** 3");
+        }
+
+        auto expected = run_program(program, {ExecMode::TREE_WALK});
+        CHECK(expected.err.empty());
+        for (auto optimize : {basic_vm::OptimizeOptions{false, false},
+                              basic_vm::OptimizeOptions{false, true},
+                              basic_vm::OptimizeOptions{true, true}}) {
+            CHECK(run_program(program, {ExecMode::BYTECODE, optimize}) ==
+                  expected);
+        }
+    }
+}
+
+TEST_CASE("tiered execution") {
+    const std::vector<std::string> program{"LET i = 0", "LET i = i + 1",
+                                           "IF i < 5000 THEN 110", "PRINT i"};
+    RunOptions options{};
+    options.optimize.solve_counted_loops = false;
+    options.tier = {false};
+    auto cold = run_program(program, options);
+    CHECK(cold.out == "5000\n");
+    CHECK(cold.err.empty());
+    CHECK(cold.tier_stats.interpreted_steps == 10002);
+    CHECK(cold.tier_stats.native_steps == 0);
+    CHECK(cold.tier_stats.promoted == 0);
+
+    options.tier = {};
+    options.tier.hot_threshold = 100;
+    auto hot = run_program(program, options);
+    CHECK(hot == cold);
+    const auto &hot_stats = hot.tier_stats;
+    CHECK(hot_stats.interpreted_steps + hot_stats.native_steps == 10002);
+    if (basic_vm::jit_available()) {
+        CHECK(hot_stats.promoted == 1);
+        CHECK(hot_stats.native_steps > 9000);
+        REQUIRE(hot_stats.hot_lines.size() == 1);
+        CHECK(hot_stats.hot_lines.front() == std::make_pair(110u, 120u));
+    }
+
+    SUBCASE("only jumps back count") {
+        // The latch at 140 runs 1000 times, but jumps back only 20 times.
+        auto loops = run_program({"LET i = 0", "LET k = 0", "LET k = k + 1",
+                                  "LET i = i + 1", "IF i MOD 50 = 0 THEN 120",
+                                  "IF i < 1000 THEN 130", "PRINT k"},
+                                 options);
+        CHECK(loops.out == "21\n");
+        if (basic_vm::jit_available()) {
+            CHECK(loops.tier_stats.promoted == 1);
+            REQUIRE(loops.tier_stats.hot_lines.size() == 1);
+            CHECK(loops.tier_stats.hot_lines.front() ==
+                  std::make_pair(130u, 150u));
+        }
+    }
+}
+
+TEST_CASE("ahead-of-time compilation") {
+    namespace fs = std::filesystem;
+    auto cache_dir = fs::temp_directory_path() / "qbasic-aot-test";
+    fs::remove_all(cache_dir);
+
+    auto frag = make_fragment(
+        {"INPUT n", "LET i = 0", "LET i = i + 1", "PRINT i MOD 3 + x",
+         "IF i < n THEN 120", "PRINT (i - 2147483647 - 4) / (i - 4)",
+         "PRINT 2 ** (i - 4)", "GOTO 15"});
+    RunOptions options{Interpreter::ExecMode::AOT};
+    options.aot.cache_dir = cache_dir;
+    options.input = "3\n";
+
+    auto first = run_program(frag, options);
+    CHECK(first.out == "-2147483648\n");
+    CHECK(first.err == "line 4:21 Undefined variable: x\n"
+                       "line 4:21 Undefined variable: x\n"
+                       "line 4:21 Undefined variable: x\n"
+                       "line 7:16 Unsupported negative exponent: -1\n"
+                       "runtime error: invalid line number: 15\n");
+    if (!basic_vm::aot_available()) {
+        CHECK(!first.aot_log.empty());
+        return;
+    }
+    CHECK(first.aot_log.empty());
+    // The second run loads the same artifact.
+    auto second = run_program(frag, options);
+    CHECK(second == first);
+    CHECK(second.aot_log.empty());
+    auto artifacts = std::distance(fs::directory_iterator{cache_dir},
+                                   fs::directory_iterator{});
+    CHECK(artifacts == 1);
+    fs::remove_all(cache_dir);
+}
+
+TEST_CASE("loop optimizations") {
+    using ExecMode = Interpreter::ExecMode;
+
+    auto frag = make_fragment({
+        "LET n = 1000",            // 100
+        "LET k = 7",               // 110
+        "LET i = 0",               // 120
+        "LET t = i * 2",           // 130, dead
+        "LET q = n / k + n MOD k", // 140, invariant
+        "LET r = (n + z) / k",     // 150, fails each time
+        "LET t = i * 3",           // 160
+        "LET i = i + 1",           // 170
+        "IF i < 50 THEN 130",      // 180
+        "PRINT t + q",             // 190
+    });
+
+    auto expected = run_program(frag, {ExecMode::TREE_WALK});
+    CHECK(expected.out == "295\n");
+    for (auto optimize : {basic_vm::OptimizeOptions{true, true, false, false},
+                          basic_vm::OptimizeOptions{true, true, true, false},
+                          basic_vm::OptimizeOptions{true, true, false, true}}) {
+        CHECK(run_program(frag, {ExecMode::BYTECODE, optimize}) == expected);
+    }
+    CHECK(run_program(frag, {ExecMode::AOT}) == expected);
+
+    std::ostringstream dot{};
+    RunOptions dumped{};
+    dumped.cfg_dump = &dot;
+    CHECK(run_program(frag, dumped) == expected);
+    auto graph = dot.str();
+    CHECK(graph.find("b1 [label=\"130 LET t\\l") != std::string::npos);
+    CHECK(graph.find("count: 50\\l\", peripheries=2") != std::string::npos);
+    CHECK(graph.find("b1 -> b1 [label=\"49\", style=dashed]") !=
+          std::string::npos);
+    CHECK(graph.find("b1 -> b2 [label=\"1\"]") != std::string::npos);
+    CHECK(graph.find("b2 -> exit") != std::string::npos);
+}
+
+TEST_CASE("counted loops") {
+    using ExecMode = Interpreter::ExecMode;
+
+    RunOptions tree_walk{ExecMode::TREE_WALK};
+    tree_walk.optimize.solve_counted_loops = false;
+    RunOptions interpreted{};
+    interpreted.optimize.solve_counted_loops = false;
+    const RunOptions solved{};
+    const RunOptions solved_aot{ExecMode::AOT};
+
+    SUBCASE("sums wrap around") {
+        const std::vector<std::string> program{
+            "LET n = 100000", "LET i = 0", "LET s = 0",
+            "LET s = s + 2 * i + 1", "LET t = i - n", "LET i = i + 1",
+            "IF i < n THEN 130", "PRINT s", "PRINT t", "PRINT i"};
+        auto expected = run_program(program, tree_walk);
+        // n * n modulo 2^32.
+        CHECK(expected.out == "1410065408\n-1\n100000\n");
+        CHECK(run_program(program, interpreted) == expected);
+        CHECK(run_program(program, solved) == expected);
+        CHECK(run_program(program, solved_aot) == expected);
+    }
+
+    SUBCASE("edge cases") {
+        const std::vector<std::vector<std::string>> programs{
+            // The counter wraps around before the loop ends.
+            {"LET s = 0", "LET i = 2147483000", "LET s = s + i",
+             "LET i = i + 500", "IF i > 0 THEN 120", "PRINT s", "PRINT i"},
+            // s is not defined the first time.
+            {"LET i = 10", "LET s = s + i", "LET i = i - 1",
+             "IF 0 < i THEN 110", "PRINT i"},
+            {"LET i = 3", "LET i = i - 1", "IF i = 2 THEN 110", "PRINT i"},
+            {"LET i = 5", "LET k = 3", "LET i = i - k", "IF i > -3 THEN 120",
+             "PRINT i"},
+        };
+        for (const auto &program : programs) {
+            CAPTURE(program.front());
+            CHECK(run_program(program, solved) ==
+                  run_program(program, tree_walk));
+        }
+    }
+
+    SUBCASE("the statement limit is kept") {
+        const std::vector<std::string> program{
+            "LET s = 0", "LET i = 0", "LET s = s + i", "LET i = i + 1",
+            "IF i < 1000000 THEN 120", "PRINT s"};
+        auto limited = interpreted;
+        limited.budget.max_steps = 10000;
+        auto solved_limited = solved;
+        solved_limited.budget.max_steps = 10000;
+
+        auto expected = run_program(program, limited);
+        CHECK(expected.out.empty());
+        CHECK(expected.err ==
+              "runtime error: statement limit exceeded: 10000 statements\n");
+        // The loop runs step by step instead of at once.
+        CHECK(run_program(program, solved_limited) == expected);
+    }
+}
+
+TEST_CASE("infinite loop detection") {
+    for (bool native : {false, true}) {
+        CAPTURE(native);
+        RunOptions detected{};
+        detected.tier.native = native;
+        detected.loop_detect.enabled = true;
+        auto not_detected = detected;
+        not_detected.loop_detect.enabled = false;
+
+        // i goes 1, 2, 3, 0, 1, ...
+        auto looping = run_program({"LET i = 0", "LET i = i + 1",
+                                    "IF i < 3 THEN 110", "LET i = 0",
+                                    "GOTO 110", "PRINT i"},
+                                   detected);
+        CHECK(looping.out.empty());
+        CHECK(looping.err ==
+              "runtime error: infinite loop detected at line 110\n");
+
+        // Runs long, but ends.
+        const std::vector<std::string> program{
+            "LET i = 0",           "LET j = 0",     "LET j = j + 1",
+            "IF j < 100 THEN 120", "LET i = i + 1", "IF i < 1000 THEN 110",
+            "PRINT i"};
+        auto expected = run_program(program, not_detected);
+        CHECK(expected.out == "1000\n");
+        CHECK(run_program(program, detected) == expected);
+    }
+}
+
+TEST_CASE("execution budget") {
+    using ExecMode = Interpreter::ExecMode;
+
+    auto frag = make_fragment({"LET i = 0", "LET i = i + 1", "GOTO 110"});
+
+    for (auto [mode, native] : {std::make_pair(ExecMode::TREE_WALK, false),
+                                std::make_pair(ExecMode::BYTECODE, false),
+                                std::make_pair(ExecMode::BYTECODE, true)}) {
+        CAPTURE(static_cast<int>(mode));
+        CAPTURE(native);
+        RunOptions base{mode};
+        base.tier.native = native;
+
+        auto steps = base;
+        steps.budget.max_steps = 10000;
+        CHECK(run_program(frag, steps).err ==
+              "runtime error: statement limit exceeded: 10000 statements\n");
+
+        auto time = base;
+        time.budget.max_time = std::chrono::milliseconds{20};
+        CHECK(run_program(frag, time).err ==
+              "runtime error: time limit exceeded: 20 ms\n");
+
+        // Cancelled from another thread while it runs.
+        auto token = std::make_shared<basic_vm::CancelToken>();
+        auto cancelled = base;
+        cancelled.cancel_token = token;
+        std::thread canceller{[token] {
+            std::this_thread::sleep_for(std::chrono::milliseconds{20});
+            token->cancel();
+        }};
+        CHECK(run_program(frag, cancelled).err == "runtime error: stopped\n");
+        canceller.join();
+    }
+}
+
+TEST_CASE("immediate mode") {
+    Session session{};
+    std::vector<std::string> inputs{"7", "8"};
+    std::size_t inputs_read = 0;
+    auto execute = [&](const std::string &command) {
+        std::ostringstream out{};
+        std::ostringstream err{};
+        session.execute(command, out, err,
+                        [&] { return inputs.at(inputs_read++); });
+        return std::make_pair(out.str(), err.str());
+    };
+
+    using Result = std::pair<std::string, std::string>;
+    CHECK(execute("LET a = 6") == Result{});
+    CHECK(execute("INPUT b") == Result{});
+    CHECK(execute("PRINT a * b") == Result{"42\n", ""});
+    // Earlier commands are not run again, so INPUT b is not asked again.
+    CHECK(execute("INPUT c") == Result{});
+    CHECK(inputs_read == 2);
+    CHECK(execute("PRINT c - a") == Result{"2\n", ""});
+    CHECK(session.get_var_env()->get_ref_time("a") == 2);
+
+    CHECK(execute("PRINT d") ==
+          Result{"", "line 1:11 Undefined variable: d\n"});
+    session.clear();
+    CHECK(execute("PRINT a") ==
+          Result{"", "line 1:11 Undefined variable: a\n"});
+
+    // A jump could only land on the command again.
+    CHECK(execute("GOTO 100") ==
+          Result{"", "runtime error: GOTO can't be run as a command\n"});
+    CHECK(execute("IF 1 = 1 THEN 100") ==
+          Result{"", "runtime error: IF can't be run as a command\n"});
+}
+
+TEST_CASE("input channel") {
+    InputChannel channel{};
+
+    SUBCASE("lines queued ahead") {
+        channel.push("3");
+        channel.push("4");
+        auto frag = std::make_shared<Fragment>();
+        frag->append("INPUT a");
+        frag->append("INPUT b");
+        frag->append("PRINT a * b");
+        std::ostringstream out{};
+        std::ostringstream err{};
+        Interpreter inter{frag, out, err,
+                          [&] { return channel.pop().value_or(""); }};
+        inter.interpret();
+        CHECK(out.str() == "12\n");
+        CHECK(err.str().empty());
+        CHECK(channel.size() == 0);
+    }
+
+    SUBCASE("waiting for a line") {
+        std::optional<std::string> line{};
+        std::thread reader{[&] { line = channel.pop(); }};
+        channel.push("5");
+        reader.join();
+        CHECK(line == "5");
+    }
+
+    SUBCASE("cancelled while waiting") {
+        basic_vm::CancelToken token{};
+        std::optional<std::string> line{"not read"};
+        std::thread reader{[&] { line = channel.pop(&token); }};
+        token.cancel();
+        channel.wake();
+        reader.join();
+        CHECK_FALSE(line.has_value());
+    }
+}
+
+TEST_CASE("output channel") {
+    OutputChannel channel{};
+    std::ostream out{&channel};
+
+    auto frag = std::make_shared<Fragment>();
+    frag->append("LET i = 0");
+    frag->append("LET i = i + 1");
+    frag->append("PRINT i");
+    frag->append("IF i < 1000 THEN 110");
+
+    std::string expected{};
+    for (int i = 1; i <= 1000; ++i) {
+        expected += std::to_string(i) + "\n";
+    }
+
+    // Taken in pieces while the program runs.
+    std::string taken{};
+    std::atomic<bool> done{false};
+    std::thread runner{[&] {
+        std::ostringstream err{};
+        Interpreter inter{frag, out, err};
+        inter.interpret();
+        done = true;
+    }};
+    while (!done) {
+        taken += channel.take();
+    }
+    runner.join();
+    taken += channel.take();
+    CHECK(taken == expected);
+    CHECK(channel.take().empty());
+}